@@ -11,6 +11,23 @@ See SDL_FontCache.h for license info.
 #include <stdlib.h>
 #include <string.h>
 
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #include <emmintrin.h>
+    #define FC_USE_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    #include <arm_neon.h>
+    #define FC_USE_NEON
+#endif
+
+// Font sources map their file where there's mmap(), and read it into memory with SDL elsewhere
+#if defined(__unix__) || defined(__APPLE__)
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+    #define FC_USE_MMAP
+#endif
+
 
 #define FC_GET_ALPHA(sdl_color) ((sdl_color).a)
 
@@ -22,12 +39,15 @@ See SDL_FontCache.h for license info.
 { \
     va_list lst; \
     va_start(lst, start_args); \
-    vsnprintf(buffer, fc_buffer_size, start_args, lst); \
+    vsnprintf(buffer, fc_format_buffer.size, start_args, lst); \
     va_end(lst); \
 }
 
-// Extra pixels of padding around each glyph to avoid linear filtering artifacts
+// Extra pixels of padding around each glyph, so filtering doesn't pick up its neighbors.  Nearest filtering
+// only needs the glyphs kept apart.  Linear filtering blends in texels past the edge at fractional positions,
+// and more of them as glyphs are scaled down.
 #define FC_CACHE_PADDING 1
+#define FC_CACHE_PADDING_LINEAR 2
 
 
 
@@ -67,27 +87,52 @@ static char* new_concat(const char* a, const char* b)
     return new_string;
 }
 
-static char* replace_concat(char** a, const char* b)
-{
-    char* new_string = new_concat(*a, b);
-    free(*a);
-    *a = new_string;
-    return *a;
-}
-
 
 // Width of a tab in units of the space width (sorry, no tab alignment!)
 static unsigned int fc_tab_width = 4;
 
-// Shared buffer for variadic text
-static char* fc_buffer = nullptr;
+// Size of the per-thread buffer for variadic text
 static unsigned int fc_buffer_size = 1024;
 
+// Each thread formats into its own buffer, so measuring with FC_Get*() on other threads doesn't clobber the text being drawn
+struct FC_FormatBuffer
+{
+    char* data;
+    unsigned int size;
+
+    ~FC_FormatBuffer()
+    {
+        free(data);
+    }
+};
+
+static thread_local FC_FormatBuffer fc_format_buffer = {nullptr, 0};
+
+static char* FC_GetFormatBuffer(void)
+{
+    unsigned int size = fc_buffer_size;
+    if(fc_format_buffer.data == nullptr || fc_format_buffer.size != size)
+    {
+        char* data = (char*)realloc(fc_format_buffer.data, size);
+        if(data == nullptr)
+            return nullptr;
+        fc_format_buffer.data = data;
+        fc_format_buffer.size = size;
+    }
+    return fc_format_buffer.data;
+}
+
 static Uint8 fc_has_render_target_support = 0;
 
 // The number of fonts that has been created but not freed
 static int NUM_EXISTING_FONTS = 0;
 
+// Guards NUM_EXISTING_FONTS and the strings below, so fonts can be made and freed on several threads
+static SDL_SpinLock fc_strings_lock = 0;
+
+// SDL_ttf makes and frees every face with one FreeType library, which can't do that on two threads at once
+static SDL_SpinLock fc_ttf_lock = 0;
+
 // Globals for GetString functions
 static char* ASCII_STRING = nullptr;
 static char* LATIN_1_STRING = nullptr;
@@ -95,6 +140,8 @@ static char* ASCII_LATIN_1_STRING = nullptr;
 
 char* FC_GetStringASCII(void)
 {
+    char* result;
+    SDL_AtomicLock(&fc_strings_lock);
     if(ASCII_STRING == nullptr)
     {
         int i;
@@ -112,11 +159,15 @@ char* FC_GetStringASCII(void)
             ++c;
         }
     }
-    return U8_strdup(ASCII_STRING);
+    result = U8_strdup(ASCII_STRING);
+    SDL_AtomicUnlock(&fc_strings_lock);
+    return result;
 }
 
 char* FC_GetStringLatin1(void)
 {
+    char* result;
+    SDL_AtomicLock(&fc_strings_lock);
     if(LATIN_1_STRING == nullptr)
     {
         int i;
@@ -146,15 +197,28 @@ char* FC_GetStringLatin1(void)
             ++c;
         }
     }
-    return U8_strdup(LATIN_1_STRING);
+    result = U8_strdup(LATIN_1_STRING);
+    SDL_AtomicUnlock(&fc_strings_lock);
+    return result;
 }
 
 char* FC_GetStringASCII_Latin1(void)
 {
+    // Get the parts first, since they take the lock themselves
+    char* ascii = FC_GetStringASCII();
+    char* latin1 = FC_GetStringLatin1();
+    char* result;
+
+    SDL_AtomicLock(&fc_strings_lock);
     if(ASCII_LATIN_1_STRING == nullptr)
-		ASCII_LATIN_1_STRING = new_concat(FC_GetStringASCII(), FC_GetStringLatin1());
+		ASCII_LATIN_1_STRING = new_concat(ascii, latin1);
 
-    return U8_strdup(ASCII_LATIN_1_STRING);
+    result = U8_strdup(ASCII_LATIN_1_STRING);
+    SDL_AtomicUnlock(&fc_strings_lock);
+
+    free(ascii);
+    free(latin1);
+    return result;
 }
 
 FC_Effect FC_MakeEffect(FC_AlignEnum alignment, FC_Scale scale, SDL_Color color)
@@ -178,134 +242,402 @@ FC_GlyphData FC_MakeGlyphData(int cache_level, Sint16 x, Sint16 y, Uint16 w, Uin
     gd.rect.h = h;
     gd.cache_level = cache_level;
 
+    // Without SDL_ttf's metrics, the glyph is as big as its rect and sits on the baseline
+    gd.metrics.minx = 0;
+    gd.metrics.maxx = w;
+    gd.metrics.miny = 0;
+    gd.metrics.maxy = h;
+    gd.metrics.advance = w;
+
     return gd;
 }
 
-// Enough to hold all of the ascii characters and some.
-#define FC_DEFAULT_NUM_BUCKETS 300
+// Initial number of hash table slots.  Always a power of two.
+#define FC_MAP_INITIAL_CAPACITY 128
+
+// ASCII and Latin-1 are looked up directly instead of hashed
+#define FC_MAP_DIRECT_SIZE 256
 
-typedef struct FC_MapNode
+typedef struct FC_MapSlot
 {
-    Uint32 key;
+    Uint32 key;  // 0 marks an empty slot.  Codepoint 0 is always stored directly.
     FC_GlyphData value;
-    struct FC_MapNode* next;
 
-} FC_MapNode;
+} FC_MapSlot;
 
 typedef struct FC_Map
 {
-    int num_buckets;
-    FC_MapNode** buckets;
+    Uint8 direct_used[FC_MAP_DIRECT_SIZE];
+    FC_GlyphData direct[FC_MAP_DIRECT_SIZE];
+    int num_direct;
+
+    // Open addressing with linear probing, kept at most half full
+    int capacity;
+    int count;
+    FC_MapSlot* slots;
 } FC_Map;
 
 
+// Returns the U+0000 - U+00FF value for codepoints that live in the direct table, or -1.
+static inline int FC_MapDirectIndex(Uint32 codepoint)
+{
+    if(codepoint < 0x80)
+        return (int)codepoint;
+
+    // Two-byte UTF-8 (0xC2 or 0xC3 lead byte) as packed by FC_GetCodepointFromUTF8()
+    if(codepoint >= 0xC280 && codepoint <= 0xC3BF && (codepoint & 0xC0) == 0x80)
+        return (int)(((codepoint >> 8) & 0x03) << 6 | (codepoint & 0x3F));
+
+    return -1;
+}
 
-static FC_Map* FC_MapCreate(int num_buckets)
+static inline Uint32 FC_MapDirectKey(int index)
 {
-    int i;
-    FC_Map* map = (FC_Map*)malloc(sizeof(FC_Map));
+    if(index < 0x80)
+        return (Uint32)index;
 
-    map->num_buckets = num_buckets;
-    map->buckets = (FC_MapNode**)malloc(num_buckets * sizeof(FC_MapNode*));
+    return (Uint32)((0xC0 | (index >> 6)) << 8 | (0x80 | (index & 0x3F)));
+}
 
-    for(i = 0; i < num_buckets; ++i)
-    {
-        map->buckets[i] = nullptr;
-    }
+static inline Uint32 FC_MapHash(Uint32 codepoint)
+{
+    Uint32 h = codepoint * 0x9E3779B1u;
+    return h ^ (h >> 16);
+}
+
+static FC_MapSlot* FC_MapAllocSlots(int capacity)
+{
+    return (FC_MapSlot*)calloc(capacity, sizeof(FC_MapSlot));
+}
+
+static FC_Map* FC_MapCreate(void)
+{
+    FC_Map* map = (FC_Map*)calloc(1, sizeof(FC_Map));
+    if(map == nullptr)
+        return nullptr;
+
+    map->capacity = FC_MAP_INITIAL_CAPACITY;
+    map->slots = FC_MapAllocSlots(map->capacity);
 
     return map;
 }
 
 static void FC_MapFree(FC_Map* map)
 {
-    int i;
     if(map == nullptr)
         return;
 
-    // Go through each bucket
-    for(i = 0; i < map->num_buckets; ++i)
+    free(map->slots);
+    free(map);
+}
+
+// Returns the slot holding 'codepoint' or the empty slot where it belongs.
+static FC_MapSlot* FC_MapProbe(FC_MapSlot* slots, int capacity, Uint32 codepoint)
+{
+    Uint32 mask = (Uint32)capacity - 1;
+    Uint32 index = FC_MapHash(codepoint) & mask;
+
+    while(slots[index].key != 0 && slots[index].key != codepoint)
+        index = (index + 1) & mask;
+
+    return &slots[index];
+}
+
+static Uint8 FC_MapGrow(FC_Map* map)
+{
+    int i;
+    int new_capacity = map->capacity * 2;
+    FC_MapSlot* new_slots = FC_MapAllocSlots(new_capacity);
+    if(new_slots == nullptr)
+        return 0;
+
+    for(i = 0; i < map->capacity; ++i)
     {
-        // Delete the nodes in order
-        FC_MapNode* node = map->buckets[i];
-        while(node != nullptr)
-        {
-            FC_MapNode* last = node;
-            node = node->next;
-            free(last);
-        }
+        if(map->slots[i].key != 0)
+            *FC_MapProbe(new_slots, new_capacity, map->slots[i].key) = map->slots[i];
     }
 
-    free(map->buckets);
-    free(map);
+    free(map->slots);
+    map->slots = new_slots;
+    map->capacity = new_capacity;
+    return 1;
 }
 
-// Note: Does not handle duplicates in any special way.
+// Replaces the stored glyph if the codepoint is already present.
+// Note: The returned pointer is only valid until the next insertion.
 static FC_GlyphData* FC_MapInsert(FC_Map* map, Uint32 codepoint, FC_GlyphData glyph)
 {
-    Uint32 index;
-    FC_MapNode* node;
+    int direct;
+    FC_MapSlot* slot;
     if(map == nullptr)
         return nullptr;
 
-    // Get index for bucket
-    index = codepoint % map->num_buckets;
-
-    // If this bucket is empty, create a node and return its value
-    if(map->buckets[index] == nullptr)
+    direct = FC_MapDirectIndex(codepoint);
+    if(direct >= 0)
     {
-        node = map->buckets[index] = (FC_MapNode*)malloc(sizeof(FC_MapNode));
-        node->key = codepoint;
-        node->value = glyph;
-        node->next = nullptr;
-        return &node->value;
+        if(!map->direct_used[direct])
+        {
+            map->direct_used[direct] = 1;
+            map->num_direct++;
+        }
+        map->direct[direct] = glyph;
+        return &map->direct[direct];
     }
 
-    for(node = map->buckets[index]; node != nullptr; node = node->next)
+    if(map->slots == nullptr)
+        return nullptr;
+
+    slot = FC_MapProbe(map->slots, map->capacity, codepoint);
+    if(slot->key == 0)
     {
-        // Find empty node and add a new one on.
-        if(node->next == nullptr)
+        // Keep the load factor at or below 1/2 so probe runs stay short
+        if((map->count + 1) * 2 > map->capacity)
         {
-            node->next = (FC_MapNode*)malloc(sizeof(FC_MapNode));
-            node = node->next;
-
-            node->key = codepoint;
-            node->value = glyph;
-            node->next = nullptr;
-            return &node->value;
+            if(!FC_MapGrow(map))
+                return nullptr;
+            slot = FC_MapProbe(map->slots, map->capacity, codepoint);
         }
+
+        slot->key = codepoint;
+        map->count++;
     }
 
-    return nullptr;
+    slot->value = glyph;
+    return &slot->value;
 }
 
 static FC_GlyphData* FC_MapFind(FC_Map* map, Uint32 codepoint)
 {
-    Uint32 index;
-    FC_MapNode* node;
+    int direct;
+    FC_MapSlot* slot;
     if(map == nullptr)
         return nullptr;
 
-    // Get index for bucket
-    index = codepoint % map->num_buckets;
+    direct = FC_MapDirectIndex(codepoint);
+    if(direct >= 0)
+        return (map->direct_used[direct]? &map->direct[direct] : nullptr);
+
+    if(map->slots == nullptr)
+        return nullptr;
+
+    slot = FC_MapProbe(map->slots, map->capacity, codepoint);
+    return (slot->key != 0? &slot->value : nullptr);
+}
+
+// Forgets every glyph stored on the given cache level
+static Uint8 FC_MapRemoveCacheLevel(FC_Map* map, int cache_level)
+{
+    int i;
+    FC_MapSlot* new_slots;
+    if(map == nullptr || map->slots == nullptr)
+        return 0;
+
+    // Linear probing can't leave holes in a probe run, so rehash whatever is left
+    new_slots = FC_MapAllocSlots(map->capacity);
+    if(new_slots == nullptr)
+        return 0;
 
-    // Go through list until we find a match
-    for(node = map->buckets[index]; node != nullptr; node = node->next)
+    map->count = 0;
+    for(i = 0; i < map->capacity; ++i)
     {
-        if(node->key == codepoint)
-            return &node->value;
+        if(map->slots[i].key != 0 && map->slots[i].value.cache_level != cache_level)
+        {
+            *FC_MapProbe(new_slots, map->capacity, map->slots[i].key) = map->slots[i];
+            map->count++;
+        }
     }
+    free(map->slots);
+    map->slots = new_slots;
 
-    return nullptr;
+    for(i = 0; i < FC_MAP_DIRECT_SIZE; ++i)
+    {
+        if(map->direct_used[i] && map->direct[i].cache_level == cache_level)
+        {
+            map->direct_used[i] = 0;
+            map->num_direct--;
+        }
+    }
+    return 1;
+}
+
+static unsigned int FC_MapCount(FC_Map* map)
+{
+    if(map == nullptr)
+        return 0;
+
+    return map->num_direct + map->count;
+}
+
+// Copies every stored key into 'result', which must hold FC_MapCount() entries.
+static void FC_MapGetKeys(FC_Map* map, Uint32* result)
+{
+    int i;
+    unsigned int count = 0;
+    if(map == nullptr || result == nullptr)
+        return;
+
+    for(i = 0; i < FC_MAP_DIRECT_SIZE; ++i)
+    {
+        if(map->direct_used[i])
+            result[count++] = FC_MapDirectKey(i);
+    }
+
+    for(i = 0; map->slots != nullptr && i < map->capacity; ++i)
+    {
+        if(map->slots[i].key != 0)
+            result[count++] = map->slots[i].key;
+    }
 }
 
 
 
+// Glyph quads collected for one cache level, submitted together with SDL_RenderGeometry
+typedef struct FC_GlyphBatchLevel
+{
+    SDL_Texture* texture;
+    float texture_w;
+    float texture_h;
+
+    int num_vertices;
+    int num_indices;
+    int capacity;  // In quads
+    SDL_Vertex* vertices;
+    int* indices;
+
+} FC_GlyphBatchLevel;
+
+typedef struct FC_GlyphBatch
+{
+    SDL_Color color;  // Vertex color of the quads added next
+    int num_levels;
+    FC_GlyphBatchLevel* levels;
+
+} FC_GlyphBatch;
+
+// Newly rendered glyphs for one cache level, waiting to be copied onto its texture
+typedef struct FC_GlyphUploadLevel
+{
+    SDL_Surface* staging;  // Same size as the cache level; only the pending rects hold glyphs
+    SDL_Rect bounds;  // Union of the pending rects
+
+    int num_rects;
+    int rects_size;
+    SDL_Rect* rects;
+
+} FC_GlyphUploadLevel;
+
+typedef struct FC_GlyphUploads
+{
+    int num_pending;
+    int num_levels;
+    FC_GlyphUploadLevel* levels;
+
+} FC_GlyphUploads;
+
+// Skyline packing state for one cache level: the top edge of the packed area, as segments sorted by x
+typedef struct FC_SkylineNode
+{
+    int x;
+    int y;
+    int w;
+
+} FC_SkylineNode;
+
+typedef struct FC_Skyline
+{
+    int width;
+    int height;
+    Uint32 used_area;  // Pixels taken by packed glyphs and their padding
+    Uint32 last_used;  // font->draw_count when a glyph on this level was last looked up
+
+    int num_nodes;
+    int nodes_size;
+    FC_SkylineNode* nodes;
+
+} FC_Skyline;
+
+// Kerning pairs are asked of SDL_ttf once and kept.  Pairs of loading string characters that live in
+// the direct range of the glyph map go in a dense table, filled when the font is loaded so measuring
+// cached text only reads it.  Any other pair is hashed as it comes up, under the kerning lock.
+#define FC_KERNING_UNKNOWN -32768
+#define FC_KERNING_INITIAL_CAPACITY 64
+
+typedef struct FC_KerningSlot
+{
+    Uint64 key;  // Both packed codepoints, 0 marks an empty slot
+    Sint16 value;
+
+} FC_KerningSlot;
+
+typedef struct FC_Kerning
+{
+    Uint8 enabled;  // TTF_GetFontKerning() when the font was loaded
+
+    int num_dense;
+    Sint16 dense_index[FC_MAP_DIRECT_SIZE];  // Row/column for each direct index, -1 if not in the dense table
+    Sint16* dense;  // num_dense*num_dense values
+
+    SDL_SpinLock lock;  // Held while the hashed pairs are looked up or added, and SDL_ttf is asked for them
+    int capacity;
+    int count;
+    FC_KerningSlot* slots;
+
+} FC_Kerning;
+
+// Finished runs of text that the draw functions keep by their text, box size and effect, so drawing the same
+// text again only has to submit its quads.  Each run is an FC_TextLayout.
+typedef struct FC_RunCacheEntry
+{
+    Uint32 hash;
+    Uint32 bytes;  // Memory the run takes, counted against the cache's limit
+    FC_TextLayout* layout;
+    struct FC_RunCacheEntry* bucket_next;
+    struct FC_RunCacheEntry* newer;
+    struct FC_RunCacheEntry* older;
+
+} FC_RunCacheEntry;
+
+typedef struct FC_RunCache
+{
+    Uint32 max_bytes;  // 0 when the cache is off
+    Uint32 bytes;
+    int num_entries;
+    int num_buckets;  // Always a power of two
+    FC_RunCacheEntry** buckets;
+    FC_RunCacheEntry* newest;
+    FC_RunCacheEntry* oldest;  // Dropped first when the cache is over its limit
+
+} FC_RunCache;
+
+// Inclusive range of Unicode values
+typedef struct FC_CodepointRange
+{
+    Uint32 first;
+    Uint32 last;
+
+} FC_CodepointRange;
+
+// Ranges waiting for FC_WarmGlyphs(), taken from the front a codepoint at a time
+typedef struct FC_WarmQueue
+{
+    int head;  // Index of the first range still queued
+    int count;
+    int size;
+    FC_CodepointRange* ranges;
+    int num_codepoints;  // Left in all of the queued ranges
+
+} FC_WarmQueue;
+
+
+
 struct FC_Font
 {
     SDL_Renderer* renderer;
 
     TTF_Font* ttf_source;  // TTF_Font source of characters
     Uint8 owns_ttf_source;  // Can we delete the TTF_Font ourselves?
+    FC_FontSource* source;  // In-memory font file that ttf_source reads from, if it was loaded from one
+    Uint32 ttf_signature;  // Identifies the face, size and style of the TTF_Font, so saved caches can be checked against it
 
     FC_FilterEnum filter;
 
@@ -324,22 +656,115 @@ struct FC_Font
     // Codepoints are little endian (reversed from UTF-8) so that something like 0x00000005 is ASCII 5 and the map can be indexed by ASCII values
     FC_Map* glyphs;
 
-    FC_GlyphData last_glyph;  // Texture packing cursor
+    FC_GlyphData last_glyph;  // Most recently packed glyph; its cache_level is the level being packed
+    int num_packers;
+    FC_Skyline* packers;  // One per cache level, created when a glyph is first packed there
+    Uint32 generation;  // Bumped whenever cached glyph placement or textures change, so layouts know to rebuild
+    int cache_level_size_hint;  // Requested cache level size, 0 for automatic
+    int cache_level_size;  // Width and height of new cache levels
+    int cache_level_limit;  // Most cache levels to keep before evicting, 0 for no limit
+    FC_CacheFormatEnum cache_format;  // Requested storage for cache levels
+    Uint32 cache_pixel_format;  // Pixel format of new cache levels, or SDL_PIXELFORMAT_UNKNOWN for the source's format
+    Uint32 draw_count;  // Bumped by every submitted draw, to tell which levels were used recently
     int glyph_cache_size;
     int glyph_cache_count;
     SDL_Texture** glyph_cache;
 
     char* loading_string;
+    int num_loading_ranges;
+    FC_CodepointRange* loading_ranges;  // Loaded along with the loading string
+    FC_WarmQueue warm_queue;
+
+    FC_GlyphBatch batch;  // Reused by the draw functions so each call doesn't have to allocate
+    FC_GlyphUploads uploads;  // Lazily loaded glyphs that haven't reached their cache textures yet
+    FC_Kerning kerning;
+
+    // Color runs of the text being drawn by FC_DrawTextRuns() or FC_DrawTextBoxRuns()
+    const char* run_text;
+    const FC_ColorRun* runs;
+    int num_runs;
+    SDL_Color run_base_color;  // For text before the first run
+    SDL_Color run_color;  // What the cache textures are modulated to, when drawing glyph by glyph
+
+    FC_Atlas* atlas;  // Shared cache levels that glyphs are packed into instead of this font's, or nullptr
+    FC_Font* fallback;  // Where glyphs missing from ttf_source come from
+
+    Uint8 shadow_cache;  // Keep a copy of each cache level in system memory, for FC_ResetFontFromRendererReset()
+    int num_shadows;
+    SDL_Surface** shadows;  // Per cache level, nullptr where there is no copy
+
+    int distance_field;  // Spread of the signed distance fields that glyphs are stored as, 0 for plain coverage
+    int field_padding;  // Spread the cached glyphs were made with, which they keep as room around them for the falloff
+    void (*distance_field_callback)(FC_Font* font, SDL_Renderer* dest, Uint8 begin, void* userdata);
+    void* distance_field_userdata;
+
+    FC_RunCache run_cache;
+
+    FC_Stats stats;  // Only the counters; FC_GetStats() fills in the state of the cache
+    SDL_threadID thread;  // Thread that created or last loaded the font, the only one that counts stats and stamps cache levels
+    void (*stats_callback)(FC_Font* font, FC_StatsEventEnum event, Uint32 value, void* userdata);
+    void* stats_userdata;
+
+};
+
+// The shared cache levels live in a font of their own that has no TTF_Font or glyphs.  Its packing cursor,
+// packers, uploads and draw count stand in for those of every font attached to the atlas.
+struct FC_Atlas
+{
+    FC_Font* cache;
+
+    int num_fonts;
+    int fonts_size;
+    FC_Font** fonts;
 
 };
 
+// Returns the font whose cache levels hold the font's glyphs
+static inline FC_Font* FC_GetCacheOwner(FC_Font* font)
+{
+    return (font->atlas != nullptr? font->atlas->cache : font);
+}
+
+// Changes whenever the font's glyphs or the cache levels they live on change
+static inline Uint32 FC_GetFontGeneration(FC_Font* font)
+{
+    return font->generation + (font->atlas != nullptr? font->atlas->cache->generation : 0);
+}
+
+// Lookups and measuring on other threads leave the counters and cache level stamps alone, so they only read the font
+static inline Uint8 FC_IsFontThread(FC_Font* font)
+{
+    return (SDL_ThreadID() == font->thread);
+}
+
+static void FC_NotifyStats(FC_Font* font, FC_StatsEventEnum event, Uint32 value)
+{
+    if(font->stats_callback != nullptr)
+        font->stats_callback(font, event, value, font->stats_userdata);
+}
+
+// Lets the distance field callback bind its shader before the font's glyphs go to the renderer (begin = 1)
+// and put things back after (begin = 0)
+static inline void FC_NotifyDistanceField(FC_Font* font, SDL_Renderer* dest, Uint8 begin)
+{
+    if(font->distance_field_callback != nullptr)
+        font->distance_field_callback(font, dest, begin, font->distance_field_userdata);
+}
+
+// Microseconds since 'start', a value from SDL_GetPerformanceCounter()
+static Uint32 FC_GetMicroseconds(Uint64 start)
+{
+    return (Uint32)((SDL_GetPerformanceCounter() - start) * 1000000 / SDL_GetPerformanceFrequency());
+}
+
 // Private
-static FC_GlyphData* FC_PackGlyphData(FC_Font* font, Uint32 codepoint, Uint16 width, Uint16 maxWidth, Uint16 maxHeight);
+static FC_GlyphData* FC_PackGlyphData(FC_Font* font, Uint32 codepoint, FC_GlyphMetrics metrics, Uint16 width, Uint16 height, Uint16 maxWidth, Uint16 maxHeight);
 
 
-static SDL_Rect FC_RenderLeft(FC_Font* font, SDL_Renderer* dest, int x, int y, FC_Scale scale, const char* text);
-static SDL_Rect FC_RenderCenter(FC_Font* font, SDL_Renderer* dest, int x, int y, FC_Scale scale, const char* text);
-static SDL_Rect FC_RenderRight(FC_Font* font, SDL_Renderer* dest, int x, int y, FC_Scale scale, const char* text);
+static SDL_Rect FC_RenderLeft(FC_Font* font, SDL_Renderer* dest, FC_GlyphBatch* batch, const SDL_Rect* visible, int x, int y, FC_Scale scale, const char* text, int len);
+static Uint8 FC_DrawCachedRun(FC_Font* font, SDL_Renderer* dest, SDL_Rect box, FC_Effect effect, const char* text, int len, SDL_Rect* result);
+static void FC_FreeRunCache(FC_RunCache* cache);
+static SDL_Rect FC_RenderAlignedLines(FC_Font* font, SDL_Renderer* dest, FC_GlyphBatch* batch, const SDL_Rect* visible, int x, int y, FC_Scale scale, FC_AlignEnum align, const char* text, int len);
 
 
 static inline SDL_Surface* FC_CreateSurface32(Uint32 width, Uint32 height)
@@ -352,6 +777,155 @@ static inline SDL_Surface* FC_CreateSurface32(Uint32 width, Uint32 height)
 }
 
 
+// UTF-8 scanning
+
+// U+FFFD, packed like FC_GetCodepointFromUTF8() does.  Stands in for malformed UTF-8.
+#define FC_REPLACEMENT_CODEPOINT 0xEFBFBD
+
+// Returns the first byte at or after 'c' that isn't ASCII, or 'end'.  Checks 16 bytes at a time where SSE2 or NEON is available, 8 otherwise.
+static const char* FC_SkipASCII(const char* c, const char* end)
+{
+#if defined(FC_USE_SSE2)
+    while(end - c >= 16)
+    {
+        if(_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)c)) != 0)
+            break;
+        c += 16;
+    }
+#elif defined(FC_USE_NEON)
+    while(end - c >= 16)
+    {
+        uint64x2_t high_bits = vreinterpretq_u64_u8(vandq_u8(vld1q_u8((const uint8_t*)c), vdupq_n_u8(0x80)));
+        if((vgetq_lane_u64(high_bits, 0) | vgetq_lane_u64(high_bits, 1)) != 0)
+            break;
+        c += 16;
+    }
+#else
+    while(end - c >= 8)
+    {
+        Uint64 word;
+        memcpy(&word, c, sizeof(word));
+        if((word & 0x8080808080808080ull) != 0)
+            break;
+        c += 8;
+    }
+#endif
+
+    while(c < end && (unsigned char)*c < 0x80)
+        ++c;
+    return c;
+}
+
+// Counts characters the way U8_next() steps through them, without going past 'end'
+static int FC_CountCharacters(const char* text, int len)
+{
+    const char* c = text;
+    const char* end = text + len;
+    int result = 0;
+
+    while(c < end)
+    {
+        const char* ascii_end = FC_SkipASCII(c, end);
+        result += ascii_end - c;
+        c = ascii_end;
+        if(c < end)
+        {
+            c = FC_MIN(c + U8_charsize(c), end);
+            ++result;
+        }
+    }
+
+    return result;
+}
+
+// Reads a packed codepoint like FC_GetCodepointFromUTF8(), but checks the sequence and never reads past 'end'.
+// Moves 'c' past the character.  Malformed sequences are skipped a byte at a time, each read as U+FFFD.
+static Uint32 FC_DecodeUTF8(const char** c, const char* end)
+{
+    const unsigned char* s = (const unsigned char*)*c;
+    unsigned char low = 0x80;
+    unsigned char high = 0xBF;
+    Uint32 result;
+    int size, i;
+
+    if(s[0] < 0x80)
+    {
+        ++*c;
+        return s[0];
+    }
+
+    // Lead bytes that would be overlong, surrogates or past U+10FFFF narrow the second byte's range
+    if(s[0] >= 0xC2 && s[0] <= 0xDF)
+        size = 2;
+    else if(s[0] >= 0xE0 && s[0] <= 0xEF)
+    {
+        size = 3;
+        if(s[0] == 0xE0)
+            low = 0xA0;
+        else if(s[0] == 0xED)
+            high = 0x9F;
+    }
+    else if(s[0] >= 0xF0 && s[0] <= 0xF4)
+    {
+        size = 4;
+        if(s[0] == 0xF0)
+            low = 0x90;
+        else if(s[0] == 0xF4)
+            high = 0x8F;
+    }
+    else
+        size = 0;
+
+    if(size == 0 || end - *c < size || s[1] < low || s[1] > high)
+    {
+        ++*c;
+        return FC_REPLACEMENT_CODEPOINT;
+    }
+
+    result = (Uint32)s[0] << 8 | s[1];
+    for(i = 2; i < size; ++i)
+    {
+        if((s[i] & 0xC0) != 0x80)
+        {
+            ++*c;
+            return FC_REPLACEMENT_CODEPOINT;
+        }
+        result = result << 8 | s[i];
+    }
+
+    *c += size;
+    return result;
+}
+
+// Steps through text for the draw and measure loops.  Runs of ASCII are found with FC_SkipASCII() and read
+// a byte at a time, so only multibyte characters go through FC_DecodeUTF8().
+typedef struct FC_TextScan
+{
+    const char* c;
+    const char* end;
+    const char* ascii_end;  // End of the ASCII run that 'c' is in
+} FC_TextScan;
+
+static inline void FC_BeginTextScan(FC_TextScan* scan, const char* text, const char* end)
+{
+    scan->c = scan->ascii_end = text;
+    scan->end = end;
+}
+
+// Returns the next codepoint, newlines included.  Only call while scan->c < scan->end.
+static inline Uint32 FC_NextCodepoint(FC_TextScan* scan)
+{
+    if(scan->c < scan->ascii_end)
+        return (unsigned char)*scan->c++;
+
+    scan->ascii_end = FC_SkipASCII(scan->c, scan->end);
+    if(scan->c < scan->ascii_end)
+        return (unsigned char)*scan->c++;
+
+    return FC_DecodeUTF8(&scan->c, scan->end);
+}
+
+
 char* U8_alloc(unsigned int size)
 {
     char* result;
@@ -383,17 +957,10 @@ char* U8_strdup(const char* string)
 
 int U8_strlen(const char* string)
 {
-    int length = 0;
     if(string == nullptr)
         return 0;
 
-    while(*string != '\0')
-    {
-        string = U8_next(string);
-        ++length;
-    }
-
-    return length;
+    return FC_CountCharacters(string, strlen(string));
 }
 
 int U8_charsize(const char* character)
@@ -535,6 +1102,27 @@ static inline SDL_Rect SDL_RectIntersect(SDL_Rect A, SDL_Rect B)
 	return result;
 }
 
+// The part of the viewport that isn't clipped away, in the coordinates that glyphs are drawn at
+static SDL_Rect get_visible_rect(SDL_Renderer* dest)
+{
+    SDL_Rect viewport;
+    SDL_Rect visible;
+
+    SDL_RenderGetViewport(dest, &viewport);
+    visible.x = 0;
+    visible.y = 0;
+    visible.w = viewport.w;
+    visible.h = viewport.h;
+
+    if(has_clip(dest))
+    {
+        SDL_Rect clip = get_clip(dest);
+        if(clip.w > 0 && clip.h > 0)
+            visible = SDL_RectIntersect(visible, clip);
+    }
+    return visible;
+}
+
 
 
 
@@ -590,8 +1178,248 @@ void FC_SetRenderCallback(SDL_Rect (*callback)(SDL_Texture* src, SDL_Rect* srcre
         fc_render_callback = callback;
 }
 
-void FC_GetUTF8FromCodepoint(char* result, Uint32 codepoint)
-{
+
+// SDL_RenderGeometry arrived in SDL 2.0.18.  Older versions always draw glyph by glyph.
+#if SDL_VERSION_ATLEAST(2,0,18)
+static Uint8 fc_use_batching = 1;
+#else
+static Uint8 fc_use_batching = 0;
+#endif
+
+void FC_SetBatchRendering(Uint8 enable)
+{
+#if SDL_VERSION_ATLEAST(2,0,18)
+    fc_use_batching = (enable != 0);
+#else
+    (void)enable;
+#endif
+}
+
+Uint8 FC_GetBatchRendering(void)
+{
+    return fc_use_batching;
+}
+
+static void FC_FreeBatch(FC_GlyphBatch* batch)
+{
+    int i;
+    for(i = 0; i < batch->num_levels; ++i)
+    {
+        free(batch->levels[i].vertices);
+        free(batch->levels[i].indices);
+    }
+    free(batch->levels);
+
+    batch->num_levels = 0;
+    batch->levels = nullptr;
+}
+
+static void FC_ResetBatch(FC_GlyphBatch* batch)
+{
+    int i;
+    for(i = 0; i < batch->num_levels; ++i)
+    {
+        batch->levels[i].texture = nullptr;
+        batch->levels[i].num_vertices = 0;
+        batch->levels[i].num_indices = 0;
+    }
+}
+
+static Uint8 FC_CanBatch(void)
+{
+    // A custom callback expects to see every glyph, so honor it.
+    return (fc_use_batching && fc_render_callback == &FC_DefaultRenderCallback);
+}
+
+// Only used when glyphs are drawn one at a time; batched glyphs carry their color in the vertices
+static void set_color_for_all_caches(FC_Font* font, SDL_Color color)
+{
+    SDL_Texture* img;
+    int i;
+    int num_levels = FC_GetNumCacheLevels(font);
+    for(i = 0; i < num_levels; ++i)
+    {
+        img = FC_GetGlyphCacheLevel(font, i);
+        set_color(img, color.r, color.g, color.b, FC_GET_ALPHA(color));
+    }
+}
+
+// Returns the font's batch ready for a new string drawn in 'color', or nullptr if glyphs should go through fc_render_callback one at a time.
+static FC_GlyphBatch* FC_BeginBatch(FC_Font* font, SDL_Color color)
+{
+    if(!FC_CanBatch())
+    {
+        set_color_for_all_caches(font, color);
+        return nullptr;
+    }
+
+    FC_ResetBatch(&font->batch);
+    font->batch.color = color;
+    return &font->batch;
+}
+
+static FC_GlyphBatchLevel* FC_GetBatchLevel(FC_GlyphBatch* batch, int cache_level, SDL_Texture* texture)
+{
+    FC_GlyphBatchLevel* level;
+
+    if(cache_level < 0 || texture == nullptr)
+        return nullptr;
+
+    if(cache_level >= batch->num_levels)
+    {
+        int i;
+        FC_GlyphBatchLevel* new_levels = (FC_GlyphBatchLevel*)realloc(batch->levels, (cache_level+1) * sizeof(FC_GlyphBatchLevel));
+        if(new_levels == nullptr)
+            return nullptr;
+
+        for(i = batch->num_levels; i <= cache_level; ++i)
+            memset(&new_levels[i], 0, sizeof(FC_GlyphBatchLevel));
+
+        batch->levels = new_levels;
+        batch->num_levels = cache_level+1;
+    }
+
+    level = &batch->levels[cache_level];
+    if(level->texture != texture)
+    {
+        int w, h;
+        SDL_QueryTexture(texture, nullptr, nullptr, &w, &h);
+        level->texture = texture;
+        level->texture_w = (float)w;
+        level->texture_h = (float)h;
+    }
+
+    return level;
+}
+
+// Adds the quad that FC_DefaultRenderCallback would have drawn and returns the same rect it would have returned.
+static SDL_Rect FC_BatchGlyph(FC_GlyphBatch* batch, SDL_Texture* src, int cache_level, SDL_Rect* srcrect, int x, int y, float xscale, float yscale)
+{
+    SDL_Rect result = {x, y, (int)(srcrect->w * xscale), (int)(srcrect->h * yscale)};
+    FC_GlyphBatchLevel* level = FC_GetBatchLevel(batch, cache_level, src);
+    SDL_Vertex* v;
+    int* n;
+    float x1, y1, u0, v0, u1, v1;
+
+    if(level == nullptr)
+        return result;
+
+    if(level->num_vertices + 4 > level->capacity * 4)
+    {
+        int new_capacity = (level->capacity > 0? level->capacity * 2 : 64);
+        SDL_Vertex* new_vertices = (SDL_Vertex*)realloc(level->vertices, new_capacity * 4 * sizeof(SDL_Vertex));
+        int* new_indices;
+        if(new_vertices == nullptr)
+            return result;
+        level->vertices = new_vertices;
+
+        new_indices = (int*)realloc(level->indices, new_capacity * 6 * sizeof(int));
+        if(new_indices == nullptr)
+            return result;
+        level->indices = new_indices;
+
+        level->capacity = new_capacity;
+    }
+
+    // Flipping for negative scales is done by swapping texture coordinates
+    x1 = x + (int)((xscale < 0? -xscale : xscale) * srcrect->w);
+    y1 = y + (int)((yscale < 0? -yscale : yscale) * srcrect->h);
+    u0 = srcrect->x / level->texture_w;
+    v0 = srcrect->y / level->texture_h;
+    u1 = (srcrect->x + srcrect->w) / level->texture_w;
+    v1 = (srcrect->y + srcrect->h) / level->texture_h;
+    if(xscale < 0)
+    {
+        float t = u0;
+        u0 = u1;
+        u1 = t;
+    }
+    if(yscale < 0)
+    {
+        float t = v0;
+        v0 = v1;
+        v1 = t;
+    }
+
+    v = &level->vertices[level->num_vertices];
+    v[0].position.x = x;   v[0].position.y = y;   v[0].tex_coord.x = u0;  v[0].tex_coord.y = v0;
+    v[1].position.x = x1;  v[1].position.y = y;   v[1].tex_coord.x = u1;  v[1].tex_coord.y = v0;
+    v[2].position.x = x1;  v[2].position.y = y1;  v[2].tex_coord.x = u1;  v[2].tex_coord.y = v1;
+    v[3].position.x = x;   v[3].position.y = y1;  v[3].tex_coord.x = u0;  v[3].tex_coord.y = v1;
+    v[0].color = v[1].color = v[2].color = v[3].color = batch->color;
+
+    n = &level->indices[level->num_indices];
+    n[0] = level->num_vertices;
+    n[1] = level->num_vertices + 1;
+    n[2] = level->num_vertices + 2;
+    n[3] = level->num_vertices;
+    n[4] = level->num_vertices + 2;
+    n[5] = level->num_vertices + 3;
+
+    level->num_vertices += 4;
+    level->num_indices += 6;
+
+    return result;
+}
+
+// Issues one SDL_RenderGeometry call per cache level that the batch used.
+static void FC_SubmitBatch(FC_Font* font, SDL_Renderer* dest, FC_GlyphBatch* batch)
+{
+    // Cache levels used before this point are no longer referenced by a pending batch
+    ++FC_GetCacheOwner(font)->draw_count;
+
+#if SDL_VERSION_ATLEAST(2,0,18)
+    int i;
+    Uint8 notified = 0;
+    if(batch == nullptr || dest == nullptr)
+        return;
+
+    // Glyphs loaded while filling the batch have to be on their textures before the geometry is drawn
+    FC_FlushGlyphUploads(font);
+
+    for(i = 0; i < batch->num_levels; ++i)
+    {
+        FC_GlyphBatchLevel* level = &batch->levels[i];
+        if(level->texture == nullptr || level->num_indices == 0)
+            continue;
+
+        if(!notified)
+        {
+            FC_NotifyDistanceField(font, dest, 1);
+            notified = 1;
+        }
+
+        // The color is in the vertices, so the texture must not modulate it again
+        set_color(level->texture, 255, 255, 255, 255);
+        SDL_RenderGeometry(dest, level->texture, level->vertices, level->num_vertices, level->indices, level->num_indices);
+        ++font->stats.render_calls;
+    }
+
+    if(notified)
+        FC_NotifyDistanceField(font, dest, 0);
+#else
+    (void)dest;
+    (void)batch;
+#endif
+}
+
+static void FC_FreeGlyphUploads(FC_GlyphUploads* uploads)
+{
+    int i;
+    for(i = 0; i < uploads->num_levels; ++i)
+    {
+        SDL_FreeSurface(uploads->levels[i].staging);
+        free(uploads->levels[i].rects);
+    }
+    free(uploads->levels);
+
+    uploads->num_pending = 0;
+    uploads->num_levels = 0;
+    uploads->levels = nullptr;
+}
+
+void FC_GetUTF8FromCodepoint(char* result, Uint32 codepoint)
+{
     char a, b, c, d;
 
     if(result == nullptr)
@@ -673,6 +1501,46 @@ Uint32 FC_GetCodepointFromUTF8(const char** c, Uint8 advance_pointer)
     return result;
 }
 
+// Converts a packed UTF-8 codepoint from FC_GetCodepointFromUTF8() to the Unicode value that SDL_ttf wants
+static Uint32 FC_GetUnicodeFromCodepoint(Uint32 codepoint)
+{
+    if(codepoint <= 0x7F)
+        return codepoint;
+    if(codepoint <= 0xFFFF)
+        return (codepoint >> 8 & 0x1F) << 6 | (codepoint & 0x3F);
+    if(codepoint <= 0xFFFFFF)
+        return (codepoint >> 16 & 0x0F) << 12 | (codepoint >> 8 & 0x3F) << 6 | (codepoint & 0x3F);
+    return (codepoint >> 24 & 0x07) << 18 | (codepoint >> 16 & 0x3F) << 12 | (codepoint >> 8 & 0x3F) << 6 | (codepoint & 0x3F);
+}
+
+// Packs the UTF-8 encoding of a Unicode value the way FC_GetCodepointFromUTF8() does
+static Uint32 FC_GetCodepointFromUnicode(Uint32 unicode)
+{
+    if(unicode <= 0x7F)
+        return unicode;
+    if(unicode <= 0x7FF)
+        return (0xC0 | unicode >> 6) << 8 | (0x80 | (unicode & 0x3F));
+    if(unicode <= 0xFFFF)
+        return (0xE0 | unicode >> 12) << 16 | (0x80 | (unicode >> 6 & 0x3F)) << 8 | (0x80 | (unicode & 0x3F));
+    return (0xF0 | unicode >> 18) << 24 | (0x80 | (unicode >> 12 & 0x3F)) << 16 | (0x80 | (unicode >> 6 & 0x3F)) << 8 | (0x80 | (unicode & 0x3F));
+}
+
+// Clamps a range to the Unicode values that can have glyphs: no control characters and nothing past U+10FFFF.
+// Returns 0 if nothing is left of it.  Surrogates are skipped as the range is used.
+static Uint8 FC_ClampCodepointRange(Uint32* first, Uint32* last)
+{
+    if(*first < 0x20)
+        *first = 0x20;
+    if(*last > 0x10FFFF)
+        *last = 0x10FFFF;
+    return (*first <= *last);
+}
+
+static inline Uint8 FC_IsSurrogate(Uint32 unicode)
+{
+    return (unicode >= 0xD800 && unicode <= 0xDFFF);
+}
+
 
 void FC_SetLoadingString(FC_Font* font, const char* string)
 {
@@ -683,6 +1551,83 @@ void FC_SetLoadingString(FC_Font* font, const char* string)
     font->loading_string = U8_strdup(string);
 }
 
+Uint8 FC_AddLoadingRange(FC_Font* font, Uint32 first, Uint32 last)
+{
+    FC_CodepointRange* new_ranges;
+
+    if(font == nullptr || !FC_ClampCodepointRange(&first, &last))
+        return 0;
+
+    new_ranges = (FC_CodepointRange*)realloc(font->loading_ranges, (font->num_loading_ranges + 1) * sizeof(FC_CodepointRange));
+    if(new_ranges == nullptr)
+        return 0;
+
+    font->loading_ranges = new_ranges;
+    font->loading_ranges[font->num_loading_ranges].first = first;
+    font->loading_ranges[font->num_loading_ranges].last = last;
+    ++font->num_loading_ranges;
+    return 1;
+}
+
+void FC_ClearLoadingRanges(FC_Font* font)
+{
+    if(font == nullptr)
+        return;
+
+    free(font->loading_ranges);
+    font->loading_ranges = nullptr;
+    font->num_loading_ranges = 0;
+}
+
+
+void FC_SetCacheLevelSize(FC_Font* font, int size)
+{
+    if(font == nullptr)
+        return;
+
+    font->cache_level_size_hint = (size > 0? size : 0);
+}
+
+int FC_GetCacheLevelSize(FC_Font* font)
+{
+    if(font == nullptr)
+        return 0;
+
+    font = FC_GetCacheOwner(font);
+    return (font->cache_level_size > 0? font->cache_level_size : font->cache_level_size_hint);
+}
+
+void FC_SetCacheLevelLimit(FC_Font* font, int max_levels)
+{
+    if(font == nullptr)
+        return;
+
+    font->cache_level_limit = (max_levels > 0? max_levels : 0);
+}
+
+int FC_GetCacheLevelLimit(FC_Font* font)
+{
+    if(font == nullptr)
+        return 0;
+
+    return font->cache_level_limit;
+}
+
+void FC_SetCacheFormat(FC_Font* font, FC_CacheFormatEnum format)
+{
+    if(font == nullptr)
+        return;
+
+    font->cache_format = format;
+}
+
+FC_CacheFormatEnum FC_GetCacheFormat(FC_Font* font)
+{
+    if(font == nullptr)
+        return FC_CACHE_FORMAT_RGBA8888;
+
+    return font->cache_format;
+}
 
 unsigned int FC_GetBufferSize(void)
 {
@@ -691,14 +1636,9 @@ unsigned int FC_GetBufferSize(void)
 
 void FC_SetBufferSize(unsigned int size)
 {
-    free(fc_buffer);
+    // Each thread's buffer picks up the new size on its next formatted call
     if(size > 0)
-    {
         fc_buffer_size = size;
-        fc_buffer = (char*)malloc(fc_buffer_size);
-    }
-    else
-        fc_buffer = (char*)malloc(fc_buffer_size);
 }
 
 
@@ -728,8 +1668,6 @@ static void FC_Init(FC_Font* font)
     font->ttf_source = nullptr;
     font->owns_ttf_source = 0;
 
-    font->filter = FC_FILTER_NEAREST;
-
     font->default_color.r = 0;
     font->default_color.g = 0;
     font->default_color.b = 0;
@@ -745,7 +1683,7 @@ static void FC_Init(FC_Font* font)
     font->lineSpacing = 0;
     font->letterSpacing = 0;
 
-    // Give a little offset for when filtering/mipmaps are used.  Depending on mipmap level, this will still not be enough.
+    // Nothing is packed yet.  FC_PackGlyphData() pads each glyph for the filter mode.
     font->last_glyph.rect.x = FC_CACHE_PADDING;
     font->last_glyph.rect.y = FC_CACHE_PADDING;
     font->last_glyph.rect.w = 0;
@@ -755,19 +1693,124 @@ static void FC_Init(FC_Font* font)
     if(font->glyphs != nullptr)
         FC_MapFree(font->glyphs);
 
-    font->glyphs = FC_MapCreate(FC_DEFAULT_NUM_BUCKETS);
+    font->glyphs = FC_MapCreate();
 
     font->glyph_cache_size = 3;
     font->glyph_cache_count = 0;
 
+    font->cache_level_size = 0;
+
 
     font->glyph_cache = (SDL_Texture**)malloc(font->glyph_cache_size * sizeof(SDL_Texture*));
 
 	if (font->loading_string == nullptr)
 		font->loading_string = FC_GetStringASCII();
+}
+
+// Clears a cache level texture to transparent, keeping the renderer's target state
+static void FC_ClearGlyphCacheLevel(FC_Font* font, SDL_Texture* level)
+{
+    Uint8 r, g, b, a;
+    SDL_Texture* prev_target = SDL_GetRenderTarget(font->renderer);
+    SDL_Rect prev_clip, prev_viewport;
+    int prev_logicalw, prev_logicalh;
+    Uint8 prev_clip_enabled;
+    float prev_scalex, prev_scaley;
+    // only backup if previous target existed (SDL will preserve them for the default target)
+    if (prev_target) {
+        prev_clip_enabled = has_clip(font->renderer);
+        if (prev_clip_enabled)
+            prev_clip = get_clip(font->renderer);
+        SDL_RenderGetViewport(font->renderer, &prev_viewport);
+        SDL_RenderGetScale(font->renderer, &prev_scalex, &prev_scaley);
+        SDL_RenderGetLogicalSize(font->renderer, &prev_logicalw, &prev_logicalh);
+    }
+    SDL_SetRenderTarget(font->renderer, level);
+    SDL_GetRenderDrawColor(font->renderer, &r, &g, &b, &a);
+    SDL_SetRenderDrawColor(font->renderer, 0, 0, 0, 0);
+    SDL_RenderClear(font->renderer);
+    SDL_SetRenderDrawColor(font->renderer, r, g, b, a);
+    SDL_SetRenderTarget(font->renderer, prev_target);
+    font->stats.target_switches += 2;
+    if (prev_target) {
+        if (prev_clip_enabled)
+            set_clip(font->renderer, &prev_clip);
+        if (prev_logicalw && prev_logicalh)
+            SDL_RenderSetLogicalSize(font->renderer, prev_logicalw, prev_logicalh);
+        else {
+            SDL_RenderSetViewport(font->renderer, &prev_viewport);
+            SDL_RenderSetScale(font->renderer, prev_scalex, prev_scaley);
+        }
+    }
+}
+
+// The shadow of a cache level holds the same white glyphs as its texture, so the texture can be made
+// again from it.  Shadows are kept on the font that owns the cache levels.
+static SDL_Surface* FC_GetShadowLevel(FC_Font* owner, int cache_level)
+{
+    return (cache_level >= 0 && cache_level < owner->num_shadows? owner->shadows[cache_level] : nullptr);
+}
+
+// Replaces the level's shadow with 'shadow', which the font then owns
+static void FC_SetShadowLevel(FC_Font* owner, int cache_level, SDL_Surface* shadow)
+{
+    if(cache_level >= owner->num_shadows)
+    {
+        SDL_Surface** new_shadows;
+        if(shadow == nullptr)
+            return;
+
+        new_shadows = (SDL_Surface**)realloc(owner->shadows, (cache_level + 1) * sizeof(SDL_Surface*));
+        if(new_shadows == nullptr)
+        {
+            SDL_FreeSurface(shadow);
+            return;
+        }
+        memset(&new_shadows[owner->num_shadows], 0, (cache_level + 1 - owner->num_shadows) * sizeof(SDL_Surface*));
+        owner->shadows = new_shadows;
+        owner->num_shadows = cache_level + 1;
+    }
+
+    if(owner->shadows[cache_level] != shadow)
+        SDL_FreeSurface(owner->shadows[cache_level]);
+    owner->shadows[cache_level] = shadow;
+}
+
+static void FC_FreeShadows(FC_Font* owner)
+{
+    int i;
+    for(i = 0; i < owner->num_shadows; ++i)
+        SDL_FreeSurface(owner->shadows[i]);
+    free(owner->shadows);
 
-    if(fc_buffer == nullptr)
-        fc_buffer = (char*)malloc(fc_buffer_size);
+    owner->num_shadows = 0;
+    owner->shadows = nullptr;
+}
+
+static SDL_Surface* FC_CreateEmptyShadow(int w, int h)
+{
+    SDL_Surface* shadow = FC_CreateSurface32(w, h);
+    if(shadow != nullptr)
+        SDL_SetSurfaceBlendMode(shadow, SDL_BLENDMODE_NONE);
+    return shadow;
+}
+
+// Sets the level's texture filtering from the owner's filter mode.  SDL before 2.0.12 can only pick it from
+// SDL_HINT_RENDER_SCALE_QUALITY when the texture is created, so FC_CreateCacheTexture() sets the hint there instead.
+static void FC_SetLevelFilter(FC_Font* owner, SDL_Texture* level)
+{
+#if SDL_VERSION_ATLEAST(2,0,12)
+    if(level != nullptr)
+        SDL_SetTextureScaleMode(level, (owner->filter == FC_FILTER_LINEAR? SDL_ScaleModeLinear : SDL_ScaleModeNearest));
+#else
+    (void)owner;
+    (void)level;
+#endif
+}
+
+static inline int FC_GetCachePadding(FC_Font* owner)
+{
+    return (owner->filter == FC_FILTER_LINEAR? FC_CACHE_PADDING_LINEAR : FC_CACHE_PADDING);
 }
 
 static Uint8 FC_GrowGlyphCache(FC_Font* font)
@@ -775,9 +1818,13 @@ static Uint8 FC_GrowGlyphCache(FC_Font* font)
     if(font == nullptr)
         return 0;
 
-    SDL_Texture* new_level = SDL_CreateTexture(font->renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET, font->height * 12, font->height * 12);
+    FC_Font* owner = FC_GetCacheOwner(font);
+    Uint32 format = owner->cache_pixel_format;
+    if(format == SDL_PIXELFORMAT_UNKNOWN)
+        format = SDL_PIXELFORMAT_RGBA8888;
+    SDL_Texture* new_level = SDL_CreateTexture(owner->renderer, format, SDL_TEXTUREACCESS_TARGET, owner->cache_level_size, owner->cache_level_size);
     
-    if(new_level == nullptr || !FC_SetGlyphCacheLevel(font, font->glyph_cache_count, new_level))
+    if(new_level == nullptr || !FC_SetGlyphCacheLevel(font, owner->glyph_cache_count, new_level))
     {
         SDL_Log("Error: SDL_FontCache ran out of packing space and could not add another cache level.\n");
         SDL_DestroyTexture(new_level);
@@ -787,58 +1834,103 @@ static Uint8 FC_GrowGlyphCache(FC_Font* font)
     // bug: we do not have the correct color here, this might be the wrong color!
     //      , most functions use set_color_for_all_caches()
     //   - for evading this bug, you must use FC_SetDefaultColor(), before using any draw functions
-    set_color(new_level, font->default_color.r, font->default_color.g, font->default_color.b, FC_GET_ALPHA(font->default_color));
-    {
-        Uint8 r, g, b, a;
-        SDL_Texture* prev_target = SDL_GetRenderTarget(font->renderer);
-        SDL_Rect prev_clip, prev_viewport;
-        int prev_logicalw, prev_logicalh;
-        Uint8 prev_clip_enabled;
-        float prev_scalex, prev_scaley;
-        // only backup if previous target existed (SDL will preserve them for the default target)
-        if (prev_target) {
-            prev_clip_enabled = has_clip(font->renderer);
-            if (prev_clip_enabled)
-                prev_clip = get_clip(font->renderer);
-            SDL_RenderGetViewport(font->renderer, &prev_viewport);
-            SDL_RenderGetScale(font->renderer, &prev_scalex, &prev_scaley);
-            SDL_RenderGetLogicalSize(font->renderer, &prev_logicalw, &prev_logicalh);
-        }
-        SDL_SetTextureBlendMode(new_level, SDL_BLENDMODE_BLEND);
-        SDL_SetRenderTarget(font->renderer, new_level);
-        SDL_GetRenderDrawColor(font->renderer, &r, &g, &b, &a);
-        SDL_SetRenderDrawColor(font->renderer, 0, 0, 0, 0);
-        SDL_RenderClear(font->renderer);
-        SDL_SetRenderDrawColor(font->renderer, r, g, b, a);
-        SDL_SetRenderTarget(font->renderer, prev_target);
-        if (prev_target) {
-            if (prev_clip_enabled)
-                set_clip(font->renderer, &prev_clip);
-            if (prev_logicalw && prev_logicalh)
-                SDL_RenderSetLogicalSize(font->renderer, prev_logicalw, prev_logicalh);
-            else {
-                SDL_RenderSetViewport(font->renderer, &prev_viewport);
-                SDL_RenderSetScale(font->renderer, prev_scalex, prev_scaley);
-            }
-        }
-    }
+    set_color(new_level, owner->default_color.r, owner->default_color.g, owner->default_color.b, FC_GET_ALPHA(owner->default_color));
+    SDL_SetTextureBlendMode(new_level, SDL_BLENDMODE_BLEND);
+    FC_SetLevelFilter(owner, new_level);
+    FC_ClearGlyphCacheLevel(owner, new_level);
+    if(owner->shadow_cache)
+        FC_SetShadowLevel(owner, owner->glyph_cache_count - 1, FC_CreateEmptyShadow(owner->cache_level_size, owner->cache_level_size));
 
     return 1;
 }
 
-Uint8 FC_UploadGlyphCache(FC_Font* font, int cache_level, SDL_Surface* data_surface)
+// Empties the least recently used cache level and moves the packing cursor onto it.  Its glyphs are
+// rendered again from the TTF_Font when they are next looked up.  Levels used since the last submitted
+// draw are skipped, since a batch may still be pointing at them.  An atlas level is emptied for every
+// font attached to the atlas, so all of them need a TTF_Font.
+static Uint8 FC_EvictGlyphCacheLevel(FC_Font* font)
 {
-    if(font == nullptr || data_surface == nullptr)
+    FC_Font* owner = FC_GetCacheOwner(font);
+    FC_Font** fonts = &font;
+    int num_fonts = 1;
+    FC_Skyline* skyline;
+    int level = -1;
+    int i;
+
+    if(font->atlas != nullptr)
+    {
+        fonts = font->atlas->fonts;
+        num_fonts = font->atlas->num_fonts;
+    }
+
+    if(!fc_has_render_target_support)
+        return 0;
+    for(i = 0; i < num_fonts; ++i)
+    {
+        if(fonts[i]->ttf_source == nullptr)
+            return 0;
+    }
+
+    // Levels without a packer were set from outside and can't be rebuilt
+    for(i = 0; i < owner->num_packers && i < owner->glyph_cache_count; ++i)
+    {
+        skyline = &owner->packers[i];
+        if(skyline->nodes == nullptr || skyline->last_used == owner->draw_count)
+            continue;
+        if(level < 0 || (Sint32)(skyline->last_used - owner->packers[level].last_used) < 0)
+            level = i;
+    }
+    if(level < 0)
         return 0;
 
+    // Glyphs still waiting to be uploaded would land on the level after it is cleared
+    FC_FlushGlyphUploads(owner);
+    for(i = 0; i < num_fonts; ++i)
+    {
+        if(!FC_MapRemoveCacheLevel(fonts[i]->glyphs, level))
+            return 0;
+    }
+
+    skyline = &owner->packers[level];
+    skyline->num_nodes = 1;
+    skyline->nodes[0].x = 0;
+    skyline->nodes[0].y = 0;
+    skyline->nodes[0].w = skyline->width;
+    skyline->used_area = 0;
+
+    FC_ClearGlyphCacheLevel(owner, owner->glyph_cache[level]);
+    if(FC_GetShadowLevel(owner, level) != nullptr)
+        SDL_FillRect(owner->shadows[level], nullptr, 0);
+    owner->last_glyph.cache_level = level;
+    ++owner->generation;
+    ++owner->stats.levels_evicted;
+    FC_NotifyStats(font, FC_STATS_CACHE_LEVEL_EVICTED, level);
+    return 1;
+}
+
+// Makes a cache level texture on the font's renderer that holds the surface's pixels
+static SDL_Texture* FC_CreateCacheTexture(FC_Font* font, SDL_Surface* data_surface)
+{
     SDL_Texture* new_level;
     if(!fc_has_render_target_support)
-        new_level = SDL_CreateTextureFromSurface(font->renderer, data_surface);
+    {
+        // The texture takes the surface's format, so convert it first to get a packed level
+        if(font->cache_pixel_format != SDL_PIXELFORMAT_UNKNOWN && data_surface->format->format != font->cache_pixel_format)
+        {
+            SDL_Surface* packed = SDL_ConvertSurfaceFormat(data_surface, font->cache_pixel_format, 0);
+            new_level = (packed != nullptr? SDL_CreateTextureFromSurface(font->renderer, packed) : nullptr);
+            SDL_FreeSurface(packed);
+        }
+        else
+            new_level = SDL_CreateTextureFromSurface(font->renderer, data_surface);
+        FC_SetLevelFilter(font, new_level);
+    }
     else
     {
         // Must upload with render target enabled so we can put more glyphs on later
         SDL_Renderer* renderer = font->renderer;
 
+#if !SDL_VERSION_ATLEAST(2,0,12)
         // Set filter mode for new texture
         char old_filter_mode[16];  // Save it so we can change the hint value in the meantime
         const char* old_filter_hint = SDL_GetHint(SDL_HINT_RENDER_SCALE_QUALITY);
@@ -846,16 +1938,21 @@ Uint8 FC_UploadGlyphCache(FC_Font* font, int cache_level, SDL_Surface* data_surf
             old_filter_hint = "nearest";
         snprintf(old_filter_mode, 16, "%s", old_filter_hint);
 
-        if(FC_GetFilterMode(font) == FC_FILTER_LINEAR)
+        if(font->filter == FC_FILTER_LINEAR)
             SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "1");
         else
             SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "0");
+#endif
 
-        new_level = SDL_CreateTexture(renderer, data_surface->format->format, SDL_TEXTUREACCESS_TARGET, data_surface->w, data_surface->h);
+        new_level = SDL_CreateTexture(renderer, (font->cache_pixel_format != SDL_PIXELFORMAT_UNKNOWN? font->cache_pixel_format : data_surface->format->format),
+                                      SDL_TEXTUREACCESS_TARGET, data_surface->w, data_surface->h);
         SDL_SetTextureBlendMode(new_level, SDL_BLENDMODE_BLEND);
+        FC_SetLevelFilter(font, new_level);
 
+#if !SDL_VERSION_ATLEAST(2,0,12)
         // Reset filter mode for the temp texture
         SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "0");
+#endif
 
         {
             Uint8 r, g, b, a;
@@ -875,6 +1972,9 @@ Uint8 FC_UploadGlyphCache(FC_Font* font, int cache_level, SDL_Surface* data_surf
                 SDL_RenderGetLogicalSize(renderer, &prev_logicalw, &prev_logicalh);
             }
             SDL_SetTextureBlendMode(temp, SDL_BLENDMODE_NONE);
+#if SDL_VERSION_ATLEAST(2,0,12)
+            SDL_SetTextureScaleMode(temp, SDL_ScaleModeNearest);
+#endif
             SDL_SetRenderTarget(renderer, new_level);
 
             SDL_GetRenderDrawColor(renderer, &r, &g, &b, &a);
@@ -884,6 +1984,7 @@ Uint8 FC_UploadGlyphCache(FC_Font* font, int cache_level, SDL_Surface* data_surf
 
             SDL_RenderCopy(renderer, temp, nullptr, nullptr);
             SDL_SetRenderTarget(renderer, prev_target);
+            font->stats.target_switches += 2;
             if (prev_target) {
                 if (prev_clip_enabled)
                     set_clip(renderer, &prev_clip);
@@ -898,1325 +1999,4994 @@ Uint8 FC_UploadGlyphCache(FC_Font* font, int cache_level, SDL_Surface* data_surf
             SDL_DestroyTexture(temp);
         }
 
+#if !SDL_VERSION_ATLEAST(2,0,12)
         // Reset to the old filter value
         SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, old_filter_mode);
-
-    }
-    
-    if(new_level == nullptr || !FC_SetGlyphCacheLevel(font, cache_level, new_level))
-    {
-        SDL_Log("Error: SDL_FontCache ran out of packing space and could not add another cache level.\n");
-        SDL_DestroyTexture(new_level);
-        
-        return 0;
+#endif
     }
-    return 1;
+
+    return new_level;
 }
 
-static FC_GlyphData* FC_PackGlyphData(FC_Font* font, Uint32 codepoint, Uint16 width, Uint16 maxWidth, Uint16 maxHeight)
+Uint8 FC_UploadGlyphCache(FC_Font* font, int cache_level, SDL_Surface* data_surface)
 {
-    FC_Map* glyphs = font->glyphs;
-    FC_GlyphData* last_glyph = &font->last_glyph;
-    Uint16 height = font->height + FC_CACHE_PADDING;
+    SDL_Texture* new_level;
+    if(font == nullptr || data_surface == nullptr)
+        return 0;
 
-    // TAB is special!
-    if(codepoint == '\t')
-    {
-        FC_GlyphData spaceGlyph;
-        FC_GetGlyphData(font, &spaceGlyph, ' ');
-        width = fc_tab_width * spaceGlyph.rect.w;
-    }
+    font = FC_GetCacheOwner(font);
 
-    if(last_glyph->rect.x + last_glyph->rect.w + width >= maxWidth - FC_CACHE_PADDING)
+    new_level = FC_CreateCacheTexture(font, data_surface);
+    if(new_level == nullptr || !FC_SetGlyphCacheLevel(font, cache_level, new_level))
     {
-        if(last_glyph->rect.y + height + height >= maxHeight - FC_CACHE_PADDING)
-        {
-            // Get ready to pack on the next cache level when it is ready
-            last_glyph->cache_level = font->glyph_cache_count;
-            last_glyph->rect.x = FC_CACHE_PADDING;
-            last_glyph->rect.y = FC_CACHE_PADDING;
-            last_glyph->rect.w = 0;
-            return nullptr;
-        }
-        else
-        {
-            // Go to next row
-            last_glyph->rect.x = FC_CACHE_PADDING;
-            last_glyph->rect.y += height;
-            last_glyph->rect.w = 0;
-        }
+        SDL_Log("Error: SDL_FontCache ran out of packing space and could not add another cache level.\n");
+        SDL_DestroyTexture(new_level);
+        
+        return 0;
     }
 
-    // Move to next space
-    last_glyph->rect.x += last_glyph->rect.w + 1 + FC_CACHE_PADDING;
-    last_glyph->rect.w = width;
-
-    return FC_MapInsert(glyphs, codepoint, FC_MakeGlyphData(last_glyph->cache_level, last_glyph->rect.x, last_glyph->rect.y, last_glyph->rect.w, last_glyph->rect.h));
+    if(font->shadow_cache)
+        FC_SetShadowLevel(font, cache_level, SDL_ConvertSurfaceFormat(data_surface, data_surface->format->format, 0));
+    return 1;
 }
 
+static void FC_FreePackers(FC_Font* font)
+{
+    int i;
+    for(i = 0; i < font->num_packers; ++i)
+        free(font->packers[i].nodes);
+    free(font->packers);
 
-SDL_Texture* FC_GetGlyphCacheLevel(FC_Font* font, int cache_level)
+    font->num_packers = 0;
+    font->packers = nullptr;
+}
+
+// Returns the lowest y at which a w*h box fits with its left edge on the given node, or -1 if it doesn't fit there
+static int FC_SkylineFit(FC_Skyline* skyline, int index, int w, int h)
 {
-    if(font == nullptr || cache_level < 0 || cache_level > font->glyph_cache_count)
-        return nullptr;
+    int x = skyline->nodes[index].x;
+    int y = 0;
+    int remaining = w;
 
-    return font->glyph_cache[cache_level];
+    if(x + w > skyline->width)
+        return -1;
+
+    for(; remaining > 0; ++index)
+    {
+        if(index >= skyline->num_nodes)
+            return -1;
+
+        if(skyline->nodes[index].y > y)
+            y = skyline->nodes[index].y;
+        if(y + h > skyline->height)
+            return -1;
+
+        remaining -= skyline->nodes[index].w;
+    }
+    return y;
 }
 
-Uint8 FC_SetGlyphCacheLevel(FC_Font* font, int cache_level, SDL_Texture* cache_texture)
+// Bottom-left skyline packing: place the box as low as possible, then raise the skyline under it
+static Uint8 FC_SkylineInsert(FC_Skyline* skyline, int w, int h, int* result_x, int* result_y)
 {
-    if(font == nullptr || cache_level < 0)
-        return 0;
+    int best_index = -1;
+    int best_y = skyline->height;
+    int best_w = skyline->width;
+    int i;
+    FC_SkylineNode* node;
 
-    // Must be sequentially added
-    if(cache_level > font->glyph_cache_count + 1)
+    for(i = 0; i < skyline->num_nodes; ++i)
+    {
+        int y = FC_SkylineFit(skyline, i, w, h);
+        if(y >= 0 && (y < best_y || (y == best_y && skyline->nodes[i].w < best_w)))
+        {
+            best_index = i;
+            best_y = y;
+            best_w = skyline->nodes[i].w;
+        }
+    }
+
+    if(best_index < 0)
         return 0;
 
-    if(cache_level == font->glyph_cache_count)
+    if(skyline->num_nodes == skyline->nodes_size)
     {
-        font->glyph_cache_count++;
+        int new_size = skyline->nodes_size*2;
+        FC_SkylineNode* new_nodes = (FC_SkylineNode*)realloc(skyline->nodes, new_size * sizeof(FC_SkylineNode));
+        if(new_nodes == nullptr)
+            return 0;
+        skyline->nodes = new_nodes;
+        skyline->nodes_size = new_size;
+    }
 
-        // Grow cache?
-        if(font->glyph_cache_count > font->glyph_cache_size)
+    *result_x = skyline->nodes[best_index].x;
+    *result_y = best_y;
+
+    memmove(&skyline->nodes[best_index+1], &skyline->nodes[best_index], (skyline->num_nodes - best_index) * sizeof(FC_SkylineNode));
+    ++skyline->num_nodes;
+    node = &skyline->nodes[best_index];
+    node->y = best_y + h;
+    node->w = w;
+
+    // Trim the segments that are now covered by the new one
+    for(i = best_index+1; i < skyline->num_nodes;)
+    {
+        FC_SkylineNode* next = &skyline->nodes[i];
+        int overlap = node->x + node->w - next->x;
+        if(overlap <= 0)
+            break;
+
+        if(overlap < next->w)
         {
-            // Copy old cache to new one
-            int i;
-            SDL_Texture** new_cache;
-            new_cache = (SDL_Texture**)malloc(font->glyph_cache_count * sizeof(SDL_Texture*));
-            for(i = 0; i < font->glyph_cache_size; ++i)
-                new_cache[i] = font->glyph_cache[i];
+            next->x += overlap;
+            next->w -= overlap;
+            break;
+        }
 
-            // Save new cache
-            free(font->glyph_cache);
-            font->glyph_cache_size = font->glyph_cache_count;
-            font->glyph_cache = new_cache;
+        memmove(next, next+1, (skyline->num_nodes - i - 1) * sizeof(FC_SkylineNode));
+        --skyline->num_nodes;
+    }
+
+    // Merge neighbours at the same height so the search stays short
+    for(i = 0; i + 1 < skyline->num_nodes;)
+    {
+        if(skyline->nodes[i].y == skyline->nodes[i+1].y)
+        {
+            skyline->nodes[i].w += skyline->nodes[i+1].w;
+            memmove(&skyline->nodes[i+1], &skyline->nodes[i+2], (skyline->num_nodes - i - 2) * sizeof(FC_SkylineNode));
+            --skyline->num_nodes;
         }
+        else
+            ++i;
     }
 
-    font->glyph_cache[cache_level] = cache_texture;
+    skyline->used_area += (Uint32)w*h;
     return 1;
 }
 
-
-FC_Font* FC_CreateFont(void)
+static FC_Skyline* FC_GetPacker(FC_Font* font, int cache_level, int width, int height)
 {
-    FC_Font* font;
+    FC_Skyline* skyline;
 
-    font = (FC_Font*)malloc(sizeof(FC_Font));
-    memset(font, 0, sizeof(FC_Font));
+    if(cache_level < 0)
+        return nullptr;
 
-    FC_Init(font);
-    ++NUM_EXISTING_FONTS;
+    if(cache_level >= font->num_packers)
+    {
+        FC_Skyline* new_packers = (FC_Skyline*)realloc(font->packers, (cache_level + 1) * sizeof(FC_Skyline));
+        if(new_packers == nullptr)
+            return nullptr;
+        memset(&new_packers[font->num_packers], 0, (cache_level + 1 - font->num_packers) * sizeof(FC_Skyline));
+        font->packers = new_packers;
+        font->num_packers = cache_level + 1;
+    }
 
-    return font;
+    skyline = &font->packers[cache_level];
+    if(skyline->nodes == nullptr)
+    {
+        skyline->nodes_size = 16;
+        skyline->nodes = (FC_SkylineNode*)malloc(skyline->nodes_size * sizeof(FC_SkylineNode));
+        if(skyline->nodes == nullptr)
+            return nullptr;
+        skyline->width = width;
+        skyline->height = height;
+        skyline->num_nodes = 1;
+        skyline->nodes[0].x = 0;
+        skyline->nodes[0].y = 0;
+        skyline->nodes[0].w = width;
+        skyline->used_area = 0;
+    }
+    return skyline;
 }
 
+// TAB is special!  It is as wide as fc_tab_width spaces.
+static void FC_SetupTabGlyph(FC_Font* font, FC_GlyphMetrics* metrics, Uint16* width)
+{
+    FC_GlyphData spaceGlyph;
+    FC_GetGlyphData(font, &spaceGlyph, ' ');
+    *width = fc_tab_width * spaceGlyph.rect.w;
+    metrics->maxx = metrics->advance = *width;
+}
 
-// Assume this many will be enough...
-#define FC_LOAD_MAX_SURFACES 10
-
-Uint8 FC_LoadFontFromTTF(FC_Font* font, SDL_Renderer* renderer, TTF_Font* ttf, SDL_Color color)
+// 'width' and 'height' are the size of the glyph's surface from FC_RenderGlyphSurface().  last_glyph.rect
+// is where that surface goes, and the glyph's rect leaves out the distance field padding around it.
+static FC_GlyphData* FC_PackGlyphData(FC_Font* font, Uint32 codepoint, FC_GlyphMetrics metrics, Uint16 width, Uint16 height, Uint16 maxWidth, Uint16 maxHeight)
 {
-    if(font == nullptr || ttf == nullptr)
-        return 0;
-    
-    if(renderer == nullptr)
-        return 0;
-    
-    FC_ClearFont(font);
+    FC_Font* owner = FC_GetCacheOwner(font);
+    FC_GlyphData* last_glyph = &owner->last_glyph;
+    FC_GlyphData glyph;
+    FC_Skyline* packer;
+    int field_padding = font->field_padding;
+    int padding;
+    int x, y;
 
+    width -= 2*field_padding;
+    height -= 2*field_padding;
+    if(codepoint == '\t')
+        FC_SetupTabGlyph(font, &metrics, &width);
 
-    // Might as well check render target support here
-    SDL_RendererInfo info;
-    SDL_GetRendererInfo(renderer, &info);
-    fc_has_render_target_support = (info.flags & SDL_RENDERER_TARGETTEXTURE);
+    // Each glyph gets padding on every side, to avoid filtering artifacts from its neighbors
+    padding = FC_GetCachePadding(owner) + field_padding;
+    packer = FC_GetPacker(owner, last_glyph->cache_level, maxWidth, maxHeight);
+    if(packer == nullptr || !FC_SkylineInsert(packer, width + 2*padding, height + 2*padding, &x, &y))
+    {
+        // Get ready to pack on the next cache level when it is ready
+        last_glyph->cache_level = owner->glyph_cache_count;
+        return nullptr;
+    }
 
-    font->renderer = renderer;
+    last_glyph->rect.x = x + padding - field_padding;
+    last_glyph->rect.y = y + padding - field_padding;
+    last_glyph->rect.w = width + 2*field_padding;
+    last_glyph->rect.h = height + 2*field_padding;
 
-    font->ttf_source = ttf;
+    glyph = FC_MakeGlyphData(last_glyph->cache_level, x + padding, y + padding, width, height);
+    glyph.metrics = metrics;
+    return FC_MapInsert(font->glyphs, codepoint, glyph);
+}
 
-    //font->line_height = TTF_FontLineSkip(ttf);
-    font->height = TTF_FontHeight(ttf);
-    font->ascent = TTF_FontAscent(ttf);
-    font->descent = -TTF_FontDescent(ttf);
+// Asks SDL_ttf for the glyph's box once, when it is rendered, so measuring text never has to.
+// Falls back to the rendered width between the font's ascent and descent.
+static FC_GlyphMetrics FC_GetTTFGlyphMetrics(FC_Font* font, TTF_Font* ttf, Uint32 codepoint, int glyph_width)
+{
+    FC_GlyphMetrics metrics;
+    int minx, maxx, miny, maxy, advance;
 
-    // Some bug for certain fonts can result in an incorrect height.
-    if(font->height < font->ascent - font->descent)
-        font->height = font->ascent - font->descent;
+    if(TTF_GlyphMetrics32(ttf, FC_GetUnicodeFromCodepoint(codepoint), &minx, &maxx, &miny, &maxy, &advance) == 0)
+    {
+        metrics.minx = minx;
+        metrics.maxx = maxx;
+        metrics.miny = miny;
+        metrics.maxy = maxy;
+        metrics.advance = advance;
+    }
+    else
+    {
+        metrics.minx = 0;
+        metrics.maxx = glyph_width;
+        metrics.miny = -font->descent;
+        metrics.maxy = font->ascent;
+        metrics.advance = glyph_width;
+    }
+    return metrics;
+}
 
-    font->baseline = font->height - font->descent;
+// Distance fields
 
-    font->default_color = color;
+// Squared distances come from the linear-time transform of Felzenszwalb and Huttenlocher, done over
+// every column and then every row.  Pixels that have nothing to be near start out this far away.
+#define FC_DISTANCE_FAR 1e20f
+
+// Transforms the 'n' values of 'grid' that start at 'offset' and are 'stride' apart.  'f' and 'v' hold
+// n values of scratch space and 'z' n+1.
+static void FC_TransformDistances(float* grid, int offset, int stride, int n, float* f, int* v, float* z)
+{
+    int q, k = 0;
+
+    f[0] = grid[offset];
+    v[0] = 0;
+    z[0] = -FC_DISTANCE_FAR;
+    z[1] = FC_DISTANCE_FAR;
 
+    // Find the lower envelope of the parabolas rooted at each value
+    for(q = 1; q < n; ++q)
     {
-        SDL_Color white = {255, 255, 255, 255};
-        SDL_Surface* glyph_surf;
-        char buff[5];
-        const char* buff_ptr = buff;
-        const char* source_string;
-        Uint8 packed = 0;
+        float s;
+        f[q] = grid[offset + q*stride];
+        do
+        {
+            int r = v[k];
+            s = (f[q] - f[r] + (float)(q*q - r*r)) / (2.0f*(q - r));
+        } while(s <= z[k] && --k >= 0);
+
+        ++k;
+        v[k] = q;
+        z[k] = s;
+        z[k+1] = FC_DISTANCE_FAR;
+    }
 
-        // Copy glyphs from the surface to the font texture and store the position data
-        // Pack row by row into a square texture
-        // Try figuring out dimensions that make sense for the font size.
-        unsigned int w = font->height*12;
-        unsigned int h = font->height*12;
-        SDL_Surface* surfaces[FC_LOAD_MAX_SURFACES];
-        int num_surfaces = 1;
-        surfaces[0] = FC_CreateSurface32(w, h);
-        font->last_glyph.rect.x = FC_CACHE_PADDING;
-        font->last_glyph.rect.y = FC_CACHE_PADDING;
-        font->last_glyph.rect.w = 0;
-        font->last_glyph.rect.h = font->height;
-
-        source_string = font->loading_string;
-        for(; *source_string != '\0'; source_string = U8_next(source_string))
-        {
-            memset(buff, 0, 5);
-            if(!U8_charcpy(buff, source_string, 5))
-                continue;
-            glyph_surf = TTF_RenderUTF8_Blended(ttf, buff, white);
-            if(glyph_surf == nullptr)
-                continue;
+    for(q = 0, k = 0; q < n; ++q)
+    {
+        int r;
+        while(z[k+1] < q)
+            ++k;
+        r = v[k];
+        grid[offset + q*stride] = f[r] + (float)((q - r)*(q - r));
+    }
+}
 
-            // Try packing.  If it fails, create a new surface for the next cache level.
-            packed = (FC_PackGlyphData(font, FC_GetCodepointFromUTF8(&buff_ptr, 0), glyph_surf->w, surfaces[num_surfaces-1]->w, surfaces[num_surfaces-1]->h) != nullptr);
-            if(!packed)
-            {
-                int i = num_surfaces-1;
-                if(num_surfaces >= FC_LOAD_MAX_SURFACES)
-                {
-                    // Can't do any more!
-                    SDL_Log("SDL_FontCache error: Could not create enough cache surfaces to fit all of the loading string!\n");
-                    SDL_FreeSurface(glyph_surf);
-                    break;
-                }
+static void FC_TransformDistances2D(float* grid, int w, int h, float* f, int* v, float* z)
+{
+    int i;
+    for(i = 0; i < w; ++i)
+        FC_TransformDistances(grid, i, w, h, f, v, z);
+    for(i = 0; i < h; ++i)
+        FC_TransformDistances(grid, i*w, 1, w, f, v, z);
+}
 
-                // Upload the current surface to the glyph cache now so we can keep the cache level packing cursor up to date as we go.
-                FC_UploadGlyphCache(font, i, surfaces[i]);
-                SDL_FreeSurface(surfaces[i]);
-                
-                SDL_SetTextureBlendMode(font->glyph_cache[i], SDL_BLENDMODE_BLEND);
-                
-                // Update the glyph cursor to the new cache level.  We need to do this here because the actual cache lags behind our use of the packing above.
-                font->last_glyph.cache_level = num_surfaces;
+// Replaces a rendered glyph's coverage with its signed distance to the outline: 128 on the edge, rising to
+// 255 'spread' pixels inside and falling to 0 as far outside.  Partly covered pixels put the edge inside
+// the pixel, like Mapbox's TinySDF does.  The field only covers the surface, so the caller leaves room for
+// the falloff around the glyph.  Returns 0, leaving the surface as it was, if it isn't a 32-bit surface or
+// memory runs out.
+static Uint8 FC_MakeDistanceField(SDL_Surface* surf, int spread)
+{
+    int w, h, n, i, x, y;
+    float* outer;
+    float* inner;
+    float* f;
+    float* z;
+    int* v;
+    Uint32 amask;
+    Uint8 ashift;
+
+    if(surf == nullptr || surf->format->BytesPerPixel != 4 || surf->format->Amask == 0 || spread <= 0)
+        return 0;
 
+    w = surf->w;
+    h = surf->h;
+    n = (w > h? w : h);
+    if(w <= 0 || h <= 0)
+        return 1;
 
-                surfaces[num_surfaces] = FC_CreateSurface32(w, h);
-                num_surfaces++;
-            }
+    outer = (float*)malloc(2 * w * h * sizeof(float));
+    f = (float*)malloc((2*n + 1) * sizeof(float));
+    v = (int*)malloc(n * sizeof(int));
+    if(outer == nullptr || f == nullptr || v == nullptr || SDL_LockSurface(surf) < 0)
+    {
+        free(outer);
+        free(f);
+        free(v);
+        return 0;
+    }
+    inner = outer + w*h;
+    z = f + n;
+
+    amask = surf->format->Amask;
+    ashift = surf->format->Ashift;
 
-            // Try packing for the new surface, then blit onto it.
-            if(packed || FC_PackGlyphData(font, FC_GetCodepointFromUTF8(&buff_ptr, 0), glyph_surf->w, surfaces[num_surfaces-1]->w, surfaces[num_surfaces-1]->h) != nullptr)
+    // 'outer' gets the squared distance to the glyph for pixels outside of it, 'inner' to the background for pixels inside
+    for(y = 0; y < h; ++y)
+    {
+        const Uint32* row = (const Uint32*)((const Uint8*)surf->pixels + y*surf->pitch);
+        for(x = 0; x < w; ++x)
+        {
+            float a = ((row[x] & amask) >> ashift) / 255.0f;
+            float d = 0.5f - a;
+            i = y*w + x;
+            if(a <= 0.0f)
             {
-                SDL_SetSurfaceBlendMode(glyph_surf, SDL_BLENDMODE_NONE);
-                SDL_Rect srcRect = {0, 0, glyph_surf->w, glyph_surf->h};
-                SDL_Rect destrect = font->last_glyph.rect;
-                SDL_BlitSurface(glyph_surf, &srcRect, surfaces[num_surfaces-1], &destrect);
+                outer[i] = FC_DISTANCE_FAR;
+                inner[i] = 0.0f;
+            }
+            else if(a >= 1.0f)
+            {
+                outer[i] = 0.0f;
+                inner[i] = FC_DISTANCE_FAR;
+            }
+            else
+            {
+                outer[i] = (d > 0.0f? d*d : 0.0f);
+                inner[i] = (d < 0.0f? d*d : 0.0f);
             }
-
-            SDL_FreeSurface(glyph_surf);
         }
+    }
 
+    FC_TransformDistances2D(outer, w, h, f, v, z);
+    FC_TransformDistances2D(inner, w, h, f, v, z);
+
+    for(y = 0; y < h; ++y)
+    {
+        Uint32* row = (Uint32*)((Uint8*)surf->pixels + y*surf->pitch);
+        for(x = 0; x < w; ++x)
         {
-            int i = num_surfaces-1;
-            FC_UploadGlyphCache(font, i, surfaces[i]);
-            SDL_FreeSurface(surfaces[i]);
-            SDL_SetTextureBlendMode(font->glyph_cache[i], SDL_BLENDMODE_BLEND);
+            float d;
+            int value;
+            i = y*w + x;
+            d = SDL_sqrtf(outer[i]) - SDL_sqrtf(inner[i]);
+            value = (int)(255.0f*(0.5f - d/(2.0f*spread)) + 0.5f);
+            if(value < 0)
+                value = 0;
+            else if(value > 255)
+                value = 255;
+            row[x] = (row[x] & ~amask) | ((Uint32)value << ashift);
         }
     }
 
+    SDL_UnlockSurface(surf);
+    free(outer);
+    free(f);
+    free(v);
     return 1;
 }
 
-Uint8 FC_LoadFont(FC_Font* font, SDL_Renderer* renderer, const char* filename_ttf, Uint32 pointSize, SDL_Color color, int style)
+// Renders a glyph white, the way it is stored in the cache levels.  Distance field glyphs come with
+// font->field_padding pixels on every side, so the falloff outside of ink that touches the box isn't cut off.
+static SDL_Surface* FC_RenderGlyphSurface(FC_Font* font, TTF_Font* ttf, const char* character)
 {
-    SDL_RWops* rwops;
+    SDL_Color white = {255, 255, 255, 255};
+    SDL_Surface* surf = TTF_RenderUTF8_Blended(ttf, character, white);
+    int spread = font->field_padding;
+    SDL_Surface* padded;
+    SDL_Rect destrect;
 
-    if(font == nullptr)
-        return 0;
+    if(surf == nullptr || spread <= 0)
+        return surf;
 
-    rwops = SDL_RWFromFile(filename_ttf, "rb");
+    padded = FC_CreateSurface32(surf->w + 2*spread, surf->h + 2*spread);
+    if(padded == nullptr)
+    {
+        SDL_FreeSurface(surf);
+        return nullptr;
+    }
+    SDL_FillRect(padded, nullptr, SDL_MapRGBA(padded->format, 255, 255, 255, 0));
 
-    if(rwops == nullptr)
+    destrect.x = spread;
+    destrect.y = spread;
+    destrect.w = surf->w;
+    destrect.h = surf->h;
+    SDL_SetSurfaceBlendMode(surf, SDL_BLENDMODE_NONE);
+    SDL_BlitSurface(surf, nullptr, padded, &destrect);
+    SDL_FreeSurface(surf);
+
+    if(!FC_MakeDistanceField(padded, spread))
     {
-        SDL_Log("Unable to open file for reading: %s \n", SDL_GetError());
-        return 0;
+        SDL_FreeSurface(padded);
+        return nullptr;
     }
+    return padded;
+}
 
-    return FC_LoadFont_RW(font, renderer, rwops, 1, pointSize, color, style);
+static const char* FC_DISTANCE_FIELD_SHADER =
+    "varying vec4 v_color;\n"
+    "varying vec2 v_texCoord;\n"
+    "uniform sampler2D tex0;\n"
+    "\n"
+    "void main()\n"
+    "{\n"
+    "    float distance = texture2D(tex0, v_texCoord).a;\n"
+    "    float smoothing = max(fwidth(distance) * 0.5, 0.0001);\n"
+    "    float alpha = smoothstep(0.5 - smoothing, 0.5 + smoothing, distance);\n"
+    "    gl_FragColor = vec4(v_color.rgb, v_color.a * alpha);\n"
+    "}\n";
+
+const char* FC_GetDistanceFieldShader(void)
+{
+    return FC_DISTANCE_FIELD_SHADER;
 }
 
-Uint8 FC_LoadFont_RW(FC_Font* font, SDL_Renderer* renderer, SDL_RWops* file_rwops_ttf, Uint8 own_rwops, Uint32 pointSize, SDL_Color color, int style)
+void FC_SetDistanceField(FC_Font* font, int spread)
 {
-    Uint8 result;
-    TTF_Font* ttf;
-    Uint8 outline;
+    if(font == nullptr)
+        return;
+
+    font->distance_field = (spread > 0? spread : 0);
+    if(font->distance_field > 0)
+        FC_SetFilterMode(font, FC_FILTER_LINEAR);
+}
 
+int FC_GetDistanceField(FC_Font* font)
+{
     if(font == nullptr)
         return 0;
 
-    if(!TTF_WasInit() && TTF_Init() < 0)
+    return font->distance_field;
+}
+
+void FC_SetDistanceFieldCallback(FC_Font* font, void (*callback)(FC_Font* font, SDL_Renderer* dest, Uint8 begin, void* userdata), void* userdata)
+{
+    if(font == nullptr)
+        return;
+
+    font->distance_field_callback = callback;
+    font->distance_field_userdata = userdata;
+}
+
+
+static void FC_FreeKerning(FC_Kerning* kerning)
+{
+    free(kerning->dense);
+    free(kerning->slots);
+    memset(kerning, 0, sizeof(FC_Kerning));
+}
+
+// Gives each loading string character in the direct range a row in the dense table, and fills it in
+static void FC_SetupKerning(FC_Font* font, TTF_Font* ttf)
+{
+    FC_Kerning* kerning = &font->kerning;
+    Uint32 unicode[FC_MAP_DIRECT_SIZE];
+    const char* c;
+    int i, j;
+
+    FC_FreeKerning(kerning);
+    kerning->enabled = (TTF_GetFontKerning(ttf) != 0);
+    memset(kerning->dense_index, -1, sizeof(kerning->dense_index));
+
+    for(c = font->loading_string; c != nullptr && *c != '\0'; c = U8_next(c))
     {
-        SDL_Log("Unable to initialize SDL_ttf: %s \n", TTF_GetError());
-        if(own_rwops)
-            SDL_RWclose(file_rwops_ttf);
-        return 0;
+        Uint32 codepoint = FC_GetCodepointFromUTF8(&c, 0);
+        int direct = FC_MapDirectIndex(codepoint);
+        if(direct >= 0 && kerning->dense_index[direct] < 0)
+        {
+            unicode[kerning->num_dense] = FC_GetUnicodeFromCodepoint(codepoint);
+            kerning->dense_index[direct] = kerning->num_dense++;
+        }
     }
 
-    ttf = TTF_OpenFontRW(file_rwops_ttf, own_rwops, pointSize);
+    if(!kerning->enabled || kerning->num_dense == 0)
+        return;
 
-    if(ttf == nullptr)
+    kerning->dense = (Sint16*)malloc(kerning->num_dense * kerning->num_dense * sizeof(Sint16));
+    if(kerning->dense == nullptr)
     {
-        SDL_Log("Unable to load TrueType font: %s \n", TTF_GetError());
-        if(own_rwops)
-            SDL_RWclose(file_rwops_ttf);
-        return 0;
+        SDL_Log("SDL_FontCache error: Out of memory for the kerning table.\n");
+        return;
     }
 
-    outline = (style & TTF_STYLE_OUTLINE);
-    if(outline)
+    for(i = 0; i < kerning->num_dense; ++i)
     {
-        style &= ~TTF_STYLE_OUTLINE;
-        TTF_SetFontOutline(ttf, 1);
+        for(j = 0; j < kerning->num_dense; ++j)
+            kerning->dense[i * kerning->num_dense + j] = (Sint16)TTF_GetFontKerningSizeGlyphs32(ttf, unicode[i], unicode[j]);
     }
-    TTF_SetFontStyle(ttf, style);
+}
 
-    result = FC_LoadFontFromTTF(font, renderer, ttf, color);
+static FC_KerningSlot* FC_KerningProbe(FC_KerningSlot* slots, int capacity, Uint64 key)
+{
+    Uint32 mask = (Uint32)capacity - 1;
+    Uint32 index = FC_MapHash((Uint32)(key >> 32) ^ FC_MapHash((Uint32)key)) & mask;
 
-    // Can only load new (uncached) glyphs if we can keep the SDL_RWops open.
-    font->owns_ttf_source = own_rwops;
-    if(!own_rwops)
-    {
-        TTF_CloseFont(font->ttf_source);
-        font->ttf_source = nullptr;
-    }
+    while(slots[index].key != 0 && slots[index].key != key)
+        index = (index + 1) & mask;
 
-    return result;
+    return &slots[index];
 }
 
-void FC_ClearFont(FC_Font* font)
+static Sint16* FC_KerningFindOrInsert(FC_Kerning* kerning, Uint64 key)
 {
-    int i;
-    if(font == nullptr)
-        return;
+    FC_KerningSlot* slot;
 
-    // Release resources
-    if(font->owns_ttf_source)
-        TTF_CloseFont(font->ttf_source);
-
-    font->owns_ttf_source = 0;
-    font->ttf_source = nullptr;
+    if(kerning->slots == nullptr)
+    {
+        kerning->slots = (FC_KerningSlot*)calloc(FC_KERNING_INITIAL_CAPACITY, sizeof(FC_KerningSlot));
+        if(kerning->slots == nullptr)
+            return nullptr;
+        kerning->capacity = FC_KERNING_INITIAL_CAPACITY;
+    }
 
-    // Delete glyph map
-    FC_MapFree(font->glyphs);
-    font->glyphs = nullptr;
+    slot = FC_KerningProbe(kerning->slots, kerning->capacity, key);
+    if(slot->key != 0)
+        return &slot->value;
 
-    // Delete glyph cache
-    for(i = 0; i < font->glyph_cache_count; ++i)
+    // Same 1/2 load factor as the glyph map
+    if((kerning->count + 1) * 2 > kerning->capacity)
     {
-        SDL_DestroyTexture(font->glyph_cache[i]);
+        int i;
+        int new_capacity = kerning->capacity * 2;
+        FC_KerningSlot* new_slots = (FC_KerningSlot*)calloc(new_capacity, sizeof(FC_KerningSlot));
+        if(new_slots == nullptr)
+            return nullptr;
+
+        for(i = 0; i < kerning->capacity; ++i)
+        {
+            if(kerning->slots[i].key != 0)
+                *FC_KerningProbe(new_slots, new_capacity, kerning->slots[i].key) = kerning->slots[i];
+        }
+
+        free(kerning->slots);
+        kerning->slots = new_slots;
+        kerning->capacity = new_capacity;
+        slot = FC_KerningProbe(kerning->slots, kerning->capacity, key);
     }
-    free(font->glyph_cache);
-    font->glyph_cache = nullptr;
 
-    // Reset font
-    FC_Init(font);
+    slot->key = key;
+    slot->value = FC_KERNING_UNKNOWN;
+    kerning->count++;
+    return &slot->value;
 }
 
+// Returns the pen adjustment between two packed codepoints.  'prev' is 0 at the start of a line.
+// Safe to call from several threads at once, as long as nothing is loading glyphs into the font.
+static int FC_GetKerning(FC_Font* font, Uint32 prev, Uint32 codepoint)
+{
+    FC_Kerning* kerning = &font->kerning;
+    Sint16* value;
+    int result;
+    int row, column;
 
-void FC_FreeFont(FC_Font* font)
+    if(!kerning->enabled || prev == 0 || font->ttf_source == nullptr)
+        return 0;
+
+    row = FC_MapDirectIndex(prev);
+    column = FC_MapDirectIndex(codepoint);
+    row = (row >= 0? kerning->dense_index[row] : -1);
+    column = (column >= 0? kerning->dense_index[column] : -1);
+
+    if(row >= 0 && column >= 0)
+        return (kerning->dense != nullptr? kerning->dense[row * kerning->num_dense + column] : 0);
+
+    SDL_AtomicLock(&kerning->lock);
+    result = 0;
+    value = FC_KerningFindOrInsert(kerning, (Uint64)prev << 32 | codepoint);
+    if(value != nullptr)
+    {
+        if(*value == FC_KERNING_UNKNOWN)
+            *value = (Sint16)TTF_GetFontKerningSizeGlyphs32(font->ttf_source, FC_GetUnicodeFromCodepoint(prev), FC_GetUnicodeFromCodepoint(codepoint));
+        result = *value;
+    }
+    SDL_AtomicUnlock(&kerning->lock);
+
+    return result;
+}
+
+// FC_GetKerning() for readers that can't fill in the tables.  Returns 0 if the pair hasn't been looked up yet.
+static Uint8 FC_PeekKerning(FC_Font* font, Uint32 prev, Uint32 codepoint, int* result)
+{
+    FC_Kerning* kerning = &font->kerning;
+    Sint16 value = FC_KERNING_UNKNOWN;
+    int row, column;
+
+    *result = 0;
+    if(!kerning->enabled || prev == 0 || font->ttf_source == nullptr)
+        return 1;
+
+    row = FC_MapDirectIndex(prev);
+    column = FC_MapDirectIndex(codepoint);
+    row = (row >= 0? kerning->dense_index[row] : -1);
+    column = (column >= 0? kerning->dense_index[column] : -1);
+
+    if(row >= 0 && column >= 0)
+    {
+        if(kerning->dense != nullptr)
+            *result = kerning->dense[row * kerning->num_dense + column];
+        return 1;
+    }
+
+    SDL_AtomicLock(&kerning->lock);
+    if(kerning->slots != nullptr)
+    {
+        Uint64 key = (Uint64)prev << 32 | codepoint;
+        FC_KerningSlot* slot = FC_KerningProbe(kerning->slots, kerning->capacity, key);
+        if(slot->key == key)
+            value = slot->value;
+    }
+    SDL_AtomicUnlock(&kerning->lock);
+
+    if(value == FC_KERNING_UNKNOWN)
+        return 0;
+
+    *result = value;
+    return 1;
+}
+
+
+SDL_Texture* FC_GetGlyphCacheLevel(FC_Font* font, int cache_level)
 {
-    int i;
     if(font == nullptr)
-        return;
+        return nullptr;
 
-    // Release resources
-    if(font->owns_ttf_source)
-        TTF_CloseFont(font->ttf_source);
+    font = FC_GetCacheOwner(font);
+    if(cache_level < 0 || cache_level >= font->glyph_cache_count)
+        return nullptr;
 
-    // Delete glyph map
-    FC_MapFree(font->glyphs);
+    return font->glyph_cache[cache_level];
+}
 
-    // Delete glyph cache
-    for(i = 0; i < font->glyph_cache_count; ++i)
+Uint8 FC_SetGlyphCacheLevel(FC_Font* font, int cache_level, SDL_Texture* cache_texture)
+{
+    FC_Font* owner;
+
+    if(font == nullptr || cache_level < 0)
+        return 0;
+
+    owner = FC_GetCacheOwner(font);
+
+    // Must be sequentially added
+    if(cache_level > owner->glyph_cache_count + 1)
+        return 0;
+
+    if(cache_level == owner->glyph_cache_count)
     {
-        SDL_DestroyTexture(font->glyph_cache[i]);
+        owner->glyph_cache_count++;
+
+        // Grow cache?
+        if(owner->glyph_cache_count > owner->glyph_cache_size)
+        {
+            // Copy old cache to new one
+            int i;
+            SDL_Texture** new_cache;
+            new_cache = (SDL_Texture**)malloc(owner->glyph_cache_count * sizeof(SDL_Texture*));
+            for(i = 0; i < owner->glyph_cache_size; ++i)
+                new_cache[i] = owner->glyph_cache[i];
+
+            // Save new cache
+            free(owner->glyph_cache);
+            owner->glyph_cache_size = owner->glyph_cache_count;
+            owner->glyph_cache = new_cache;
+        }
+
+        FC_NotifyStats(font, FC_STATS_CACHE_LEVEL_ADDED, cache_level);
     }
-    free(font->glyph_cache);
 
-    free(font->loading_string);
+    // Whatever the new texture holds, the old shadow doesn't match it
+    FC_SetShadowLevel(owner, cache_level, nullptr);
+    owner->glyph_cache[cache_level] = cache_texture;
+    ++owner->generation;
+    return 1;
+}
 
-    free(font);
+float FC_GetCacheLevelOccupancy(FC_Font* font, int cache_level)
+{
+    FC_Skyline* skyline;
 
-    // If the last font has been freed; assume shutdown and free the global variables
-    if (--NUM_EXISTING_FONTS <= 0)
+    if(font == nullptr)
+        return 0.0f;
+
+    font = FC_GetCacheOwner(font);
+    if(cache_level < 0 || cache_level >= font->num_packers)
+        return 0.0f;
+
+    skyline = &font->packers[cache_level];
+    if(skyline->width <= 0 || skyline->height <= 0)
+        return 0.0f;
+
+    return skyline->used_area / ((float)skyline->width * skyline->height);
+}
+
+
+FC_Font* FC_CreateFont(void)
+{
+    FC_Font* font;
+
+    font = (FC_Font*)malloc(sizeof(FC_Font));
+    memset(font, 0, sizeof(FC_Font));
+
+    FC_Init(font);
+    font->thread = SDL_ThreadID();
+
+    SDL_AtomicLock(&fc_strings_lock);
+    ++NUM_EXISTING_FONTS;
+    SDL_AtomicUnlock(&fc_strings_lock);
+
+    return font;
+}
+
+
+// Hashes what decides how the TTF_Font's glyphs come out, so a saved cache is only used for the same face, size and style.
+// SDL_ttf can't report the point size, so the font's metrics and a few glyph boxes stand in for it.
+static Uint32 FC_GetTTFSignature(TTF_Font* ttf)
+{
+    const char* probe = "AMWgjy0@";
+    const char* names[2];
+    int values[8];
+    Uint32 hash = 2166136261u;
+    int i;
+
+    names[0] = TTF_FontFaceFamilyName(ttf);
+    names[1] = TTF_FontFaceStyleName(ttf);
+    for(i = 0; i < 2; ++i)
     {
-        free(ASCII_STRING);
-        ASCII_STRING = nullptr;
+        const char* c = names[i];
+        for(; c != nullptr && *c != '\0'; ++c)
+            hash = (hash ^ (Uint8)*c) * 16777619u;
+        hash = (hash ^ 0xFF) * 16777619u;
+    }
 
-        free(LATIN_1_STRING);
-        LATIN_1_STRING = nullptr;
+    values[0] = TTF_FontHeight(ttf);
+    values[1] = TTF_FontAscent(ttf);
+    values[2] = TTF_FontDescent(ttf);
+    values[3] = TTF_FontLineSkip(ttf);
+    values[4] = TTF_GetFontStyle(ttf);
+    values[5] = TTF_GetFontOutline(ttf);
+    values[6] = TTF_GetFontHinting(ttf);
+    values[7] = TTF_GetFontKerning(ttf);
+    for(i = 0; i < 8; ++i)
+        hash = (hash ^ (Uint32)values[i]) * 16777619u;
+
+    for(; *probe != '\0'; ++probe)
+    {
+        int minx = 0, maxx = 0, miny = 0, maxy = 0, advance = 0;
+        TTF_GlyphMetrics32(ttf, (Uint8)*probe, &minx, &maxx, &miny, &maxy, &advance);
+        values[0] = minx;
+        values[1] = maxx;
+        values[2] = miny;
+        values[3] = maxy;
+        values[4] = advance;
+        for(i = 0; i < 5; ++i)
+            hash = (hash ^ (Uint32)values[i]) * 16777619u;
+    }
+    return hash;
+}
 
-        free(ASCII_LATIN_1_STRING);
-        ASCII_LATIN_1_STRING = nullptr;
+// SDL2 has no alpha-only texture format, so the smallest that keeps coverage is a 16-bit 4444 one
+static Uint32 FC_GetPackedAlphaFormat(const SDL_RendererInfo* info)
+{
+    Uint32 i;
+    for(i = 0; i < info->num_texture_formats; ++i)
+    {
+        switch(info->texture_formats[i])
+        {
+        case SDL_PIXELFORMAT_ARGB4444:
+        case SDL_PIXELFORMAT_RGBA4444:
+        case SDL_PIXELFORMAT_ABGR4444:
+        case SDL_PIXELFORMAT_BGRA4444:
+            return info->texture_formats[i];
+        }
+    }
+    return SDL_PIXELFORMAT_UNKNOWN;
+}
+
+static void FC_SetupFontMetrics(FC_Font* font, SDL_Renderer* renderer, TTF_Font* ttf, SDL_Color color)
+{
+    FC_ClearFont(font);
 
-        free(fc_buffer);
-        fc_buffer = nullptr;
+
+    // Might as well check render target support here.  Headless fonts have no renderer to ask.
+    SDL_RendererInfo info;
+    memset(&info, 0, sizeof(info));
+    if(renderer != nullptr)
+    {
+        SDL_GetRendererInfo(renderer, &info);
+        fc_has_render_target_support = (info.flags & SDL_RENDERER_TARGETTEXTURE);
     }
+
+    font->renderer = renderer;
+    font->thread = SDL_ThreadID();
+
+    font->ttf_source = ttf;
+
+    //font->line_height = TTF_FontLineSkip(ttf);
+    font->height = TTF_FontHeight(ttf);
+    font->ascent = TTF_FontAscent(ttf);
+    font->descent = -TTF_FontDescent(ttf);
+
+    // Some bug for certain fonts can result in an incorrect height.
+    if(font->height < font->ascent - font->descent)
+        font->height = font->ascent - font->descent;
+
+    font->baseline = font->height - font->descent;
+    font->ttf_signature = FC_GetTTFSignature(ttf);
+    font->field_padding = font->distance_field;
+
+    FC_SetupKerning(font, ttf);
+
+    font->default_color = color;
+
+    // Cache levels used to be 12 lines square, which is still the default
+    font->cache_level_size = (font->cache_level_size_hint > 0? font->cache_level_size_hint : font->height*12);
+    if(info.max_texture_width > 0 && font->cache_level_size > info.max_texture_width)
+        font->cache_level_size = info.max_texture_width;
+    if(info.max_texture_height > 0 && font->cache_level_size > info.max_texture_height)
+        font->cache_level_size = info.max_texture_height;
+
+    font->cache_pixel_format = SDL_PIXELFORMAT_UNKNOWN;
+    if(font->cache_format == FC_CACHE_FORMAT_ALPHA)
+        font->cache_pixel_format = FC_GetPackedAlphaFormat(&info);
 }
 
-int FC_GetNumCacheLevels(FC_Font* font)
+// Lists the characters to load up front: the loading string, then whatever the ttf has of the loading ranges.
+// Each character is in the result once.  Returns the number of characters or -1 if out of memory.
+static int FC_GetLoadingCharacters(FC_Font* font, TTF_Font* ttf, char (**result)[5])
 {
-    return font->glyph_cache_count;
+    FC_Map* seen = FC_MapCreate();
+    FC_GlyphData empty = FC_MakeGlyphData(0, 0, 0, 0, 0);
+    unsigned int size = U8_strlen(font->loading_string) + 1;
+    int count = 0;
+    const char* c;
+    int i;
+    Uint32 unicode;
+
+    for(i = 0; i < font->num_loading_ranges; ++i)
+        size += font->loading_ranges[i].last - font->loading_ranges[i].first + 1;
+
+    *result = (char (*)[5])calloc(size, 5);
+    if(seen == nullptr || *result == nullptr)
+    {
+        FC_MapFree(seen);
+        free(*result);
+        *result = nullptr;
+        return -1;
+    }
+
+    for(c = font->loading_string; *c != '\0'; c = U8_next(c))
+    {
+        const char* next = c;
+        Uint32 codepoint = FC_GetCodepointFromUTF8(&next, 0);
+        if(FC_MapFind(seen, codepoint) != nullptr || !U8_charcpy((*result)[count], c, 5))
+            continue;
+        FC_MapInsert(seen, codepoint, empty);
+        ++count;
+    }
+
+    for(i = 0; i < font->num_loading_ranges; ++i)
+    {
+        for(unicode = font->loading_ranges[i].first; unicode <= font->loading_ranges[i].last; ++unicode)
+        {
+            Uint32 codepoint = FC_GetCodepointFromUnicode(unicode);
+            if(FC_IsSurrogate(unicode) || FC_MapFind(seen, codepoint) != nullptr || !TTF_GlyphIsProvided32(ttf, unicode))
+                continue;
+            FC_MapInsert(seen, codepoint, empty);
+            FC_GetUTF8FromCodepoint((*result)[count++], codepoint);
+        }
+    }
+
+    FC_MapFree(seen);
+    return count;
 }
 
-Uint8 FC_AddGlyphToCache(FC_Font* font, SDL_Surface* glyph_surface)
+Uint8 FC_LoadFontFromTTF(FC_Font* font, SDL_Renderer* renderer, TTF_Font* ttf, SDL_Color color)
 {
-    if(font == nullptr || glyph_surface == nullptr)
+    char (*characters)[5];
+    int num_characters;
+    int i;
+
+    if(font == nullptr || ttf == nullptr)
         return 0;
 
-    SDL_SetSurfaceBlendMode(glyph_surface, SDL_BLENDMODE_NONE);
-    SDL_Texture* dest = FC_GetGlyphCacheLevel(font, font->last_glyph.cache_level);
-    if(dest == nullptr)
+    if(font->atlas != nullptr && font->atlas->cache->renderer != renderer)
+    {
+        SDL_Log("SDL_FontCache error: A font has to be loaded with the renderer of its atlas.\n");
         return 0;
+    }
+    
+    FC_SetupFontMetrics(font, renderer, ttf, color);
 
+    num_characters = FC_GetLoadingCharacters(font, ttf, &characters);
+    if(num_characters < 0)
     {
-        SDL_Renderer* renderer = font->renderer;
-        SDL_Texture* img;
-        SDL_Rect destrect;
-        SDL_Texture* prev_target = SDL_GetRenderTarget(renderer);
-        SDL_Rect prev_clip, prev_viewport;
-        int prev_logicalw, prev_logicalh;
-        Uint8 prev_clip_enabled;
-        float prev_scalex, prev_scaley;
-        // only backup if previous target existed (SDL will preserve them for the default target)
-        if (prev_target) {
-            prev_clip_enabled = has_clip(renderer);
-            if (prev_clip_enabled)
-                prev_clip = get_clip(renderer);
-            SDL_RenderGetViewport(renderer, &prev_viewport);
-            SDL_RenderGetScale(renderer, &prev_scalex, &prev_scaley);
-            SDL_RenderGetLogicalSize(renderer, &prev_logicalw, &prev_logicalh);
+        SDL_Log("SDL_FontCache error: Out of memory for the loading characters.\n");
+        return 0;
+    }
+
+    // The atlas already has a level to pack into, and headless fonts only measure, so the loading characters
+    // go in the same way as any other glyph
+    if(font->atlas != nullptr || renderer == nullptr)
+    {
+        for(i = 0; i < num_characters; ++i)
+        {
+            const char* c = characters[i];
+            FC_GetGlyphData(font, nullptr, FC_GetCodepointFromUTF8(&c, 0));
         }
+        FC_FlushGlyphUploads(font);
+        free(characters);
+        return 1;
+    }
+
+    {
+        SDL_Surface* glyph_surf;
+        const char* buff_ptr;
+        Uint32 codepoint;
+        FC_GlyphMetrics metrics;
 
-        img = SDL_CreateTextureFromSurface(renderer, glyph_surface);
+        // Copy glyphs from the surface to the font texture and store the position data
+        // Pack into square textures of the size picked in FC_SetupFontMetrics()
+        unsigned int w = font->cache_level_size;
+        unsigned int h = font->cache_level_size;
+        SDL_Surface* surface = FC_CreateSurface32(w, h);
+        int level = 0;
 
-        destrect = font->last_glyph.rect;
-        SDL_SetRenderTarget(renderer, dest);
-        SDL_RenderCopy(renderer, img, nullptr, &destrect);
-        SDL_SetRenderTarget(renderer, prev_target);
-        if (prev_target) {
-            if (prev_clip_enabled)
-                set_clip(renderer, &prev_clip);
-            if (prev_logicalw && prev_logicalh)
-                SDL_RenderSetLogicalSize(renderer, prev_logicalw, prev_logicalh);
-            else {
-                SDL_RenderSetViewport(renderer, &prev_viewport);
-                SDL_RenderSetScale(renderer, prev_scalex, prev_scaley);
+        for(i = 0; i < num_characters && surface != nullptr; ++i)
+        {
+            glyph_surf = FC_RenderGlyphSurface(font, ttf, characters[i]);
+            if(glyph_surf == nullptr)
+                continue;
+            ++font->stats.glyphs_rendered;
+            buff_ptr = characters[i];
+            codepoint = FC_GetCodepointFromUTF8(&buff_ptr, 0);
+            metrics = FC_GetTTFGlyphMetrics(font, ttf, codepoint, glyph_surf->w - 2*font->field_padding);
+
+            // Try packing.  If the level is full, upload it and reuse the surface for the next one.
+            if(FC_PackGlyphData(font, codepoint, metrics, glyph_surf->w, glyph_surf->h, w, h) == nullptr)
+            {
+                if(FC_UploadGlyphCache(font, level, surface))
+                    SDL_SetTextureBlendMode(font->glyph_cache[level], SDL_BLENDMODE_BLEND);
+                SDL_FillRect(surface, nullptr, 0);
+
+                // Update the glyph cursor to the new cache level.  We need to do this here because the actual cache lags behind our use of the packing above.
+                font->last_glyph.cache_level = ++level;
+
+                if(FC_PackGlyphData(font, codepoint, metrics, glyph_surf->w, glyph_surf->h, w, h) == nullptr)
+                {
+                    // Too big for an empty level
+                    SDL_FreeSurface(glyph_surf);
+                    continue;
+                }
             }
+
+            SDL_SetSurfaceBlendMode(glyph_surf, SDL_BLENDMODE_NONE);
+            SDL_Rect srcRect = {0, 0, glyph_surf->w, glyph_surf->h};
+            SDL_Rect destrect = font->last_glyph.rect;
+            SDL_BlitSurface(glyph_surf, &srcRect, surface, &destrect);
+
+            SDL_FreeSurface(glyph_surf);
         }
 
-        SDL_DestroyTexture(img);
+        if(surface != nullptr && FC_UploadGlyphCache(font, level, surface))
+            SDL_SetTextureBlendMode(font->glyph_cache[level], SDL_BLENDMODE_BLEND);
+        SDL_FreeSurface(surface);
+    }
+
+    free(characters);
+    return 1;
+}
+
+Uint8 FC_LoadFont(FC_Font* font, SDL_Renderer* renderer, const char* filename_ttf, Uint32 pointSize, SDL_Color color, int style)
+{
+    SDL_RWops* rwops;
+
+    if(font == nullptr)
+        return 0;
+
+    rwops = SDL_RWFromFile(filename_ttf, "rb");
+
+    if(rwops == nullptr)
+    {
+        SDL_Log("Unable to open file for reading: %s \n", SDL_GetError());
+        return 0;
+    }
+
+    return FC_LoadFont_RW(font, renderer, rwops, 1, pointSize, color, style);
+}
+
+static void FC_SetTTFStyle(TTF_Font* ttf, int style)
+{
+    if(style & TTF_STYLE_OUTLINE)
+    {
+        style &= ~TTF_STYLE_OUTLINE;
+        TTF_SetFontOutline(ttf, 1);
     }
+    TTF_SetFontStyle(ttf, style);
+}
+
+static Uint8 FC_InitTTF(void)
+{
+    Uint8 result;
+    SDL_AtomicLock(&fc_ttf_lock);
+    result = (TTF_WasInit() || TTF_Init() == 0);
+    SDL_AtomicUnlock(&fc_ttf_lock);
+    return result;
+}
+
+static TTF_Font* FC_OpenTTF_RW(SDL_RWops* rwops, int own_rwops, Uint32 pointSize)
+{
+    TTF_Font* ttf;
+    SDL_AtomicLock(&fc_ttf_lock);
+    ttf = TTF_OpenFontRW(rwops, own_rwops, pointSize);
+    SDL_AtomicUnlock(&fc_ttf_lock);
+    return ttf;
+}
+
+static void FC_CloseTTF(TTF_Font* ttf)
+{
+    SDL_AtomicLock(&fc_ttf_lock);
+    TTF_CloseFont(ttf);
+    SDL_AtomicUnlock(&fc_ttf_lock);
+}
+
+Uint8 FC_LoadFont_RW(FC_Font* font, SDL_Renderer* renderer, SDL_RWops* file_rwops_ttf, Uint8 own_rwops, Uint32 pointSize, SDL_Color color, int style)
+{
+    Uint8 result;
+    TTF_Font* ttf;
+
+    if(font == nullptr)
+        return 0;
+
+    if(!FC_InitTTF())
+    {
+        SDL_Log("Unable to initialize SDL_ttf: %s \n", TTF_GetError());
+        if(own_rwops)
+            SDL_RWclose(file_rwops_ttf);
+        return 0;
+    }
+
+    ttf = FC_OpenTTF_RW(file_rwops_ttf, own_rwops, pointSize);
+
+    if(ttf == nullptr)
+    {
+        SDL_Log("Unable to load TrueType font: %s \n", TTF_GetError());
+        if(own_rwops)
+            SDL_RWclose(file_rwops_ttf);
+        return 0;
+    }
+
+    FC_SetTTFStyle(ttf, style);
+
+    result = FC_LoadFontFromTTF(font, renderer, ttf, color);
+
+    // Can only load new (uncached) glyphs if we can keep the SDL_RWops open.
+    font->owns_ttf_source = own_rwops;
+    if(!own_rwops)
+    {
+        FC_CloseTTF(font->ttf_source);
+        font->ttf_source = nullptr;
+    }
+
+    return result;
+}
+
+// Font sources
+
+struct FC_FontSource
+{
+    SDL_atomic_t refcount;  // The creator's reference, plus one for each font and load reading from it
+    const void* data;
+    size_t size;
+    void* allocated;  // Copy of the file to SDL_free(), if it was read into memory
+    Uint8 mapped;  // The data is a mapping of the file to unmap
+};
+
+static FC_FontSource* FC_MakeFontSource(const void* data, size_t size)
+{
+    FC_FontSource* source = (FC_FontSource*)calloc(1, sizeof(FC_FontSource));
+    if(source == nullptr)
+        return nullptr;
+
+    SDL_AtomicSet(&source->refcount, 1);
+    source->data = data;
+    source->size = size;
+    return source;
+}
+
+static FC_FontSource* FC_RetainFontSource(FC_FontSource* source)
+{
+    SDL_AtomicIncRef(&source->refcount);
+    return source;
+}
+
+static void FC_ReleaseFontSource(FC_FontSource* source)
+{
+    if(source == nullptr || !SDL_AtomicDecRef(&source->refcount))
+        return;
+
+#ifdef FC_USE_MMAP
+    if(source->mapped)
+        munmap((void*)source->data, source->size);
+#endif
+    SDL_free(source->allocated);
+    free(source);
+}
+
+// Takes ownership of 'data', from SDL_LoadFile()
+static FC_FontSource* FC_MakeLoadedFontSource(void* data, size_t size)
+{
+    FC_FontSource* source;
+    if(data == nullptr)
+    {
+        SDL_Log("Unable to read TrueType font: %s \n", SDL_GetError());
+        return nullptr;
+    }
+
+    source = FC_MakeFontSource(data, size);
+    if(source == nullptr)
+    {
+        SDL_free(data);
+        return nullptr;
+    }
+    source->allocated = data;
+    return source;
+}
+
+FC_FontSource* FC_CreateFontSource(const char* filename_ttf)
+{
+    size_t size;
+
+    if(filename_ttf == nullptr)
+        return nullptr;
+
+#ifdef FC_USE_MMAP
+    // Read-only pages of a mapping are shared with the OS file cache, and only the parts FreeType reads are loaded
+    {
+        int fd = open(filename_ttf, O_RDONLY);
+        if(fd >= 0)
+        {
+            struct stat info;
+            void* data = MAP_FAILED;
+            if(fstat(fd, &info) == 0 && info.st_size > 0)
+                data = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            close(fd);
+
+            if(data != MAP_FAILED)
+            {
+                FC_FontSource* source = FC_MakeFontSource(data, (size_t)info.st_size);
+                if(source == nullptr)
+                    munmap(data, (size_t)info.st_size);
+                else
+                    source->mapped = 1;
+                return source;
+            }
+        }
+    }
+#endif
+
+    // SDL can also reach files that aren't on the filesystem, like Android assets
+    {
+        void* data = SDL_LoadFile(filename_ttf, &size);
+        return FC_MakeLoadedFontSource(data, size);
+    }
+}
+
+FC_FontSource* FC_CreateFontSource_RW(SDL_RWops* file_rwops_ttf, Uint8 own_rwops)
+{
+    size_t size;
+    void* data;
+
+    if(file_rwops_ttf == nullptr)
+        return nullptr;
+
+    data = SDL_LoadFile_RW(file_rwops_ttf, &size, own_rwops);
+    return FC_MakeLoadedFontSource(data, size);
+}
+
+FC_FontSource* FC_CreateFontSourceFromMemory(const void* data, size_t size)
+{
+    if(data == nullptr || size == 0)
+        return nullptr;
+
+    return FC_MakeFontSource(data, size);
+}
+
+void FC_FreeFontSource(FC_FontSource* source)
+{
+    FC_ReleaseFontSource(source);
+}
+
+static TTF_Font* FC_OpenTTFFromMemory(const void* data, size_t size, Uint32 pointSize, int style)
+{
+    SDL_RWops* rwops = SDL_RWFromConstMem(data, (int)size);
+    TTF_Font* ttf;
+
+    if(rwops == nullptr)
+        return nullptr;
+
+    ttf = FC_OpenTTF_RW(rwops, 1, pointSize);
+    if(ttf != nullptr)
+        FC_SetTTFStyle(ttf, style);
+    return ttf;
+}
+
+Uint8 FC_LoadFontFromSource(FC_Font* font, SDL_Renderer* renderer, FC_FontSource* source, Uint32 pointSize, SDL_Color color, int style)
+{
+    Uint8 result;
+    TTF_Font* ttf;
+
+    if(font == nullptr || source == nullptr)
+        return 0;
+
+    if(!FC_InitTTF())
+    {
+        SDL_Log("Unable to initialize SDL_ttf: %s \n", TTF_GetError());
+        return 0;
+    }
+
+    ttf = FC_OpenTTFFromMemory(source->data, source->size, pointSize, style);
+    if(ttf == nullptr)
+    {
+        SDL_Log("Unable to load TrueType font: %s \n", TTF_GetError());
+        return 0;
+    }
+
+    // Clearing the font can drop the last other reference when it was loaded from this source before
+    FC_RetainFontSource(source);
+    result = FC_LoadFontFromTTF(font, renderer, ttf, color);
+    if(font->ttf_source != ttf)
+    {
+        FC_CloseTTF(ttf);
+        FC_ReleaseFontSource(source);
+        return 0;
+    }
+
+    // The TTF_Font keeps reading from the source, so new glyphs can always be loaded while the font holds on to it
+    font->owns_ttf_source = 1;
+    font->source = source;
+    return result;
+}
+
+// Async loading
+
+typedef struct FC_LoadWorker
+{
+    struct FC_FontLoad* load;
+    TTF_Font* ttf;  // Each thread gets its own, since a TTF_Font can't be shared between threads
+    SDL_Thread* thread;
+} FC_LoadWorker;
+
+struct FC_FontLoad
+{
+    FC_Font* font;
+    TTF_Font* ttf;  // Becomes the font's ttf_source when the load is finished
+    FC_FontSource* source;  // In-memory font file that every TTF_Font reads from
+
+    // One entry per loading character, from FC_GetLoadingCharacters()
+    int num_glyphs;
+    char (*glyph_chars)[5];
+    SDL_Surface** glyph_surfaces;
+    FC_GlyphMetrics* glyph_metrics;
+    SDL_atomic_t next_glyph;
+
+    int num_workers;
+    FC_LoadWorker* workers;
+
+    // Packed cache levels, waiting to be uploaded on the main thread
+    int num_surfaces;
+    int surfaces_size;
+    SDL_Surface** surfaces;
+
+    SDL_Thread* thread;
+    SDL_atomic_t done;
+};
+
+static int SDLCALL FC_LoadWorkerThread(void* data)
+{
+    FC_LoadWorker* worker = (FC_LoadWorker*)data;
+    FC_FontLoad* load = worker->load;
+    int i;
+
+    // Workers pull glyphs off a shared counter, so a slow or missing worker doesn't leave any unrendered
+    while((i = SDL_AtomicAdd(&load->next_glyph, 1)) < load->num_glyphs)
+    {
+        const char* buff_ptr = load->glyph_chars[i];
+        SDL_Surface* glyph_surf = FC_RenderGlyphSurface(load->font, worker->ttf, load->glyph_chars[i]);
+
+        if(glyph_surf != nullptr)
+            load->glyph_metrics[i] = FC_GetTTFGlyphMetrics(load->font, worker->ttf, FC_GetCodepointFromUTF8(&buff_ptr, 0), glyph_surf->w - 2*load->font->field_padding);
+        load->glyph_surfaces[i] = glyph_surf;
+    }
+
+    return 0;
+}
+
+static SDL_Surface* FC_AddLoadSurface(FC_FontLoad* load, unsigned int w, unsigned int h)
+{
+    SDL_Surface* surface;
+
+    if(load->num_surfaces == load->surfaces_size)
+    {
+        int new_size = (load->surfaces_size > 0? load->surfaces_size*2 : 4);
+        SDL_Surface** new_surfaces = (SDL_Surface**)realloc(load->surfaces, new_size * sizeof(SDL_Surface*));
+        if(new_surfaces == nullptr)
+            return nullptr;
+        load->surfaces = new_surfaces;
+        load->surfaces_size = new_size;
+    }
+
+    surface = FC_CreateSurface32(w, h);
+    if(surface != nullptr)
+        load->surfaces[load->num_surfaces++] = surface;
+    return surface;
+}
+
+static void FC_PackLoadedGlyphs(FC_FontLoad* load)
+{
+    FC_Font* font = load->font;
+    unsigned int w = font->cache_level_size;
+    unsigned int h = font->cache_level_size;
+    SDL_Surface* surface = FC_AddLoadSurface(load, w, h);
+    int i;
+
+    // Pack in loading order so the result matches FC_LoadFontFromTTF()
+    for(i = 0; i < load->num_glyphs && surface != nullptr; ++i)
+    {
+        SDL_Surface* glyph_surf = load->glyph_surfaces[i];
+        const char* buff_ptr = load->glyph_chars[i];
+        Uint32 codepoint;
+
+        if(glyph_surf == nullptr)
+            continue;
+        ++font->stats.glyphs_rendered;
+
+        codepoint = FC_GetCodepointFromUTF8(&buff_ptr, 0);
+        if(FC_PackGlyphData(font, codepoint, load->glyph_metrics[i], glyph_surf->w, glyph_surf->h, w, h) == nullptr)
+        {
+            // Start the next cache level.  Nothing is uploaded yet, so move the packing cursor by hand.
+            surface = FC_AddLoadSurface(load, w, h);
+            font->last_glyph.cache_level = load->num_surfaces-1;
+            if(surface == nullptr || FC_PackGlyphData(font, codepoint, load->glyph_metrics[i], glyph_surf->w, glyph_surf->h, w, h) == nullptr)
+                surface = nullptr;
+        }
+
+        if(surface != nullptr)
+        {
+            SDL_SetSurfaceBlendMode(glyph_surf, SDL_BLENDMODE_NONE);
+            SDL_Rect srcRect = {0, 0, glyph_surf->w, glyph_surf->h};
+            SDL_Rect destrect = font->last_glyph.rect;
+            SDL_BlitSurface(glyph_surf, &srcRect, surface, &destrect);
+        }
+    }
+
+    if(surface == nullptr)
+        SDL_Log("SDL_FontCache error: Could not create enough cache surfaces to fit all of the loading string!\n");
+
+    for(i = 0; i < load->num_glyphs; ++i)
+    {
+        SDL_FreeSurface(load->glyph_surfaces[i]);
+        load->glyph_surfaces[i] = nullptr;
+    }
+}
+
+static int SDLCALL FC_LoadFontThread(void* data)
+{
+    FC_FontLoad* load = (FC_FontLoad*)data;
+    int i;
+
+    // This thread is worker 0
+    for(i = 1; i < load->num_workers; ++i)
+        load->workers[i].thread = SDL_CreateThread(FC_LoadWorkerThread, "FC_LoadWorker", &load->workers[i]);
+
+    FC_LoadWorkerThread(&load->workers[0]);
+
+    for(i = 1; i < load->num_workers; ++i)
+    {
+        if(load->workers[i].thread != nullptr)
+            SDL_WaitThread(load->workers[i].thread, nullptr);
+    }
+
+    FC_PackLoadedGlyphs(load);
+
+    SDL_AtomicSet(&load->done, 1);
+    return 0;
+}
+
+// Undoes a load that couldn't get started, leaving the font cleared as if nothing had been loaded
+static FC_FontLoad* FC_AbortFontLoad(FC_Font* font, FC_FontLoad* load, TTF_Font* ttf, FC_FontSource* source)
+{
+    SDL_Log("SDL_FontCache error: Out of memory for the font load.\n");
+
+    if(load != nullptr)
+    {
+        free(load->workers);
+        free(load->glyph_surfaces);
+        free(load->glyph_metrics);
+        free(load->glyph_chars);
+        free(load);
+    }
+
+    // Hand the font back its TTF_Font and source so clearing it closes the one and releases the other
+    font->ttf_source = ttf;
+    font->owns_ttf_source = 1;
+    font->source = source;
+    FC_ClearFont(font);
+    return nullptr;
+}
+
+FC_FontLoad* FC_LoadFontAsync(FC_Font* font, SDL_Renderer* renderer, const char* filename_ttf, Uint32 pointSize, SDL_Color color, int style, int num_threads)
+{
+    SDL_RWops* rwops;
+
+    if(font == nullptr)
+        return nullptr;
+
+    rwops = SDL_RWFromFile(filename_ttf, "rb");
+
+    if(rwops == nullptr)
+    {
+        SDL_Log("Unable to open file for reading: %s \n", SDL_GetError());
+        return nullptr;
+    }
+
+    return FC_LoadFontAsync_RW(font, renderer, rwops, 1, pointSize, color, style, num_threads);
+}
+
+FC_FontLoad* FC_LoadFontAsync_RW(FC_Font* font, SDL_Renderer* renderer, SDL_RWops* file_rwops_ttf, Uint8 own_rwops, Uint32 pointSize, SDL_Color color, int style, int num_threads)
+{
+    FC_FontLoad* load;
+    FC_FontSource* source;
+
+    if(font == nullptr || renderer == nullptr || file_rwops_ttf == nullptr)
+    {
+        if(own_rwops && file_rwops_ttf != nullptr)
+            SDL_RWclose(file_rwops_ttf);
+        return nullptr;
+    }
+
+    // Every thread needs its own TTF_Font, so keep the whole file in memory where they can all read it
+    source = FC_CreateFontSource_RW(file_rwops_ttf, own_rwops);
+    if(source == nullptr)
+        return nullptr;
+
+    load = FC_LoadFontAsyncFromSource(font, renderer, source, pointSize, color, style, num_threads);
+    FC_FreeFontSource(source);
+    return load;
+}
+
+FC_FontLoad* FC_LoadFontAsyncFromSource(FC_Font* font, SDL_Renderer* renderer, FC_FontSource* source, Uint32 pointSize, SDL_Color color, int style, int num_threads)
+{
+    FC_FontLoad* load;
+    TTF_Font* ttf;
+    int i;
+
+    if(font == nullptr || renderer == nullptr || source == nullptr)
+        return nullptr;
+
+    // The background threads pack into surfaces of the font's own, which an atlas doesn't have
+    if(font->atlas != nullptr)
+    {
+        SDL_Log("SDL_FontCache error: Fonts that use an atlas can't be loaded asynchronously.\n");
+        return nullptr;
+    }
+
+    if(!FC_InitTTF())
+    {
+        SDL_Log("Unable to initialize SDL_ttf: %s \n", TTF_GetError());
+        return nullptr;
+    }
+
+    ttf = FC_OpenTTFFromMemory(source->data, source->size, pointSize, style);
+    if(ttf == nullptr)
+    {
+        SDL_Log("Unable to load TrueType font: %s \n", TTF_GetError());
+        return nullptr;
+    }
+
+    // Taken before clearing the font, which might drop the last other reference
+    FC_RetainFontSource(source);
+    FC_SetupFontMetrics(font, renderer, ttf, color);
+
+    // Keep the packer from rendering missing glyphs itself; the font gets this back in FC_FinishFontLoad()
+    font->ttf_source = nullptr;
+
+    load = (FC_FontLoad*)calloc(1, sizeof(FC_FontLoad));
+    if(load == nullptr)
+        return FC_AbortFontLoad(font, nullptr, ttf, source);
+    load->font = font;
+    load->ttf = ttf;
+    load->source = source;
+
+    // Split the loading characters out up front so the workers can index them
+    load->num_glyphs = FC_GetLoadingCharacters(font, ttf, &load->glyph_chars);
+    if(load->num_glyphs < 0)
+    {
+        SDL_Log("SDL_FontCache error: Out of memory for the loading characters.\n");
+        load->num_glyphs = 0;
+    }
+    load->glyph_surfaces = (SDL_Surface**)calloc(load->num_glyphs + 1, sizeof(SDL_Surface*));
+    load->glyph_metrics = (FC_GlyphMetrics*)calloc(load->num_glyphs + 1, sizeof(FC_GlyphMetrics));
+    if(load->glyph_surfaces == nullptr || load->glyph_metrics == nullptr)
+        return FC_AbortFontLoad(font, load, ttf, source);
+
+    if(num_threads <= 0)
+        num_threads = SDL_GetCPUCount();
+    if(num_threads > load->num_glyphs)
+        num_threads = load->num_glyphs;
+    if(num_threads < 1)
+        num_threads = 1;
+
+    // TTF_Fonts are opened here since FreeType's library handle isn't safe to use from several threads at once.
+    // Worker 0 borrows the font's own TTF_Font, which nobody else touches until the load is finished.
+    load->workers = (FC_LoadWorker*)calloc(num_threads, sizeof(FC_LoadWorker));
+    if(load->workers == nullptr)
+        return FC_AbortFontLoad(font, load, ttf, source);
+    load->workers[0].load = load;
+    load->workers[0].ttf = ttf;
+    for(load->num_workers = 1; load->num_workers < num_threads; ++load->num_workers)
+    {
+        FC_LoadWorker* worker = &load->workers[load->num_workers];
+        worker->load = load;
+        worker->ttf = FC_OpenTTFFromMemory(source->data, source->size, pointSize, style);
+        if(worker->ttf == nullptr)
+            break;
+    }
+
+    load->thread = SDL_CreateThread(FC_LoadFontThread, "FC_LoadFont", load);
+    if(load->thread == nullptr)
+    {
+        // No threads available, so do all of the work now
+        for(i = 1; i < load->num_workers; ++i)
+        {
+            FC_CloseTTF(load->workers[i].ttf);
+            load->workers[i].ttf = nullptr;
+        }
+        load->num_workers = 1;
+        FC_LoadFontThread(load);
+    }
+
+    return load;
+}
+
+Uint8 FC_PollFontLoad(FC_FontLoad* load)
+{
+    if(load == nullptr)
+        return 1;
+
+    return (SDL_AtomicGet(&load->done) != 0);
+}
+
+Uint8 FC_FinishFontLoad(FC_FontLoad* load)
+{
+    FC_Font* font;
+    Uint8 result = 1;
+    int i;
+
+    if(load == nullptr)
+        return 0;
+
+    font = load->font;
+    font->thread = SDL_ThreadID();
+
+    if(load->thread != nullptr)
+        SDL_WaitThread(load->thread, nullptr);
+
+    for(i = 1; i < load->num_workers; ++i)
+        FC_CloseTTF(load->workers[i].ttf);
+
+    font->ttf_source = load->ttf;
+    font->owns_ttf_source = 1;  // The font holds on to the file, so new glyphs can always be loaded
+    font->source = load->source;
+
+    for(i = 0; i < load->num_surfaces; ++i)
+    {
+        if(FC_UploadGlyphCache(font, i, load->surfaces[i]))
+            SDL_SetTextureBlendMode(font->glyph_cache[i], SDL_BLENDMODE_BLEND);
+        else
+            result = 0;
+        SDL_FreeSurface(load->surfaces[i]);
+    }
+
+    free(load->surfaces);
+    free(load->workers);
+    free(load->glyph_surfaces);
+    free(load->glyph_metrics);
+    free(load->glyph_chars);
+    free(load);
+
+    return result;
+}
+
+// Prebaked caches
+
+// File layout, all little endian:
+//   magic, version, TTF signature, height, ascent, descent, distance field spread, cache level size, number of levels, number of glyphs (Uint32 each)
+//   per glyph: codepoint (Uint32), cache level, x, y, w, h (Uint16), minx, maxx, miny, maxy, advance (Sint16)
+//   per level: width, height, number of skyline nodes, used area (Uint32), nodes as x, y, w (Uint16), then width*height bytes of coverage
+// Glyphs are always white, so only their alpha is stored.  A level with no skyline nodes wasn't packed by the font.
+// Version 2 added the distance field spread, and version 3 keeps that many pixels around distance field glyphs.
+#define FC_CACHE_FILE_MAGIC 0x48434346  // "FCCH"
+#define FC_CACHE_FILE_VERSION 3
+#define FC_CACHE_FILE_GLYPH_SIZE 24
+
+typedef struct FC_CacheReader
+{
+    const Uint8* pos;
+    const Uint8* end;
+    Uint8 ok;  // Cleared when a read runs past the end
+
+} FC_CacheReader;
+
+static const Uint8* FC_ReadCacheBytes(FC_CacheReader* reader, Uint32 size)
+{
+    const Uint8* result = reader->pos;
+    if(!reader->ok || (size_t)(reader->end - reader->pos) < size)
+    {
+        reader->ok = 0;
+        return nullptr;
+    }
+    reader->pos += size;
+    return result;
+}
+
+static Uint16 FC_ReadCache16(FC_CacheReader* reader)
+{
+    const Uint8* p = FC_ReadCacheBytes(reader, 2);
+    return (p != nullptr? (Uint16)(p[0] | p[1] << 8) : 0);
+}
+
+static Uint32 FC_ReadCache32(FC_CacheReader* reader)
+{
+    const Uint8* p = FC_ReadCacheBytes(reader, 4);
+    return (p != nullptr? (Uint32)p[0] | (Uint32)p[1] << 8 | (Uint32)p[2] << 16 | (Uint32)p[3] << 24 : 0);
+}
+
+// Copies a cache level's coverage into 'result', which must hold w*h bytes
+static Uint8 FC_ReadGlyphCacheLevel(FC_Font* font, SDL_Texture* level, int w, int h, Uint8* result)
+{
+    SDL_Renderer* renderer = font->renderer;
+    Uint32* pixels = (Uint32*)malloc((size_t)w * h * sizeof(Uint32));
+    Uint8 ok;
+    int i;
+    SDL_Texture* prev_target;
+    SDL_Rect prev_clip, prev_viewport;
+    int prev_logicalw, prev_logicalh;
+    Uint8 prev_clip_enabled;
+    float prev_scalex, prev_scaley;
+
+    if(pixels == nullptr)
+        return 0;
+
+    prev_target = SDL_GetRenderTarget(renderer);
+    // only backup if previous target existed (SDL will preserve them for the default target)
+    if (prev_target) {
+        prev_clip_enabled = has_clip(renderer);
+        if (prev_clip_enabled)
+            prev_clip = get_clip(renderer);
+        SDL_RenderGetViewport(renderer, &prev_viewport);
+        SDL_RenderGetScale(renderer, &prev_scalex, &prev_scaley);
+        SDL_RenderGetLogicalSize(renderer, &prev_logicalw, &prev_logicalh);
+    }
+    SDL_SetRenderTarget(renderer, level);
+    ok = (SDL_RenderReadPixels(renderer, nullptr, SDL_PIXELFORMAT_ARGB8888, pixels, w * sizeof(Uint32)) == 0);
+    SDL_SetRenderTarget(renderer, prev_target);
+    font->stats.target_switches += 2;
+    if (prev_target) {
+        if (prev_clip_enabled)
+            set_clip(renderer, &prev_clip);
+        if (prev_logicalw && prev_logicalh)
+            SDL_RenderSetLogicalSize(renderer, prev_logicalw, prev_logicalh);
+        else {
+            SDL_RenderSetViewport(renderer, &prev_viewport);
+            SDL_RenderSetScale(renderer, prev_scalex, prev_scaley);
+        }
+    }
+
+    if(ok)
+    {
+        for(i = 0; i < w*h; ++i)
+            result[i] = (Uint8)(pixels[i] >> 24);
+    }
+    else
+        SDL_Log("SDL_FontCache error: Could not read back cache level: %s\n", SDL_GetError());
+
+    free(pixels);
+    return ok;
+}
+
+Uint8 FC_SaveFontCache(FC_Font* font, SDL_RWops* dst, Uint8 own_rwops)
+{
+    Uint8 ok;
+    Uint32* keys;
+    Uint8* coverage;
+    unsigned int num_glyphs, i;
+    int level;
+
+    if(dst == nullptr)
+        return 0;
+
+    if(font == nullptr || font->renderer == nullptr || font->atlas != nullptr || font->glyph_cache_count == 0 || !fc_has_render_target_support)
+    {
+        if(font != nullptr && font->atlas != nullptr)
+            SDL_Log("SDL_FontCache error: Fonts that use an atlas share their cache levels, so they can't be saved on their own.\n");
+        else if(font != nullptr && !fc_has_render_target_support)
+            SDL_Log("SDL_FontCache error: Saving a font cache needs render target support.\n");
+        if(own_rwops)
+            SDL_RWclose(dst);
+        return 0;
+    }
+
+    // Staged glyphs aren't on the textures yet
+    FC_FlushGlyphUploads(font);
+
+    num_glyphs = FC_MapCount(font->glyphs);
+    keys = (Uint32*)malloc((num_glyphs > 0? num_glyphs : 1) * sizeof(Uint32));
+    ok = (keys != nullptr);
+    if(ok)
+        FC_MapGetKeys(font->glyphs, keys);
+
+    ok &= (SDL_WriteLE32(dst, FC_CACHE_FILE_MAGIC) == 1);
+    ok &= (SDL_WriteLE32(dst, FC_CACHE_FILE_VERSION) == 1);
+    ok &= (SDL_WriteLE32(dst, font->ttf_signature) == 1);
+    ok &= (SDL_WriteLE32(dst, font->height) == 1);
+    ok &= (SDL_WriteLE32(dst, font->ascent) == 1);
+    ok &= (SDL_WriteLE32(dst, font->descent) == 1);
+    ok &= (SDL_WriteLE32(dst, font->field_padding) == 1);
+    ok &= (SDL_WriteLE32(dst, font->cache_level_size) == 1);
+    ok &= (SDL_WriteLE32(dst, font->glyph_cache_count) == 1);
+    ok &= (SDL_WriteLE32(dst, num_glyphs) == 1);
+
+    for(i = 0; ok && i < num_glyphs; ++i)
+    {
+        FC_GlyphData* glyph = FC_MapFind(font->glyphs, keys[i]);
+        ok &= (SDL_WriteLE32(dst, keys[i]) == 1);
+        ok &= (SDL_WriteLE16(dst, glyph->cache_level) == 1);
+        ok &= (SDL_WriteLE16(dst, glyph->rect.x) == 1);
+        ok &= (SDL_WriteLE16(dst, glyph->rect.y) == 1);
+        ok &= (SDL_WriteLE16(dst, glyph->rect.w) == 1);
+        ok &= (SDL_WriteLE16(dst, glyph->rect.h) == 1);
+        ok &= (SDL_WriteLE16(dst, glyph->metrics.minx) == 1);
+        ok &= (SDL_WriteLE16(dst, glyph->metrics.maxx) == 1);
+        ok &= (SDL_WriteLE16(dst, glyph->metrics.miny) == 1);
+        ok &= (SDL_WriteLE16(dst, glyph->metrics.maxy) == 1);
+        ok &= (SDL_WriteLE16(dst, glyph->metrics.advance) == 1);
+    }
+
+    for(level = 0; ok && level < font->glyph_cache_count; ++level)
+    {
+        FC_Skyline* skyline = (level < font->num_packers && font->packers[level].nodes != nullptr? &font->packers[level] : nullptr);
+        int w = 0, h = 0, n;
+
+        if(SDL_QueryTexture(font->glyph_cache[level], nullptr, nullptr, &w, &h) < 0)
+        {
+            ok = 0;
+            break;
+        }
+        ok &= (SDL_WriteLE32(dst, w) == 1);
+        ok &= (SDL_WriteLE32(dst, h) == 1);
+        ok &= (SDL_WriteLE32(dst, skyline != nullptr? skyline->num_nodes : 0) == 1);
+        ok &= (SDL_WriteLE32(dst, skyline != nullptr? skyline->used_area : 0) == 1);
+        for(n = 0; skyline != nullptr && n < skyline->num_nodes; ++n)
+        {
+            ok &= (SDL_WriteLE16(dst, skyline->nodes[n].x) == 1);
+            ok &= (SDL_WriteLE16(dst, skyline->nodes[n].y) == 1);
+            ok &= (SDL_WriteLE16(dst, skyline->nodes[n].w) == 1);
+        }
+
+        coverage = (Uint8*)malloc((size_t)w * h);
+        ok &= (coverage != nullptr && FC_ReadGlyphCacheLevel(font, font->glyph_cache[level], w, h, coverage));
+        ok &= (ok && SDL_RWwrite(dst, coverage, (size_t)w * h, 1) == 1);
+        free(coverage);
+    }
+
+    if(!ok)
+        SDL_Log("SDL_FontCache error: Could not write the font cache.\n");
+
+    free(keys);
+    if(own_rwops)
+        SDL_RWclose(dst);
+    return ok;
+}
+
+// Walks the cache levels of a file, checking that their data is all there
+static Uint8 FC_CheckCacheLevels(FC_CacheReader* reader, Uint32 num_levels, int max_size)
+{
+    Uint32 i;
+    for(i = 0; reader->ok && i < num_levels; ++i)
+    {
+        Uint32 w = FC_ReadCache32(reader);
+        Uint32 h = FC_ReadCache32(reader);
+        Uint32 num_nodes = FC_ReadCache32(reader);
+        FC_ReadCache32(reader);
+        if(w == 0 || h == 0 || w > 0xFFFF || h > 0xFFFF || (max_size > 0 && ((int)w > max_size || (int)h > max_size)) || num_nodes > w)
+            return 0;
+        FC_ReadCacheBytes(reader, num_nodes * 6);
+        FC_ReadCacheBytes(reader, w * h);
+    }
+    return reader->ok;
+}
+
+Uint8 FC_LoadFontCache(FC_Font* font, SDL_Renderer* renderer, TTF_Font* ttf, SDL_Color color, SDL_RWops* src, Uint8 own_rwops)
+{
+    FC_CacheReader reader;
+    SDL_RendererInfo info;
+    void* data;
+    size_t size = 0;
+    const Uint8* glyphs;
+    const Uint8* levels;
+    Uint32 level_size, num_levels, num_glyphs, i;
+    Uint32 white[256];
+    int height, ascent, descent;
+    Uint8 result = 1;
+
+    if(src == nullptr)
+        return 0;
+
+    if(font == nullptr || renderer == nullptr || ttf == nullptr || font->atlas != nullptr)
+    {
+        if(font != nullptr && font->atlas != nullptr)
+            SDL_Log("SDL_FontCache error: Fonts that use an atlas can't be loaded from a saved cache.\n");
+        if(own_rwops)
+            SDL_RWclose(src);
+        return 0;
+    }
+
+    data = SDL_LoadFile_RW(src, &size, own_rwops);
+    if(data == nullptr)
+    {
+        SDL_Log("SDL_FontCache error: Could not read the font cache: %s\n", SDL_GetError());
+        return 0;
+    }
+
+    // The metrics as FC_SetupFontMetrics() will see them
+    height = TTF_FontHeight(ttf);
+    ascent = TTF_FontAscent(ttf);
+    descent = -TTF_FontDescent(ttf);
+    if(height < ascent - descent)
+        height = ascent - descent;
+
+    // Check everything before touching the font, so a stale or damaged file can fall back to a normal load
+    reader.pos = (const Uint8*)data;
+    reader.end = reader.pos + size;
+    reader.ok = 1;
+    if(FC_ReadCache32(&reader) != FC_CACHE_FILE_MAGIC || FC_ReadCache32(&reader) != FC_CACHE_FILE_VERSION
+       || FC_ReadCache32(&reader) != FC_GetTTFSignature(ttf) || (int)FC_ReadCache32(&reader) != height
+       || (int)FC_ReadCache32(&reader) != ascent || (int)FC_ReadCache32(&reader) != descent
+       || (int)FC_ReadCache32(&reader) != font->distance_field)
+    {
+        SDL_free(data);
+        return 0;
+    }
+    level_size = FC_ReadCache32(&reader);
+    num_levels = FC_ReadCache32(&reader);
+    num_glyphs = FC_ReadCache32(&reader);
+    glyphs = reader.pos;
+
+    SDL_GetRendererInfo(renderer, &info);
+    if(level_size == 0 || num_levels == 0 || num_levels > 0xFFFF || num_glyphs > (size_t)(reader.end - reader.pos) / FC_CACHE_FILE_GLYPH_SIZE)
+        reader.ok = 0;
+    FC_ReadCacheBytes(&reader, num_glyphs * FC_CACHE_FILE_GLYPH_SIZE);
+    levels = reader.pos;
+    if(!FC_CheckCacheLevels(&reader, num_levels, SDL_min(info.max_texture_width, info.max_texture_height)))
+    {
+        SDL_Log("SDL_FontCache error: The font cache is damaged or too large for this renderer.\n");
+        SDL_free(data);
+        return 0;
+    }
+
+    FC_SetupFontMetrics(font, renderer, ttf, color);
+    font->cache_level_size = level_size;
+
+    reader.pos = glyphs;
+    for(i = 0; i < num_glyphs; ++i)
+    {
+        Uint32 codepoint = FC_ReadCache32(&reader);
+        FC_GlyphData glyph;
+        glyph.cache_level = FC_ReadCache16(&reader);
+        glyph.rect.x = FC_ReadCache16(&reader);
+        glyph.rect.y = FC_ReadCache16(&reader);
+        glyph.rect.w = FC_ReadCache16(&reader);
+        glyph.rect.h = FC_ReadCache16(&reader);
+        glyph.metrics.minx = (Sint16)FC_ReadCache16(&reader);
+        glyph.metrics.maxx = (Sint16)FC_ReadCache16(&reader);
+        glyph.metrics.miny = (Sint16)FC_ReadCache16(&reader);
+        glyph.metrics.maxy = (Sint16)FC_ReadCache16(&reader);
+        glyph.metrics.advance = (Sint16)FC_ReadCache16(&reader);
+        if(glyph.cache_level < (int)num_levels)
+            FC_MapInsert(font->glyphs, codepoint, glyph);
+    }
+
+    // Expand the coverage back to white glyphs
+    {
+        SDL_Surface* surface = FC_CreateSurface32(1, 1);
+        if(surface == nullptr)
+        {
+            SDL_free(data);
+            return 0;
+        }
+        for(i = 0; i < 256; ++i)
+            white[i] = SDL_MapRGBA(surface->format, 255, 255, 255, (Uint8)i);
+        SDL_FreeSurface(surface);
+    }
+
+    reader.pos = levels;
+    for(i = 0; i < num_levels; ++i)
+    {
+        Uint32 w = FC_ReadCache32(&reader);
+        Uint32 h = FC_ReadCache32(&reader);
+        Uint32 num_nodes = FC_ReadCache32(&reader);
+        Uint32 used_area = FC_ReadCache32(&reader);
+        SDL_Surface* surface;
+        Uint32 n, x, y;
+
+        if(num_nodes > 0)
+        {
+            FC_Skyline* skyline = FC_GetPacker(font, i, w, h);
+            FC_SkylineNode* nodes = (skyline != nullptr? (FC_SkylineNode*)realloc(skyline->nodes, num_nodes * sizeof(FC_SkylineNode)) : nullptr);
+            if(nodes == nullptr)
+            {
+                result = 0;
+                break;
+            }
+            skyline->nodes = nodes;
+            skyline->nodes_size = skyline->num_nodes = num_nodes;
+            skyline->used_area = used_area;
+            for(n = 0; n < num_nodes; ++n)
+            {
+                nodes[n].x = FC_ReadCache16(&reader);
+                nodes[n].y = FC_ReadCache16(&reader);
+                nodes[n].w = FC_ReadCache16(&reader);
+            }
+        }
+
+        surface = FC_CreateSurface32(w, h);
+        if(surface == nullptr)
+        {
+            result = 0;
+            break;
+        }
+        for(y = 0; y < h; ++y)
+        {
+            const Uint8* coverage = FC_ReadCacheBytes(&reader, w);
+            Uint32* row = (Uint32*)((Uint8*)surface->pixels + y*surface->pitch);
+            for(x = 0; x < w; ++x)
+                row[x] = white[coverage[x]];
+        }
+
+        if(FC_UploadGlyphCache(font, i, surface))
+            SDL_SetTextureBlendMode(font->glyph_cache[i], SDL_BLENDMODE_BLEND);
+        else
+            result = 0;
+        SDL_FreeSurface(surface);
+    }
+
+    // Keep packing where the saved font left off, or on a new level if the last one wasn't packed by it
+    i = num_levels - 1;
+    font->last_glyph.cache_level = ((int)i < font->num_packers && font->packers[i].nodes != nullptr? i : num_levels);
+
+    SDL_free(data);
+    return result;
+}
+
+
+// Renderer resets
+
+// Reads a cache level back from its texture into a new shadow
+static SDL_Surface* FC_ReadShadowLevel(FC_Font* owner, int cache_level)
+{
+    SDL_Surface* shadow;
+    Uint8* coverage;
+    Uint32 white[256];
+    int w, h, x, y, i;
+
+    if(SDL_QueryTexture(owner->glyph_cache[cache_level], nullptr, nullptr, &w, &h) < 0)
+        return nullptr;
+
+    shadow = FC_CreateEmptyShadow(w, h);
+    coverage = (Uint8*)malloc((size_t)w * h);
+    if(shadow == nullptr || coverage == nullptr || !FC_ReadGlyphCacheLevel(owner, owner->glyph_cache[cache_level], w, h, coverage))
+    {
+        SDL_FreeSurface(shadow);
+        free(coverage);
+        return nullptr;
+    }
+
+    // The level only holds white glyphs, so their coverage is all there is to keep
+    for(i = 0; i < 256; ++i)
+        white[i] = SDL_MapRGBA(shadow->format, 255, 255, 255, (Uint8)i);
+    for(y = 0; y < h; ++y)
+    {
+        Uint32* row = (Uint32*)((Uint8*)shadow->pixels + y*shadow->pitch);
+        for(x = 0; x < w; ++x)
+            row[x] = white[coverage[y*w + x]];
+    }
+
+    free(coverage);
+    return shadow;
+}
+
+void FC_SetCacheShadowing(FC_Font* font, Uint8 enable)
+{
+    FC_Font* owner;
+    int i;
+
+    if(font == nullptr)
+        return;
+
+    owner = FC_GetCacheOwner(font);
+    owner->shadow_cache = (enable != 0);
+    if(!owner->shadow_cache)
+    {
+        FC_FreeShadows(owner);
+        return;
+    }
+
+    if(owner->renderer == nullptr || owner->glyph_cache_count == 0)
+        return;
+
+    // Levels that already have glyphs need a copy of them.  Staged glyphs have to be on the textures first.
+    FC_FlushGlyphUploads(owner);
+    for(i = 0; i < owner->glyph_cache_count; ++i)
+    {
+        if(FC_GetShadowLevel(owner, i) != nullptr || i >= owner->num_packers || owner->packers[i].nodes == nullptr)
+            continue;
+
+        if(!fc_has_render_target_support)
+        {
+            SDL_Log("SDL_FontCache error: Copying existing cache levels needs render target support.  Enable shadowing before loading the font.\n");
+            return;
+        }
+        FC_SetShadowLevel(owner, i, FC_ReadShadowLevel(owner, i));
+    }
+}
+
+Uint8 FC_GetCacheShadowing(FC_Font* font)
+{
+    if(font == nullptr)
+        return 0;
+
+    return FC_GetCacheOwner(font)->shadow_cache;
+}
+
+void FC_ResetFontFromRendererReset(FC_Font* font, SDL_Renderer* renderer, Uint32 evType)
+{
+    FC_Font* owner;
+    FC_Font** fonts = &font;
+    int num_fonts = 1;
+    SDL_RendererInfo info;
+    int i, j;
+
+    if(font == nullptr || renderer == nullptr || font->renderer == nullptr)
+        return;
+
+    owner = FC_GetCacheOwner(font);
+    if(font->atlas != nullptr)
+    {
+        fonts = font->atlas->fonts;
+        num_fonts = font->atlas->num_fonts;
+    }
+
+    if(SDL_GetRendererInfo(renderer, &info) == 0)
+        fc_has_render_target_support = (info.flags & SDL_RENDERER_TARGETTEXTURE);
+
+    owner->renderer = renderer;
+    for(j = 0; j < num_fonts; ++j)
+        fonts[j]->renderer = renderer;
+
+    // Staged glyphs are already in the shadows, and the rest are dropped with their level below
+    FC_FreeGlyphUploads(&owner->uploads);
+
+    for(i = 0; i < owner->glyph_cache_count; ++i)
+    {
+        SDL_Surface* shadow = FC_GetShadowLevel(owner, i);
+        FC_Skyline* skyline = (i < owner->num_packers && owner->packers[i].nodes != nullptr? &owner->packers[i] : nullptr);
+        SDL_Texture* level;
+
+        // Levels set with FC_SetGlyphCacheLevel() have to be put back by whoever set them
+        if(shadow == nullptr && skyline == nullptr)
+            continue;
+
+        // After a device reset the old textures went with the old device
+        if(evType == SDL_RENDER_TARGETS_RESET)
+            SDL_DestroyTexture(owner->glyph_cache[i]);
+
+        if(shadow != nullptr)
+            level = FC_CreateCacheTexture(owner, shadow);
+        else
+        {
+            Uint32 format = owner->cache_pixel_format;
+            if(format == SDL_PIXELFORMAT_UNKNOWN)
+                format = SDL_PIXELFORMAT_RGBA8888;
+            level = SDL_CreateTexture(renderer, format, SDL_TEXTUREACCESS_TARGET, skyline->width, skyline->height);
+            FC_SetLevelFilter(owner, level);
+            if(level != nullptr)
+                FC_ClearGlyphCacheLevel(owner, level);
+
+            // Nothing to put back, so the level starts over and its glyphs are rendered again when they're next drawn
+            for(j = 0; j < num_fonts; ++j)
+                FC_MapRemoveCacheLevel(fonts[j]->glyphs, i);
+            skyline->num_nodes = 1;
+            skyline->nodes[0].x = 0;
+            skyline->nodes[0].y = 0;
+            skyline->nodes[0].w = skyline->width;
+            skyline->used_area = 0;
+        }
+
+        owner->glyph_cache[i] = level;
+        if(level == nullptr)
+        {
+            SDL_Log("SDL_FontCache error: Could not re-create cache level %d after a renderer reset: %s\n", i, SDL_GetError());
+            continue;
+        }
+        set_color(level, owner->default_color.r, owner->default_color.g, owner->default_color.b, FC_GET_ALPHA(owner->default_color));
+        SDL_SetTextureBlendMode(level, SDL_BLENDMODE_BLEND);
+    }
+
+    // Layouts are holding quads that point at the old textures
+    ++owner->generation;
+}
+
+
+// Shared atlases
+
+static void FC_RemoveAtlasFont(FC_Atlas* atlas, FC_Font* font)
+{
+    int i;
+    for(i = 0; i < atlas->num_fonts; ++i)
+    {
+        if(atlas->fonts[i] == font)
+        {
+            atlas->fonts[i] = atlas->fonts[--atlas->num_fonts];
+            return;
+        }
+    }
+}
+
+FC_Atlas* FC_CreateAtlas(SDL_Renderer* renderer, int level_size, int max_levels)
+{
+    FC_Atlas* atlas;
+    FC_Font* cache;
+    SDL_RendererInfo info;
+
+    if(renderer == nullptr)
+        return nullptr;
+
+    SDL_GetRendererInfo(renderer, &info);
+    fc_has_render_target_support = (info.flags & SDL_RENDERER_TARGETTEXTURE);
+    if(!fc_has_render_target_support)
+    {
+        SDL_Log("SDL_FontCache error: An atlas needs render target support.\n");
+        return nullptr;
+    }
+
+    atlas = (FC_Atlas*)malloc(sizeof(FC_Atlas));
+    if(atlas == nullptr)
+        return nullptr;
+    memset(atlas, 0, sizeof(FC_Atlas));
+
+    // Glyphs are rendered white and colored when drawn, whichever font they belong to
+    cache = FC_CreateFont();
+    cache->renderer = renderer;
+    cache->default_color.r = 255;
+    cache->default_color.g = 255;
+    cache->default_color.b = 255;
+    FC_GET_ALPHA(cache->default_color) = 255;
+
+    cache->cache_level_size = (level_size > 0? level_size : 1024);
+    if(info.max_texture_width > 0 && cache->cache_level_size > info.max_texture_width)
+        cache->cache_level_size = info.max_texture_width;
+    if(info.max_texture_height > 0 && cache->cache_level_size > info.max_texture_height)
+        cache->cache_level_size = info.max_texture_height;
+    cache->cache_level_limit = (max_levels > 0? max_levels : 0);
+
+    if(!FC_GrowGlyphCache(cache))
+    {
+        FC_FreeFont(cache);
+        free(atlas);
+        return nullptr;
+    }
+
+    atlas->cache = cache;
+    return atlas;
+}
+
+void FC_FreeAtlas(FC_Atlas* atlas)
+{
+    int i;
+    if(atlas == nullptr)
+        return;
+
+    FC_FreeFont(atlas->cache);
+
+    // The fonts' glyphs were all on the atlas, so they start over with cache levels of their own
+    for(i = 0; i < atlas->num_fonts; ++i)
+    {
+        FC_Font* font = atlas->fonts[i];
+        font->atlas = nullptr;
+        FC_MapFree(font->glyphs);
+        font->glyphs = FC_MapCreate();
+        ++font->generation;
+
+        if(font->ttf_source != nullptr)
+            FC_GrowGlyphCache(font);
+    }
+
+    free(atlas->fonts);
+    free(atlas);
+}
+
+Uint8 FC_SetFontAtlas(FC_Font* font, FC_Atlas* atlas)
+{
+    if(font == nullptr)
+        return 0;
+
+    if(font->atlas == atlas)
+        return 1;
+
+    // Glyphs that are already cached would be on the wrong textures
+    if(font->ttf_source != nullptr || font->glyph_cache_count > 0 || FC_MapCount(font->glyphs) > 0)
+    {
+        SDL_Log("SDL_FontCache error: A font's atlas has to be set before the font is loaded.\n");
+        return 0;
+    }
+
+    if(atlas != nullptr && atlas->num_fonts == atlas->fonts_size)
+    {
+        int new_size = (atlas->fonts_size > 0? atlas->fonts_size*2 : 8);
+        FC_Font** new_fonts = (FC_Font**)realloc(atlas->fonts, new_size * sizeof(FC_Font*));
+        if(new_fonts == nullptr)
+            return 0;
+        atlas->fonts = new_fonts;
+        atlas->fonts_size = new_size;
+    }
+
+    if(font->atlas != nullptr)
+        FC_RemoveAtlasFont(font->atlas, font);
+    if(atlas != nullptr)
+        atlas->fonts[atlas->num_fonts++] = font;
+
+    font->atlas = atlas;
+    ++font->generation;
+    return 1;
+}
+
+FC_Atlas* FC_GetFontAtlas(FC_Font* font)
+{
+    if(font == nullptr)
+        return nullptr;
+
+    return font->atlas;
+}
+
+void FC_SetFallbackFont(FC_Font* font, FC_Font* fallback)
+{
+    if(font == nullptr || fallback == font)
+        return;
+
+    font->fallback = fallback;
+}
+
+FC_Font* FC_GetFallbackFont(FC_Font* font)
+{
+    if(font == nullptr)
+        return nullptr;
+
+    return font->fallback;
+}
+
+
+void FC_ClearFont(FC_Font* font)
+{
+    int i;
+    if(font == nullptr)
+        return;
+
+    // Release resources
+    if(font->owns_ttf_source)
+        FC_CloseTTF(font->ttf_source);
+
+    font->owns_ttf_source = 0;
+    font->ttf_source = nullptr;
+
+    FC_ReleaseFontSource(font->source);
+    font->source = nullptr;
+
+    // Delete glyph map
+    FC_MapFree(font->glyphs);
+    font->glyphs = nullptr;
+
+    // Delete glyph cache
+    for(i = 0; i < font->glyph_cache_count; ++i)
+    {
+        SDL_DestroyTexture(font->glyph_cache[i]);
+    }
+    free(font->glyph_cache);
+    font->glyph_cache = nullptr;
+
+    FC_FreeBatch(&font->batch);
+    FC_FreeGlyphUploads(&font->uploads);
+    FC_FreeShadows(font);
+    FC_FreePackers(font);
+    FC_FreeKerning(&font->kerning);
+    FC_FreeRunCache(&font->run_cache);
+
+    // Reset font
+    FC_Init(font);
+    ++font->generation;
+}
+
+
+void FC_FreeFont(FC_Font* font)
+{
+    int i;
+    if(font == nullptr)
+        return;
+
+    // Release resources
+    if(font->owns_ttf_source)
+        FC_CloseTTF(font->ttf_source);
+
+    FC_ReleaseFontSource(font->source);
+
+    // Delete glyph map
+    FC_MapFree(font->glyphs);
+
+    // Delete glyph cache
+    for(i = 0; i < font->glyph_cache_count; ++i)
+    {
+        SDL_DestroyTexture(font->glyph_cache[i]);
+    }
+    free(font->glyph_cache);
+
+    FC_FreeBatch(&font->batch);
+    FC_FreeGlyphUploads(&font->uploads);
+    FC_FreeShadows(font);
+    FC_FreePackers(font);
+    FC_FreeKerning(&font->kerning);
+    FC_FreeRunCache(&font->run_cache);
+
+    // Its glyphs stay on the atlas until their level is evicted
+    if(font->atlas != nullptr)
+        FC_RemoveAtlasFont(font->atlas, font);
+
+    free(font->loading_string);
+    free(font->loading_ranges);
+    free(font->warm_queue.ranges);
+
+    free(font);
+
+    // If the last font has been freed; assume shutdown and free the global variables
+    SDL_AtomicLock(&fc_strings_lock);
+    if (--NUM_EXISTING_FONTS <= 0)
+    {
+        free(ASCII_STRING);
+        ASCII_STRING = nullptr;
+
+        free(LATIN_1_STRING);
+        LATIN_1_STRING = nullptr;
+
+        free(ASCII_LATIN_1_STRING);
+        ASCII_LATIN_1_STRING = nullptr;
+    }
+    SDL_AtomicUnlock(&fc_strings_lock);
+}
+
+int FC_GetNumCacheLevels(FC_Font* font)
+{
+    return FC_GetCacheOwner(font)->glyph_cache_count;
+}
+
+Uint8 FC_AddGlyphToCache(FC_Font* font, SDL_Surface* glyph_surface)
+{
+    FC_Stats* stats;
+    FC_GlyphUploads* uploads;
+    FC_GlyphUploadLevel* level;
+    int cache_level;
+    SDL_Rect destrect;
+
+    if(font == nullptr || glyph_surface == nullptr)
+        return 0;
+
+    stats = &font->stats;
+    font = FC_GetCacheOwner(font);
+    cache_level = font->last_glyph.cache_level;
+    SDL_Texture* dest = FC_GetGlyphCacheLevel(font, cache_level);
+    if(dest == nullptr)
+        return 0;
+
+    uploads = &font->uploads;
+    if(cache_level >= uploads->num_levels)
+    {
+        FC_GlyphUploadLevel* new_levels = (FC_GlyphUploadLevel*)realloc(uploads->levels, (cache_level + 1) * sizeof(FC_GlyphUploadLevel));
+        if(new_levels == nullptr)
+            return 0;
+        memset(&new_levels[uploads->num_levels], 0, (cache_level + 1 - uploads->num_levels) * sizeof(FC_GlyphUploadLevel));
+        uploads->levels = new_levels;
+        uploads->num_levels = cache_level + 1;
+    }
+    level = &uploads->levels[cache_level];
+
+    if(level->staging == nullptr)
+    {
+        int w, h;
+        SDL_QueryTexture(dest, nullptr, nullptr, &w, &h);
+        level->staging = FC_CreateSurface32(w, h);
+        if(level->staging == nullptr)
+            return 0;
+        SDL_SetSurfaceBlendMode(level->staging, SDL_BLENDMODE_NONE);
+    }
+
+    if(level->num_rects == level->rects_size)
+    {
+        int new_size = (level->rects_size > 0? level->rects_size*2 : 16);
+        SDL_Rect* new_rects = (SDL_Rect*)realloc(level->rects, new_size * sizeof(SDL_Rect));
+        if(new_rects == nullptr)
+            return 0;
+        level->rects = new_rects;
+        level->rects_size = new_size;
+    }
+
+    // Stage the glyph on the CPU.  FC_FlushGlyphUploads() copies all of them to the cache texture at once.
+    SDL_SetSurfaceBlendMode(glyph_surface, SDL_BLENDMODE_NONE);
+    destrect = font->last_glyph.rect;
+    SDL_BlitSurface(glyph_surface, nullptr, level->staging, &destrect);
+    if(FC_GetShadowLevel(font, cache_level) != nullptr)
+    {
+        destrect = font->last_glyph.rect;
+        SDL_BlitSurface(glyph_surface, nullptr, font->shadows[cache_level], &destrect);
+    }
+
+    destrect = font->last_glyph.rect;
+    level->bounds = (level->num_rects == 0? destrect : SDL_RectUnion(level->bounds, destrect));
+    level->rects[level->num_rects++] = destrect;
+    ++uploads->num_pending;
+    ++stats->glyph_uploads;
+
+    return 1;
+}
+
+static void FC_FlushGlyphUploadLevel(FC_Font* font, int cache_level)
+{
+    FC_GlyphUploadLevel* level = &font->uploads.levels[cache_level];
+    SDL_Texture* dest = FC_GetGlyphCacheLevel(font, cache_level);
+    SDL_Rect bounds = level->bounds;
+
+    if(level->num_rects == 0)
+        return;
+
+    // Clamp to the staging surface, since the packer's rects may include padding past the edge
+    bounds = SDL_RectIntersect(bounds, {0, 0, level->staging->w, level->staging->h});
+
+    if(dest != nullptr && bounds.w > 0 && bounds.h > 0)
+    {
+        SDL_Renderer* renderer = font->renderer;
+        SDL_Surface* region;
+        SDL_Texture* img;
+        int i;
+        SDL_Texture* prev_target = SDL_GetRenderTarget(renderer);
+        SDL_Rect prev_clip, prev_viewport;
+        int prev_logicalw, prev_logicalh;
+        Uint8 prev_clip_enabled;
+        float prev_scalex, prev_scaley;
+        // only backup if previous target existed (SDL will preserve them for the default target)
+        if (prev_target) {
+            prev_clip_enabled = has_clip(renderer);
+            if (prev_clip_enabled)
+                prev_clip = get_clip(renderer);
+            SDL_RenderGetViewport(renderer, &prev_viewport);
+            SDL_RenderGetScale(renderer, &prev_scalex, &prev_scaley);
+            SDL_RenderGetLogicalSize(renderer, &prev_logicalw, &prev_logicalh);
+        }
+
+        // Only upload the part of the staging surface that has new glyphs in it
+        region = SDL_CreateRGBSurfaceWithFormatFrom((Uint8*)level->staging->pixels + bounds.y*level->staging->pitch + bounds.x*4,
+                                                    bounds.w, bounds.h, 32, level->staging->pitch, level->staging->format->format);
+        img = (region != nullptr? SDL_CreateTextureFromSurface(renderer, region) : nullptr);
+        SDL_FreeSurface(region);
+
+        if(img != nullptr)
+        {
+            SDL_SetTextureBlendMode(img, SDL_BLENDMODE_NONE);
+
+            // Copy each glyph on its own so the transparent gaps don't overwrite glyphs that are already cached
+            SDL_SetRenderTarget(renderer, dest);
+            for(i = 0; i < level->num_rects; ++i)
+            {
+                SDL_Rect destrect = level->rects[i];
+                SDL_Rect srcrect = {destrect.x - bounds.x, destrect.y - bounds.y, destrect.w, destrect.h};
+                SDL_RenderCopy(renderer, img, &srcrect, &destrect);
+            }
+            SDL_SetRenderTarget(renderer, prev_target);
+            font->stats.target_switches += 2;
+            if (prev_target) {
+                if (prev_clip_enabled)
+                    set_clip(renderer, &prev_clip);
+                if (prev_logicalw && prev_logicalh)
+                    SDL_RenderSetLogicalSize(renderer, prev_logicalw, prev_logicalh);
+                else {
+                    SDL_RenderSetViewport(renderer, &prev_viewport);
+                    SDL_RenderSetScale(renderer, prev_scalex, prev_scaley);
+                }
+            }
+
+            SDL_DestroyTexture(img);
+        }
+    }
+
+    font->uploads.num_pending -= level->num_rects;
+    level->num_rects = 0;
+
+    // The staging copy is only needed until the next flush
+    SDL_FreeSurface(level->staging);
+    level->staging = nullptr;
+}
+
+void FC_FlushGlyphUploads(FC_Font* font)
+{
+    FC_Font* owner;
+    int num_pending;
+    int i;
+
+    if(font == nullptr)
+        return;
+
+    owner = FC_GetCacheOwner(font);
+    num_pending = owner->uploads.num_pending;
+    if(num_pending == 0)
+        return;
+
+    for(i = 0; i < owner->uploads.num_levels; ++i)
+        FC_FlushGlyphUploadLevel(owner, i);
+
+    FC_NotifyStats(font, FC_STATS_UPLOADS_FLUSHED, num_pending);
+}
+
+
+// Statistics
+
+FC_Stats FC_GetStats(FC_Font* font)
+{
+    FC_Stats stats;
+    FC_Font* owner;
+    Uint64 used_area = 0;
+    Uint64 packed_area = 0;
+    int i;
+
+    if(font == nullptr)
+    {
+        memset(&stats, 0, sizeof(stats));
+        return stats;
+    }
+
+    // An atlas font's cache work is done by the atlas
+    owner = FC_GetCacheOwner(font);
+    stats = font->stats;
+    if(owner != font)
+    {
+        stats.target_switches = owner->stats.target_switches;
+        stats.levels_evicted = owner->stats.levels_evicted;
+    }
+
+    stats.num_cache_levels = owner->glyph_cache_count;
+    stats.cache_bytes = 0;
+    for(i = 0; i < owner->glyph_cache_count; ++i)
+    {
+        Uint32 format;
+        int w, h;
+        if(SDL_QueryTexture(owner->glyph_cache[i], &format, nullptr, &w, &h) == 0)
+            stats.cache_bytes += (Uint64)w*h*SDL_BYTESPERPIXEL(format);
+
+        if(i < owner->num_packers && owner->packers[i].nodes != nullptr)
+        {
+            used_area += owner->packers[i].used_area;
+            packed_area += (Uint64)owner->packers[i].width*owner->packers[i].height;
+        }
+    }
+    stats.cache_occupancy = (packed_area > 0? (float)used_area / packed_area : 0.0f);
+    stats.run_cache_bytes = font->run_cache.bytes;
+
+    return stats;
+}
+
+void FC_ResetStats(FC_Font* font)
+{
+    if(font == nullptr)
+        return;
+
+    memset(&font->stats, 0, sizeof(FC_Stats));
+    if(font->atlas != nullptr)
+        memset(&font->atlas->cache->stats, 0, sizeof(FC_Stats));
+}
+
+void FC_SetStatsCallback(FC_Font* font, void (*callback)(FC_Font* font, FC_StatsEventEnum event, Uint32 value, void* userdata), void* userdata)
+{
+    if(font == nullptr)
+        return;
+
+    font->stats_callback = callback;
+    font->stats_userdata = userdata;
+}
+
+
+unsigned int FC_GetNumCodepoints(FC_Font* font)
+{
+    if(font == nullptr)
+        return 0;
+
+    return FC_MapCount(font->glyphs);
+}
+
+void FC_GetCodepoints(FC_Font* font, Uint32* result)
+{
+    if(font == nullptr)
+        return;
+
+    FC_MapGetKeys(font->glyphs, result);
+}
+
+// How many fonts FC_GetGlyphSource() follows, which also stops it going around a cycle forever
+#define FC_MAX_FALLBACK_DEPTH 8
+
+// Returns the font in the fallback chain whose TTF_Font should render the glyph.  The font itself
+// does when it has the glyph, or when no fallback has it either and it draws its missing glyph box.
+static FC_Font* FC_GetGlyphSource(FC_Font* font, Uint32 codepoint)
+{
+    FC_Font* source;
+    Uint32 unicode;
+    int depth;
+
+    // Control characters aren't drawn, so their boxes come from the font itself
+    if(font->fallback == nullptr || codepoint < 0x20)
+        return font;
+
+    unicode = FC_GetUnicodeFromCodepoint(codepoint);
+    if(TTF_GlyphIsProvided32(font->ttf_source, unicode))
+        return font;
+
+    source = font->fallback;
+    for(depth = 0; source != nullptr && depth < FC_MAX_FALLBACK_DEPTH; ++depth)
+    {
+        if(source->ttf_source != nullptr && TTF_GlyphIsProvided32(source->ttf_source, unicode))
+            return source;
+        source = source->fallback;
+    }
+    return font;
+}
+
+// Moves a glyph rendered by a fallback font onto the font's baseline, in a surface as tall as the font's lines.
+// Parts of the glyph that stick out past the font's line are cut off.
+static SDL_Surface* FC_MoveToBaseline(FC_Font* font, FC_Font* source, SDL_Surface* surf)
+{
+    SDL_Surface* result = FC_CreateSurface32(surf->w, font->height + 2*font->field_padding);
+    SDL_Rect destrect = {0, font->ascent - source->ascent, surf->w, surf->h};
+
+    if(result == nullptr)
+        return nullptr;
+
+    SDL_SetSurfaceBlendMode(surf, SDL_BLENDMODE_NONE);
+    SDL_BlitSurface(surf, nullptr, result, &destrect);
+    return result;
+}
+
+// Headless fonts keep each glyph's metrics and the size it would be rendered at, without rendering it
+static FC_GlyphData* FC_MeasureGlyphData(FC_Font* font, Uint32 codepoint)
+{
+    char buff[5];
+    int w, h;
+    Uint16 width;
+    FC_GlyphData glyph;
+    FC_GlyphMetrics metrics;
+    FC_Font* source = FC_GetGlyphSource(font, codepoint);
+
+    FC_GetUTF8FromCodepoint(buff, codepoint);
+
+    // This is the size TTF_RenderUTF8_Blended() would make the glyph's surface, which fails for empty glyphs
+    if(TTF_SizeUTF8(source->ttf_source, buff, &w, &h) < 0 || w <= 0)
+        return nullptr;
+
+    // Borrowed glyphs are moved onto the font's lines
+    if(source != font)
+        h = font->height;
+
+    width = w;
+    metrics = FC_GetTTFGlyphMetrics(source, source->ttf_source, codepoint, w);
+    if(codepoint == '\t')
+        FC_SetupTabGlyph(font, &metrics, &width);
+
+    glyph = FC_MakeGlyphData(0, 0, 0, width, h);
+    glyph.metrics = metrics;
+    return FC_MapInsert(font->glyphs, codepoint, glyph);
+}
+
+// Marks the glyph's cache level as used by the current draw, so eviction passes it over
+static inline void FC_TouchGlyph(FC_Font* owner, const FC_GlyphData* glyph)
+{
+    if(glyph->cache_level < owner->num_packers && FC_IsFontThread(owner))
+        owner->packers[glyph->cache_level].last_used = owner->draw_count;
+}
+
+Uint8 FC_GetGlyphData(FC_Font* font, FC_GlyphData* result, Uint32 codepoint)
+{
+    FC_Font* owner = FC_GetCacheOwner(font);
+    FC_GlyphData* e = FC_MapFind(font->glyphs, codepoint);
+    if(e != nullptr)
+    {
+        if(FC_IsFontThread(font))
+            ++font->stats.glyph_hits;
+    }
+    else if(font->renderer == nullptr)
+    {
+        ++font->stats.glyph_misses;
+        if(font->ttf_source == nullptr)
+            return 0;
+
+        e = FC_MeasureGlyphData(font, codepoint);
+        if(e == nullptr)
+            return 0;
+    }
+    else
+    {
+        char buff[5];
+        int w, h;
+        SDL_Surface* surf;
+        SDL_Texture* cache_image;
+        FC_GlyphMetrics metrics;
+        FC_Font* source;
+        Uint64 start = SDL_GetPerformanceCounter();
+
+        ++font->stats.glyph_misses;
+        if(font->ttf_source == nullptr)
+            return 0;
+
+        FC_GetUTF8FromCodepoint(buff, codepoint);
+
+        cache_image = FC_GetGlyphCacheLevel(owner, owner->last_glyph.cache_level);
+        if(cache_image == nullptr)
+        {
+            SDL_Log("SDL_FontCache: Failed to load cache image, so cannot add new glyphs!\n");
+            return 0;
+        }
+
+        SDL_QueryTexture(cache_image, nullptr, nullptr, &w, &h);
+
+        source = FC_GetGlyphSource(font, codepoint);
+        surf = FC_RenderGlyphSurface(font, source->ttf_source, buff);
+        if(surf == nullptr)
+        {
+            return 0;
+        }
+        ++font->stats.glyphs_rendered;
+        metrics = FC_GetTTFGlyphMetrics(source, source->ttf_source, codepoint, surf->w - 2*font->field_padding);
+        if(source != font)
+        {
+            SDL_Surface* moved = FC_MoveToBaseline(font, source, surf);
+            SDL_FreeSurface(surf);
+            surf = moved;
+            if(surf == nullptr)
+                return 0;
+        }
+
+        e = FC_PackGlyphData(font, codepoint, metrics, surf->w, surf->h, w, h);
+        if(e == nullptr)
+        {
+            // Make room on an old level if the font is at its limit, otherwise grow the cache
+            Uint8 evicted = (owner->cache_level_limit > 0 && owner->glyph_cache_count >= owner->cache_level_limit && FC_EvictGlyphCacheLevel(font));
+            if(!evicted && !FC_GrowGlyphCache(font))
+            {
+                SDL_FreeSurface(surf);
+                return 0;
+            }
+
+            // Try packing again
+            SDL_QueryTexture(FC_GetGlyphCacheLevel(owner, owner->last_glyph.cache_level), nullptr, nullptr, &w, &h);
+            e = FC_PackGlyphData(font, codepoint, metrics, surf->w, surf->h, w, h);
+            if(e == nullptr)
+            {
+                SDL_FreeSurface(surf);
+                return 0;
+            }
+        }
+
+        // Render onto the cache texture
+        FC_AddGlyphToCache(font, surf);
+
+        SDL_FreeSurface(surf);
+        FC_NotifyStats(font, FC_STATS_GLYPH_RENDERED, FC_GetMicroseconds(start));
+    }
+
+    if(result != nullptr && e != nullptr)
+        *result = *e;
+
+    if(e != nullptr)
+        FC_TouchGlyph(owner, e);
+
+    return 1;
+}
+
+// FC_GetGlyphData() for the draw and measure loops.  Hits are used in place rather than copied (ASCII comes
+// straight from the map's direct table), and the returned glyph stays valid until the next one is added.
+static inline const FC_GlyphData* FC_LookupGlyph(FC_Font* font, Uint32 codepoint)
+{
+    FC_GlyphData* e = FC_MapFind(font->glyphs, codepoint);
+    if(e == nullptr)
+        return (FC_GetGlyphData(font, nullptr, codepoint)? FC_MapFind(font->glyphs, codepoint) : nullptr);
+
+    if(FC_IsFontThread(font))
+        ++font->stats.glyph_hits;
+    FC_TouchGlyph(FC_GetCacheOwner(font), e);
+    return e;
+}
+
+// Looks up the codepoint's glyph, or the space's for characters the font can't provide
+static inline const FC_GlyphData* FC_LookupGlyphOrSpace(FC_Font* font, Uint32* codepoint)
+{
+    const FC_GlyphData* glyph = FC_LookupGlyph(font, *codepoint);
+    if(glyph == nullptr)
+    {
+        *codepoint = ' ';
+        glyph = FC_LookupGlyph(font, ' ');
+    }
+    return glyph;
+}
+
+
+// Warm-up
+
+static Uint8 FC_PushWarmRange(FC_WarmQueue* queue, Uint32 first, Uint32 last)
+{
+    if(queue->count == queue->size)
+    {
+        // Reuse the space of ranges already taken off the front before growing
+        if(queue->head > 0)
+        {
+            memmove(queue->ranges, queue->ranges + queue->head, (queue->count - queue->head) * sizeof(FC_CodepointRange));
+            queue->count -= queue->head;
+            queue->head = 0;
+        }
+        else
+        {
+            int new_size = (queue->size > 0? queue->size*2 : 16);
+            FC_CodepointRange* new_ranges = (FC_CodepointRange*)realloc(queue->ranges, new_size * sizeof(FC_CodepointRange));
+            if(new_ranges == nullptr)
+                return 0;
+            queue->ranges = new_ranges;
+            queue->size = new_size;
+        }
+    }
+
+    queue->ranges[queue->count].first = first;
+    queue->ranges[queue->count].last = last;
+    ++queue->count;
+    queue->num_codepoints += last - first + 1;
+    return 1;
+}
+
+// Takes the next Unicode value off the queue.  Only call while queue->num_codepoints > 0.
+static Uint32 FC_PopWarmCodepoint(FC_WarmQueue* queue)
+{
+    FC_CodepointRange* range = &queue->ranges[queue->head];
+    Uint32 unicode = range->first;
+
+    if(range->first < range->last)
+        ++range->first;
+    else if(++queue->head == queue->count)
+        queue->head = queue->count = 0;
+
+    --queue->num_codepoints;
+    return unicode;
+}
+
+Uint8 FC_QueueGlyphRange(FC_Font* font, Uint32 first, Uint32 last)
+{
+    if(font == nullptr || !FC_ClampCodepointRange(&first, &last))
+        return 0;
+
+    return FC_PushWarmRange(&font->warm_queue, first, last);
+}
+
+Uint8 FC_QueueGlyphsFromText(FC_Font* font, const char* text, int len)
+{
+    FC_TextScan scan;
+    FC_Map* seen;
+    FC_GlyphData empty = FC_MakeGlyphData(0, 0, 0, 0, 0);
+    Uint32 first = 0;
+    Uint32 last = 0;
+    Uint8 result = 1;
+
+    if(font == nullptr || text == nullptr)
+        return 0;
+
+    if(len < 0)
+        len = strlen(text);
+
+    seen = FC_MapCreate();
+    if(seen == nullptr)
+        return 0;
+
+    // Characters that follow each other in Unicode go in as one range
+    FC_BeginTextScan(&scan, text, text + len);
+    while(scan.c < scan.end && result)
+    {
+        Uint32 codepoint = FC_NextCodepoint(&scan);
+        Uint32 unicode;
+
+        if(codepoint < 0x20 || FC_MapFind(font->glyphs, codepoint) != nullptr || FC_MapFind(seen, codepoint) != nullptr)
+            continue;
+        FC_MapInsert(seen, codepoint, empty);
+
+        unicode = FC_GetUnicodeFromCodepoint(codepoint);
+        if(first != 0 && unicode == last + 1)
+            last = unicode;
+        else
+        {
+            if(first != 0)
+                result = FC_PushWarmRange(&font->warm_queue, first, last);
+            first = last = unicode;
+        }
+    }
+    if(first != 0 && result)
+        result = FC_PushWarmRange(&font->warm_queue, first, last);
+
+    FC_MapFree(seen);
+    return result;
+}
+
+int FC_WarmGlyphs(FC_Font* font, Uint32 budget_us)
+{
+    FC_WarmQueue* queue;
+    Uint64 start = SDL_GetPerformanceCounter();
+    int warmed = 0;
+
+    if(font == nullptr)
+        return 0;
+
+    // Nothing to render with until the font is loaded
+    queue = &font->warm_queue;
+    if(font->ttf_source == nullptr)
+        return queue->num_codepoints;
+
+    while(queue->num_codepoints > 0)
+    {
+        Uint32 unicode = FC_PopWarmCodepoint(queue);
+        Uint32 codepoint = FC_GetCodepointFromUnicode(unicode);
+
+        // Checking is cheap next to rendering, but a large range of characters the font doesn't have still takes time
+        if(!FC_IsSurrogate(unicode) && FC_MapFind(font->glyphs, codepoint) == nullptr
+           && TTF_GlyphIsProvided32(FC_GetGlyphSource(font, codepoint)->ttf_source, unicode))
+        {
+            FC_GetGlyphData(font, nullptr, codepoint);
+            ++warmed;
+        }
+
+        if(FC_GetMicroseconds(start) >= budget_us)
+            break;
+    }
+
+    if(warmed > 0)
+        FC_FlushGlyphUploads(font);
+
+    return queue->num_codepoints;
+}
+
+int FC_GetNumQueuedGlyphs(FC_Font* font)
+{
+    if(font == nullptr)
+        return 0;
+
+    return font->warm_queue.num_codepoints;
+}
+
+
+FC_GlyphData* FC_SetGlyphData(FC_Font* font, Uint32 codepoint, FC_GlyphData glyph_data)
+{
+    ++font->generation;
+    return FC_MapInsert(font->glyphs, codepoint, glyph_data);
+}
+
+
+
+// Drawing
+// Switches to the color of the run that 'c' is in.  Batched glyphs take it as their vertex color.
+static void FC_ApplyColorRun(FC_Font* font, FC_GlyphBatch* batch, const char* c)
+{
+    int offset = c - font->run_text;
+    int lo = 0;
+    int hi = font->num_runs;
+    SDL_Color color;
+
+    // Find the last run that starts at or before the offset
+    while(lo < hi)
+    {
+        int mid = (lo + hi)/2;
+        if(font->runs[mid].offset <= offset)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    color = (lo > 0? font->runs[lo-1].color : font->run_base_color);
+
+    if(batch != nullptr)
+        batch->color = color;
+    else if(color.r != font->run_color.r || color.g != font->run_color.g || color.b != font->run_color.b || FC_GET_ALPHA(color) != FC_GET_ALPHA(font->run_color))
+    {
+        set_color_for_all_caches(font, color);
+        font->run_color = color;
+    }
+}
+
+static SDL_Rect FC_RenderLeft(FC_Font* font, SDL_Renderer* dest, FC_GlyphBatch* batch, const SDL_Rect* visible, int x, int y, FC_Scale scale, const char* text, int len)
+{
+    const char* glyph_start;
+    const char* end;
+    FC_TextScan scan;
+    SDL_Rect srcRect;
+    SDL_Rect dstRect;
+    SDL_Rect dirtyRect = {x, y, 0, 0};
+
+    const FC_GlyphData* glyph;
+    Uint32 codepoint;
+    Uint32 prev = 0;
+
+    float destX = x;
+    float destY = y;
+    float drawX, drawY;
+    float destH;
+    float destLineSpacing;
+    float destLetterSpacing;
+
+    if(font == nullptr)
+        return dirtyRect;
+
+    destH = font->height * scale.y;
+    destLineSpacing = font->lineSpacing*scale.y;
+    destLetterSpacing = font->letterSpacing*scale.x;
+
+    if(text == nullptr || FC_GetNumCacheLevels(font) == 0 || dest == nullptr)
+        return dirtyRect;
+
+    int newlineX = x;
+    end = text + len;
+
+    if(batch == nullptr)
+    {
+        // Drawing one glyph at a time, so every glyph must be on its cache texture up front
+        FC_BeginTextScan(&scan, text, end);
+        while(scan.c < end)
+        {
+            codepoint = FC_NextCodepoint(&scan);
+            if(codepoint != '\n')
+                FC_LookupGlyphOrSpace(font, &codepoint);
+        }
+        FC_FlushGlyphUploads(font);
+        FC_NotifyDistanceField(font, dest, 1);
+    }
+
+    FC_BeginTextScan(&scan, text, end);
+    while(scan.c < end)
+    {
+        glyph_start = scan.c;
+        codepoint = FC_NextCodepoint(&scan);
+        if(codepoint == '\n')
+        {
+            destX = newlineX;
+            destY += destH + destLineSpacing;
+            prev = 0;
+            continue;
+        }
+
+        glyph = FC_LookupGlyphOrSpace(font, &codepoint);
+        if(glyph == nullptr)
+            continue;  // Skip bad characters
+
+        destX += FC_GetKerning(font, prev, codepoint)*scale.x;
+        prev = codepoint;
+
+        if (codepoint == ' ')
+        {
+            destX += glyph->rect.w*scale.x + destLetterSpacing;
+            continue;
+        }
+        srcRect = glyph->rect;
+        drawX = destX;
+        drawY = destY;
+        if(font->field_padding > 0)
+        {
+            // Distance field glyphs are drawn with the falloff around them, which doesn't move the pen
+            srcRect.x -= font->field_padding;
+            srcRect.y -= font->field_padding;
+            srcRect.w += 2*font->field_padding;
+            srcRect.h += 2*font->field_padding;
+            drawX -= font->field_padding*(scale.x < 0? -scale.x : scale.x);
+            drawY -= font->field_padding*(scale.y < 0? -scale.y : scale.y);
+        }
+
+        // Glyphs that can't be seen still count toward the drawn area, but aren't submitted
+        if(visible != nullptr && scale.x > 0 && scale.y > 0)
+        {
+            dstRect.x = (int)drawX;
+            dstRect.y = (int)drawY;
+            dstRect.w = (int)(srcRect.w*scale.x);
+            dstRect.h = (int)(srcRect.h*scale.y);
+            if(dstRect.x >= visible->x + visible->w || dstRect.y >= visible->y + visible->h
+               || dstRect.x + dstRect.w <= visible->x || dstRect.y + dstRect.h <= visible->y)
+            {
+                dstRect = {(int)destX, (int)destY, (int)(glyph->rect.w*scale.x), (int)(glyph->rect.h*scale.y)};
+                dirtyRect = (dirtyRect.w == 0 || dirtyRect.h == 0? dstRect : SDL_RectUnion(dirtyRect, dstRect));
+                destX += glyph->rect.w*scale.x + destLetterSpacing;
+                continue;
+            }
+        }
+
+        if(font->num_runs > 0)
+            FC_ApplyColorRun(font, batch, glyph_start);
+
+        if(batch != nullptr)
+            dstRect = FC_BatchGlyph(batch, FC_GetGlyphCacheLevel(font, glyph->cache_level), glyph->cache_level, &srcRect, drawX, drawY, scale.x, scale.y);
+        else
+        {
+            dstRect = fc_render_callback(FC_GetGlyphCacheLevel(font, glyph->cache_level), &srcRect, dest, drawX, drawY, scale.x, scale.y);
+            ++font->stats.render_calls;
+        }
+
+        // The returned area is the glyphs' boxes either way
+        if(font->field_padding > 0)
+            dstRect = {(int)destX, (int)destY, (int)(glyph->rect.w*scale.x), (int)(glyph->rect.h*scale.y)};
+        if(dirtyRect.w == 0 || dirtyRect.h == 0)
+            dirtyRect = dstRect;
+        else
+            dirtyRect = SDL_RectUnion(dirtyRect, dstRect);
+
+        destX += glyph->rect.w*scale.x + destLetterSpacing;
+    }
+
+    if(batch == nullptr)
+        FC_NotifyDistanceField(font, dest, 0);
+
+    return dirtyRect;
+}
+
+
+
+// Adds up the kerned advances of one line of text, the same way FC_RenderLeft() moves the pen.
+// 'prev' carries the last codepoint so a line can be measured a piece at a time.
+static int FC_GetLineWidth(FC_Font* font, const char* text, const char* end, Uint32* prev)
+{
+    FC_TextScan scan;
+    int width = 0;
+
+    FC_BeginTextScan(&scan, text, end);
+    while(scan.c < end)
+    {
+        const FC_GlyphData* glyph;
+        Uint32 codepoint = FC_NextCodepoint(&scan);
+        if(codepoint == '\n')
+        {
+            *prev = 0;
+            continue;
+        }
+
+        glyph = FC_LookupGlyphOrSpace(font, &codepoint);
+        if(glyph == nullptr)
+            continue;
+
+        width += FC_GetKerning(font, *prev, codepoint) + glyph->rect.w;
+        *prev = codepoint;
+    }
+
+    return width;
+}
+
+// Word wrapping walks the original buffer and hands back each wrapped line as a span into it,
+// so measuring and drawing a column doesn't allocate or copy any text.
+typedef struct FC_LineWrap
+{
+    FC_Font* font;
+    int width;
+    Uint8 keep_newlines;
+
+    const char* pos;  // Start of the next line, or nullptr when there are no more
+    const char* line_end;  // End of the current newline-delimited line
+    const char* end;
+} FC_LineWrap;
+
+static const char* FC_FindNewline(const char* text, const char* end)
+{
+    const char* c = (const char*)memchr(text, '\n', end - text);
+    return (c != nullptr? c : end);
+}
+
+static void FC_BeginLineWrap(FC_LineWrap* wrap, FC_Font* font, int width, Uint8 keep_newlines, const char* text, int len)
+{
+    wrap->font = font;
+    wrap->width = width;
+    wrap->keep_newlines = keep_newlines;
+    wrap->pos = text;
+    wrap->end = wrap->line_end = nullptr;
+
+    if(text != nullptr)
+    {
+        wrap->end = text + len;
+        wrap->line_end = FC_FindNewline(text, wrap->end);
+    }
+}
+
+// Finds where the line starting at 'start' has to break and returns 1 if it does.  Words are split on
+// spaces and tabs, and each word keeps the space after it.  A line always gets at least one word,
+// even if it's too wide.  Trailing spaces that don't fit carry over to an empty line of their own.
+static Uint8 FC_FindLineBreak(FC_LineWrap* wrap, const char* start, const char** line_break)
+{
+    const char* c = start;
+    int line_width = 0;
+    Uint32 prev = 0;
+
+    *line_break = wrap->line_end;
+    if(wrap->width <= 0)
+        return 0;
+
+    while(1)
+    {
+        const char* word = c;
+        int word_width;
+
+        while(c < wrap->line_end && *c != ' ' && *c != '\t')
+            ++c;
+        word_width = FC_GetLineWidth(wrap->font, word, c, &prev);
+
+        if(word != start && line_width + word_width > wrap->width)
+        {
+            *line_break = word;
+            return 1;
+        }
+
+        if(c == wrap->line_end)
+            return 0;
+
+        line_width += word_width + FC_GetLineWidth(wrap->font, c, c + 1, &prev);
+        ++c;
+    }
+}
+
+// Returns the next wrapped line.  When keeping newlines, each line after a '\n' starts with it.
+static Uint8 FC_NextWrappedLine(FC_LineWrap* wrap, const char** line, int* line_len)
+{
+    const char* start = wrap->pos;
+    const char* line_break;
+
+    if(start == nullptr)
+        return 0;
+
+    if(FC_FindLineBreak(wrap, start, &line_break))
+        wrap->pos = line_break;
+    else if(wrap->line_end == wrap->end)
+        wrap->pos = nullptr;
+    else
+    {
+        wrap->pos = (wrap->keep_newlines? wrap->line_end : wrap->line_end + 1);
+        wrap->line_end = FC_FindNewline(wrap->line_end + 1, wrap->end);
+    }
+
+    *line = start;
+    *line_len = line_break - start;
+    return 1;
+}
+
+static SDL_Rect FC_RenderAlign(FC_Font* font, SDL_Renderer* dest, FC_GlyphBatch* batch, const SDL_Rect* visible, int x, int y, int width, FC_Scale scale, FC_AlignEnum align, const char* text, int len)
+{
+    switch(align)
+    {
+        case FC_ALIGN_LEFT:
+            return FC_RenderLeft(font, dest, batch, visible, x, y, scale, text, len);
+        case FC_ALIGN_CENTER:
+            return FC_RenderAlignedLines(font, dest, batch, visible, x + width/2, y, scale, align, text, len);
+        case FC_ALIGN_RIGHT:
+            return FC_RenderAlignedLines(font, dest, batch, visible, x + width, y, scale, align, text, len);
+        default:
+            return {x, y, 0, 0};
+    }
+}
+
+static void FC_RenderColumn(FC_Font* font, SDL_Renderer* dest, FC_GlyphBatch* batch, const SDL_Rect* visible, SDL_Rect box, int* total_height, FC_Scale scale, FC_AlignEnum align, const char* text, int len)
+{
+    int y = box.y;
+    int line_height = FC_GetLineHeight(font);
+    int glyph_height = font->height*scale.y;
+    FC_LineWrap wrap;
+    const char* line;
+    int line_len;
+
+    if(scale.x <= 0 || scale.y <= 0)
+        visible = nullptr;  // Flipped glyphs don't land where the pen is
+
+    FC_BeginLineWrap(&wrap, font, box.w, 0, text, len);
+    while(FC_NextWrappedLine(&wrap, &line, &line_len))
+    {
+        if(visible != nullptr && y >= visible->y + visible->h)
+        {
+            // Everything from here down is hidden.  Keep wrapping only if someone wants the height.
+            if(total_height == nullptr)
+                break;
+        }
+        else if(visible == nullptr || y + glyph_height > visible->y)
+            FC_RenderAlign(font, dest, batch, visible, box.x, y, box.w, scale, align, line, line_len);
+        y += line_height;
+    }
+
+    if(total_height != nullptr)
+        *total_height = y - box.y;
+}
+
+static void FC_DrawColumnFromText(FC_Font* font, SDL_Renderer* dest, SDL_Rect box, int* total_height, FC_Scale scale, FC_AlignEnum align, SDL_Color color, const char* text, int len)
+{
+    SDL_Rect result;
+    if(FC_DrawCachedRun(font, dest, box, FC_MakeEffect(align, scale, color), text, len, &result))
+    {
+        if(total_height != nullptr)
+            *total_height = result.h;
+        return;
+    }
+
+    SDL_Rect visible = get_visible_rect(dest);
+    FC_GlyphBatch* batch = FC_BeginBatch(font, color);
+    FC_RenderColumn(font, dest, batch, &visible, box, total_height, scale, align, text, len);
+    FC_SubmitBatch(font, dest, batch);
+}
+
+// How many lines FC_RenderAlignedLines() measures before drawing them.  Longer text is done this many lines at a time.
+#define FC_ALIGN_LINE_BATCH 32
+
+// Draws each line with its middle (FC_ALIGN_CENTER) or right end (FC_ALIGN_RIGHT) at x.
+// The lines are measured into a stack buffer and then drawn, so the text is only split once.
+// Lines outside of visible aren't measured, so they don't count toward the returned area.
+static SDL_Rect FC_RenderAlignedLines(FC_Font* font, SDL_Renderer* dest, FC_GlyphBatch* batch, const SDL_Rect* visible, int x, int y, FC_Scale scale, FC_AlignEnum align, const char* text, int len)
+{
+    SDL_Rect result = {x, y, 0, 0};
+    struct
+    {
+        const char* text;
+        const char* end;
+        int y;
+        int width;
+    } lines[FC_ALIGN_LINE_BATCH];
+    const char* c;
+    const char* end;
+    int glyph_height;
+    int num_lines, i;
+    if(text == nullptr || font == nullptr)
+        return result;
+
+    if(scale.x <= 0 || scale.y <= 0)
+        visible = nullptr;  // Flipped glyphs don't land where the pen is
+
+    glyph_height = font->height*scale.y;
+    end = text + len;
+    for(c = text; c != nullptr;)
+    {
+        for(num_lines = 0; num_lines < FC_ALIGN_LINE_BATCH && c != nullptr; y += scale.y*font->height)
+        {
+            const char* line_end = FC_FindNewline(c, end);
+            if(visible != nullptr && y >= visible->y + visible->h)
+            {
+                c = nullptr;  // Everything from here down is hidden
+                break;
+            }
+
+            if(visible == nullptr || y + glyph_height > visible->y)
+            {
+                Uint32 prev = 0;
+                lines[num_lines].text = c;
+                lines[num_lines].end = line_end;
+                lines[num_lines].y = y;
+                lines[num_lines].width = FC_GetLineWidth(font, c, line_end, &prev);
+                ++num_lines;
+            }
+            c = (line_end < end? line_end + 1 : nullptr);
+        }
+
+        for(i = 0; i < num_lines; ++i)
+        {
+            int line_x = (align == FC_ALIGN_CENTER? x - scale.x*lines[i].width/2 : x - scale.x*lines[i].width);
+            result = SDL_RectUnion(FC_RenderLeft(font, dest, batch, visible, line_x, lines[i].y, scale, lines[i].text, lines[i].end - lines[i].text), result);
+        }
+    }
+
+    return result;
+}
+
+
+
+// Non-variadic drawing
+
+SDL_Rect FC_DrawText(FC_Font* font, SDL_Renderer* dest, int x, int y, const char* text, int len)
+{
+    if(text == nullptr || font == nullptr)
+        return {x, y, 0, 0};
+
+    return FC_DrawTextEffect(font, dest, x, y, FC_MakeEffect(FC_ALIGN_LEFT, {1,1}, font->default_color), text, len);
+}
+
+SDL_Rect FC_DrawTextEffect(FC_Font* font, SDL_Renderer* dest, int x, int y, FC_Effect effect, const char* text, int len)
+{
+    if(text == nullptr || font == nullptr)
+        return {x, y, 0, 0};
+
+    if(len < 0)
+        len = strlen(text);
+
+    SDL_Rect result;
+    if(FC_DrawCachedRun(font, dest, {x, y, 0, 0}, effect, text, len, &result))
+        return result;
+
+    SDL_Rect visible = get_visible_rect(dest);
+    FC_GlyphBatch* batch = FC_BeginBatch(font, effect.color);
+    result = FC_RenderAlign(font, dest, batch, &visible, x, y, 0, effect.scale, effect.alignment, text, len);
+    FC_SubmitBatch(font, dest, batch);
+
+    return result;
+}
+
+SDL_Rect FC_DrawTextBox(FC_Font* font, SDL_Renderer* dest, SDL_Rect box, FC_Effect effect, const char* text, int len)
+{
+    Uint8 useClip;
+    if(text == nullptr || font == nullptr)
+        return {box.x, box.y, 0, 0};
+
+    if(len < 0)
+        len = strlen(text);
+
+    useClip = has_clip(dest);
+    SDL_Rect oldclip, newclip;
+    if(useClip)
+    {
+        oldclip = get_clip(dest);
+        newclip = SDL_RectIntersect(oldclip, box);
+    }
+    else
+        newclip = box;
+    set_clip(dest, &newclip);
+
+    FC_DrawColumnFromText(font, dest, box, nullptr, effect.scale, effect.alignment, effect.color, text, len);
+
+    if(useClip)
+        set_clip(dest, &oldclip);
+    else
+        set_clip(dest, nullptr);
+
+    return box;
+}
+
+SDL_Rect FC_DrawTextColumn(FC_Font* font, SDL_Renderer* dest, int x, int y, Uint16 width, FC_Effect effect, const char* text, int len)
+{
+    SDL_Rect box = {x, y, width, 0};
+    int total_height;
+
+    if(text == nullptr || font == nullptr)
+        return {x, y, 0, 0};
+
+    if(len < 0)
+        len = strlen(text);
+
+    switch(effect.alignment)
+    {
+    case FC_ALIGN_CENTER:
+        box.x -= width/2;
+        break;
+    case FC_ALIGN_RIGHT:
+        box.x -= width;
+        break;
+    default:
+        break;
+    }
+
+    FC_DrawColumnFromText(font, dest, box, &total_height, effect.scale, effect.alignment, effect.color, text, len);
+
+    return {box.x, box.y, width, total_height};
+}
+
+
+static void FC_BeginColorRuns(FC_Font* font, SDL_Color color, const char* text, const FC_ColorRun* runs, int num_runs)
+{
+    font->run_text = text;
+    font->runs = runs;
+    font->num_runs = (runs != nullptr && num_runs > 0? num_runs : 0);
+    font->run_base_color = color;
+    font->run_color = color;
+}
+
+SDL_Rect FC_DrawTextRuns(FC_Font* font, SDL_Renderer* dest, int x, int y, FC_Effect effect, const char* text, int len, const FC_ColorRun* runs, int num_runs)
+{
+    SDL_Rect result;
+    if(text == nullptr || font == nullptr)
+        return {x, y, 0, 0};
+
+    FC_BeginColorRuns(font, effect.color, text, runs, num_runs);
+    result = FC_DrawTextEffect(font, dest, x, y, effect, text, len);
+    font->num_runs = 0;
+
+    return result;
+}
+
+SDL_Rect FC_DrawTextBoxRuns(FC_Font* font, SDL_Renderer* dest, SDL_Rect box, FC_Effect effect, const char* text, int len, const FC_ColorRun* runs, int num_runs)
+{
+    SDL_Rect result;
+    if(text == nullptr || font == nullptr)
+        return {box.x, box.y, 0, 0};
+
+    FC_BeginColorRuns(font, effect.color, text, runs, num_runs);
+    result = FC_DrawTextBox(font, dest, box, effect, text, len);
+    font->num_runs = 0;
+
+    return result;
+}
+
+
+
+// Text layouts
+
+struct FC_TextLayout
+{
+    FC_Font* font;
+    Uint32 font_generation;  // FC_GetFontGeneration() when the quads were built
+    Uint8 dirty;
+
+    char* text;
+    int len;
+    SDL_Rect box;
+    FC_Effect effect;
+
+    SDL_Rect bounds;
+    Uint8 batched;  // 0 when the quads couldn't be kept, so every draw goes through the render callback
+    FC_GlyphBatch batch;
+};
+
+// Quads kept in 'batch' are drawn later under whatever clip is set then, so only direct drawing is culled
+static SDL_Rect FC_RenderTextLayout(FC_TextLayout* layout, SDL_Renderer* dest, FC_GlyphBatch* batch)
+{
+    FC_Font* font = layout->font;
+    SDL_Rect box = layout->box;
+    FC_Effect effect = layout->effect;
+    SDL_Rect visible_rect;
+    const SDL_Rect* visible = nullptr;
+
+    if(batch == nullptr)
+    {
+        visible_rect = get_visible_rect(dest);
+        visible = &visible_rect;
+        set_color_for_all_caches(font, effect.color);
+    }
+    else
+        batch->color = effect.color;
+
+    if(box.w > 0)
+    {
+        int total_height;
+        FC_RenderColumn(font, dest, batch, visible, box, &total_height, effect.scale, effect.alignment, layout->text, layout->len);
+        if(box.h <= 0)
+            box.h = total_height;
+        return box;
+    }
+
+    return FC_RenderAlign(font, dest, batch, visible, box.x, box.y, 0, effect.scale, effect.alignment, layout->text, layout->len);
+}
+
+static void FC_BuildTextLayout(FC_TextLayout* layout)
+{
+    Uint64 start = SDL_GetPerformanceCounter();
+    Uint32 elapsed;
+
+    layout->font_generation = FC_GetFontGeneration(layout->font);
+    layout->dirty = 0;
+    layout->batched = FC_CanBatch();
+
+    // Headless fonts have nothing to draw, only bounds to measure
+    FC_ResetBatch(&layout->batch);
+    if(layout->batched && layout->font->renderer != nullptr)
+        layout->bounds = FC_RenderTextLayout(layout, layout->font->renderer, &layout->batch);
+
+    elapsed = FC_GetMicroseconds(start);
+    if(FC_IsFontThread(layout->font))
+        layout->font->stats.layout_us += elapsed;
+    FC_NotifyStats(layout->font, FC_STATS_LAYOUT_BUILT, elapsed);
+}
+
+FC_TextLayout* FC_CreateTextLayout(FC_Font* font, SDL_Rect box, FC_Effect effect, const char* text, int len)
+{
+    FC_TextLayout* layout;
+
+    if(font == nullptr)
+        return nullptr;
+
+    layout = (FC_TextLayout*)calloc(1, sizeof(FC_TextLayout));
+    if(layout == nullptr)
+        return nullptr;
+
+    layout->font = font;
+    layout->box = box;
+    layout->effect = effect;
+    layout->bounds = {box.x, box.y, 0, 0};
+    FC_SetTextLayoutText(layout, text, len);
+    layout->dirty = 1;
+
+    return layout;
+}
+
+void FC_FreeTextLayout(FC_TextLayout* layout)
+{
+    if(layout == nullptr)
+        return;
+
+    FC_FreeBatch(&layout->batch);
+    free(layout->text);
+    free(layout);
+}
+
+void FC_SetTextLayoutText(FC_TextLayout* layout, const char* text, int len)
+{
+    char* new_text;
+
+    if(layout == nullptr)
+        return;
+
+    if(text == nullptr)
+        text = "";
+    if(len < 0)
+        len = strlen(text);
+
+    if(layout->text != nullptr && layout->len == len && memcmp(layout->text, text, len) == 0)
+        return;
+
+    new_text = (char*)malloc(len + 1);
+    if(new_text == nullptr)
+        return;
+    memcpy(new_text, text, len);
+    new_text[len] = '\0';
+
+    free(layout->text);
+    layout->text = new_text;
+    layout->len = len;
+    layout->dirty = 1;
+}
+
+void FC_SetTextLayoutBox(FC_TextLayout* layout, SDL_Rect box)
+{
+    int dx, dy;
+    int i, j;
+
+    if(layout == nullptr)
+        return;
+
+    dx = box.x - layout->box.x;
+    dy = box.y - layout->box.y;
+    if(dx == 0 && dy == 0 && box.w == layout->box.w && box.h == layout->box.h)
+        return;
+
+    // Just moving the box doesn't change the layout, so slide the quads instead of rebuilding them
+    if(!layout->dirty && layout->batched && box.w == layout->box.w && box.h == layout->box.h)
+    {
+        for(i = 0; i < layout->batch.num_levels; ++i)
+        {
+            FC_GlyphBatchLevel* level = &layout->batch.levels[i];
+            for(j = 0; j < level->num_vertices; ++j)
+            {
+                level->vertices[j].position.x += dx;
+                level->vertices[j].position.y += dy;
+            }
+        }
+        layout->bounds.x += dx;
+        layout->bounds.y += dy;
+    }
+    else
+        layout->dirty = 1;
+
+    layout->box = box;
+}
+
+void FC_SetTextLayoutEffect(FC_TextLayout* layout, FC_Effect effect)
+{
+    Uint8 same_shape;
+    int i, j;
+
+    if(layout == nullptr)
+        return;
+
+    same_shape = (layout->effect.alignment == effect.alignment && layout->effect.scale.x == effect.scale.x && layout->effect.scale.y == effect.scale.y);
+    if(same_shape && layout->effect.color.r == effect.color.r && layout->effect.color.g == effect.color.g && layout->effect.color.b == effect.color.b && FC_GET_ALPHA(layout->effect.color) == FC_GET_ALPHA(effect.color))
+        return;
+
+    // A new color doesn't move anything, so recolor the quads instead of rebuilding them
+    if(same_shape && !layout->dirty && layout->batched)
+    {
+        for(i = 0; i < layout->batch.num_levels; ++i)
+        {
+            FC_GlyphBatchLevel* level = &layout->batch.levels[i];
+            for(j = 0; j < level->num_vertices; ++j)
+                level->vertices[j].color = effect.color;
+        }
+        layout->batch.color = effect.color;
+    }
+    else
+        layout->dirty = 1;
+
+    layout->effect = effect;
+}
+
+static void FC_UpdateTextLayout(FC_TextLayout* layout)
+{
+    if(layout->dirty || layout->font_generation != FC_GetFontGeneration(layout->font) || layout->batched != FC_CanBatch())
+        FC_BuildTextLayout(layout);
+}
+
+// Kept quads skip the glyph lookups that mark cache levels as used, so mark the levels they draw from
+static void FC_TouchBatchLevels(FC_Font* font, FC_GlyphBatch* batch)
+{
+    FC_Font* owner = FC_GetCacheOwner(font);
+    int i;
+    for(i = 0; i < batch->num_levels && i < owner->num_packers; ++i)
+    {
+        if(batch->levels[i].num_indices > 0)
+            owner->packers[i].last_used = owner->draw_count;
+    }
+}
+
+SDL_Rect FC_GetTextLayoutBounds(FC_TextLayout* layout)
+{
+    if(layout == nullptr)
+        return {0, 0, 0, 0};
+
+    FC_UpdateTextLayout(layout);
+    if(!layout->batched || layout->font->renderer == nullptr)
+    {
+        // Measure without drawing
+        SDL_Rect box = layout->box;
+        if(box.w > 0)
+        {
+            if(box.h <= 0)
+                box.h = FC_GetTextColumnHeight(layout->font, box.w, layout->text, layout->len);
+            return box;
+        }
+        return FC_GetTextBounds(layout->font, box.x, box.y, layout->effect.alignment, layout->effect.scale, layout->text, layout->len);
+    }
+
+    return layout->bounds;
+}
+
+SDL_Rect FC_DrawTextLayout(FC_TextLayout* layout, SDL_Renderer* dest)
+{
+    Uint8 useClip = 0;
+    SDL_Rect oldclip, newclip;
+    Uint8 clipToBox;
+
+    if(layout == nullptr)
+        return {0, 0, 0, 0};
+
+    FC_UpdateTextLayout(layout);
+
+    // Boxes with a height clip like FC_DrawTextBox()
+    clipToBox = (layout->box.w > 0 && layout->box.h > 0);
+    if(clipToBox)
+    {
+        useClip = has_clip(dest);
+        if(useClip)
+        {
+            oldclip = get_clip(dest);
+            newclip = SDL_RectIntersect(oldclip, layout->box);
+        }
+        else
+            newclip = layout->box;
+        set_clip(dest, &newclip);
+    }
+
+    if(layout->batched)
+    {
+        FC_TouchBatchLevels(layout->font, &layout->batch);
+        FC_SubmitBatch(layout->font, dest, &layout->batch);
+    }
+    else
+        layout->bounds = FC_RenderTextLayout(layout, dest, nullptr);
+
+    if(clipToBox)
+    {
+        if(useClip)
+            set_clip(dest, &oldclip);
+        else
+            set_clip(dest, nullptr);
+    }
+
+    return layout->bounds;
+}
+
+
 
-    return 1;
-}
+// Retained runs
 
+#define FC_RUN_CACHE_INITIAL_BUCKETS 64
 
-unsigned int FC_GetNumCodepoints(FC_Font* font)
+// Hashes what decides where a run's quads go, except for its position, which only moves them
+static Uint32 FC_HashRun(SDL_Rect box, FC_Effect effect, const char* text, int len)
 {
-    FC_Map* glyphs;
+    Uint32 hash = 2166136261u;
+    Uint32 values[5];
     int i;
-    unsigned int result = 0;
-    if(font == nullptr || font->glyphs == nullptr)
-        return 0;
 
-    glyphs = font->glyphs;
+    for(i = 0; i < len; ++i)
+        hash = (hash ^ (Uint8)text[i]) * 16777619u;
+
+    values[0] = (Uint32)box.w;
+    values[1] = (Uint32)box.h;
+    values[2] = (Uint32)effect.alignment;
+    memcpy(&values[3], &effect.scale.x, sizeof(Uint32));
+    memcpy(&values[4], &effect.scale.y, sizeof(Uint32));
+    for(i = 0; i < 5; ++i)
+        hash = (hash ^ values[i]) * 16777619u;
+    return hash;
+}
+
+static FC_RunCacheEntry* FC_FindRun(FC_RunCache* cache, Uint32 hash, SDL_Rect box, FC_Effect effect, const char* text, int len)
+{
+    FC_RunCacheEntry* entry;
+
+    if(cache->num_buckets == 0)
+        return nullptr;
 
-    for(i = 0; i < glyphs->num_buckets; ++i)
+    for(entry = cache->buckets[hash & (cache->num_buckets - 1)]; entry != nullptr; entry = entry->bucket_next)
     {
-        FC_MapNode* node;
-        for(node = glyphs->buckets[i]; node != nullptr; node = node->next)
-        {
-            result++;
-        }
+        FC_TextLayout* layout = entry->layout;
+        if(entry->hash == hash && layout->len == len && layout->box.w == box.w && layout->box.h == box.h
+           && layout->effect.alignment == effect.alignment && layout->effect.scale.x == effect.scale.x && layout->effect.scale.y == effect.scale.y
+           && memcmp(layout->text, text, len) == 0)
+            return entry;
     }
-
-    return result;
+    return nullptr;
 }
 
-void FC_GetCodepoints(FC_Font* font, Uint32* result)
+// Memory held by the run's layout: its text and quads
+static Uint32 FC_GetRunBytes(FC_TextLayout* layout)
 {
-    FC_Map* glyphs;
+    Uint32 bytes = sizeof(FC_RunCacheEntry) + sizeof(FC_TextLayout) + layout->len + 1;
     int i;
-    unsigned int count = 0;
-    if(font == nullptr || font->glyphs == nullptr)
-        return;
 
-    glyphs = font->glyphs;
+    bytes += layout->batch.num_levels * sizeof(FC_GlyphBatchLevel);
+    for(i = 0; i < layout->batch.num_levels; ++i)
+        bytes += layout->batch.levels[i].capacity * (4*sizeof(SDL_Vertex) + 6*sizeof(int));
+    return bytes;
+}
 
-    for(i = 0; i < glyphs->num_buckets; ++i)
-    {
-        FC_MapNode* node;
-        for(node = glyphs->buckets[i]; node != nullptr; node = node->next)
-        {
-            result[count] = node->key;
-            count++;
-        }
-    }
+static void FC_UnlinkRun(FC_RunCache* cache, FC_RunCacheEntry* entry)
+{
+    if(entry->newer != nullptr)
+        entry->newer->older = entry->older;
+    else
+        cache->newest = entry->older;
+
+    if(entry->older != nullptr)
+        entry->older->newer = entry->newer;
+    else
+        cache->oldest = entry->newer;
+
+    entry->newer = entry->older = nullptr;
 }
 
-Uint8 FC_GetGlyphData(FC_Font* font, FC_GlyphData* result, Uint32 codepoint)
+static void FC_PushRun(FC_RunCache* cache, FC_RunCacheEntry* entry)
 {
-    FC_GlyphData* e = FC_MapFind(font->glyphs, codepoint);
-    if(e == nullptr)
-    {
-        char buff[5];
-        int w, h;
-        SDL_Color white = {255, 255, 255, 255};
-        SDL_Surface* surf;
-        SDL_Texture* cache_image;
+    entry->newer = nullptr;
+    entry->older = cache->newest;
+    if(cache->newest != nullptr)
+        cache->newest->newer = entry;
+    else
+        cache->oldest = entry;
+    cache->newest = entry;
+}
 
-        if(font->ttf_source == nullptr)
-            return 0;
+static void FC_RemoveRun(FC_RunCache* cache, FC_RunCacheEntry* entry)
+{
+    FC_RunCacheEntry** link = &cache->buckets[entry->hash & (cache->num_buckets - 1)];
+    while(*link != entry)
+        link = &(*link)->bucket_next;
+    *link = entry->bucket_next;
 
-        FC_GetUTF8FromCodepoint(buff, codepoint);
+    FC_UnlinkRun(cache, entry);
+    cache->bytes -= entry->bytes;
+    --cache->num_entries;
 
-        cache_image = FC_GetGlyphCacheLevel(font, font->last_glyph.cache_level);
-        if(cache_image == nullptr)
-        {
-            SDL_Log("SDL_FontCache: Failed to load cache image, so cannot add new glyphs!\n");
-            return 0;
-        }
+    FC_FreeTextLayout(entry->layout);
+    free(entry);
+}
 
-        SDL_QueryTexture(cache_image, nullptr, nullptr, &w, &h);
+// Keeps the layout as the newest run.  Returns nullptr, and frees the layout, on failure.
+static FC_RunCacheEntry* FC_AddRun(FC_RunCache* cache, Uint32 hash, FC_TextLayout* layout)
+{
+    FC_RunCacheEntry* entry;
+    FC_RunCacheEntry** bucket;
 
-        surf = TTF_RenderUTF8_Blended(font->ttf_source, buff, white);
-        if(surf == nullptr)
-        {
-            return 0;
-        }
+    if(layout == nullptr || layout->text == nullptr)
+    {
+        FC_FreeTextLayout(layout);
+        return nullptr;
+    }
 
-        e = FC_PackGlyphData(font, codepoint, surf->w, w, h);
-        if(e == nullptr)
+    // Keep the chains short by growing once there is a run per bucket
+    if(cache->num_entries >= cache->num_buckets)
+    {
+        int new_num_buckets = (cache->num_buckets > 0? cache->num_buckets*2 : FC_RUN_CACHE_INITIAL_BUCKETS);
+        FC_RunCacheEntry** new_buckets = (FC_RunCacheEntry**)calloc(new_num_buckets, sizeof(FC_RunCacheEntry*));
+        if(new_buckets != nullptr)
         {
-            // Grow the cache
-            FC_GrowGlyphCache(font);
-
-            // Try packing again
-            e = FC_PackGlyphData(font, codepoint, surf->w, w, h);
-            if(e == nullptr)
+            int i;
+            for(i = 0; i < cache->num_buckets; ++i)
             {
-                SDL_FreeSurface(surf);
-                return 0;
+                FC_RunCacheEntry* e = cache->buckets[i];
+                while(e != nullptr)
+                {
+                    FC_RunCacheEntry* next = e->bucket_next;
+                    e->bucket_next = new_buckets[e->hash & (new_num_buckets - 1)];
+                    new_buckets[e->hash & (new_num_buckets - 1)] = e;
+                    e = next;
+                }
             }
+            free(cache->buckets);
+            cache->buckets = new_buckets;
+            cache->num_buckets = new_num_buckets;
+        }
+        else if(cache->num_buckets == 0)
+        {
+            FC_FreeTextLayout(layout);
+            return nullptr;
         }
+    }
 
-        // Render onto the cache texture
-        FC_AddGlyphToCache(font, surf);
+    entry = (FC_RunCacheEntry*)calloc(1, sizeof(FC_RunCacheEntry));
+    if(entry == nullptr)
+    {
+        FC_FreeTextLayout(layout);
+        return nullptr;
+    }
 
-        SDL_FreeSurface(surf);
+    entry->hash = hash;
+    entry->layout = layout;
+    bucket = &cache->buckets[hash & (cache->num_buckets - 1)];
+    entry->bucket_next = *bucket;
+    *bucket = entry;
+    FC_PushRun(cache, entry);
+    ++cache->num_entries;
+    return entry;
+}
+
+// Drops the least recently drawn runs until the cache fits its limit
+static void FC_TrimRunCache(FC_RunCache* cache)
+{
+    while(cache->oldest != nullptr && cache->bytes > cache->max_bytes)
+        FC_RemoveRun(cache, cache->oldest);
+}
+
+static void FC_FreeRunCache(FC_RunCache* cache)
+{
+    while(cache->oldest != nullptr)
+        FC_RemoveRun(cache, cache->oldest);
+
+    free(cache->buckets);
+    cache->buckets = nullptr;
+    cache->num_buckets = 0;
+}
+
+// Draws the text from the font's run cache, laying it out and keeping it there first if it isn't yet.
+// Returns 0 if the run cache can't be used, so the caller draws the text itself.
+static Uint8 FC_DrawCachedRun(FC_Font* font, SDL_Renderer* dest, SDL_Rect box, FC_Effect effect, const char* text, int len, SDL_Rect* result)
+{
+    FC_RunCache* cache = &font->run_cache;
+    FC_RunCacheEntry* entry;
+    FC_TextLayout* layout;
+    Uint32 hash;
+
+    // Runs are kept as batched quads on the font's own renderer.  Color runs aren't part of the key.
+    if(cache->max_bytes == 0 || font->num_runs > 0 || dest == nullptr || dest != font->renderer || !FC_CanBatch())
+        return 0;
+
+    hash = FC_HashRun(box, effect, text, len);
+    entry = FC_FindRun(cache, hash, box, effect, text, len);
+    if(entry != nullptr)
+    {
+        ++font->stats.run_cache_hits;
+        FC_SetTextLayoutBox(entry->layout, box);
+        FC_SetTextLayoutEffect(entry->layout, effect);
+        FC_UnlinkRun(cache, entry);
+        FC_PushRun(cache, entry);
+    }
+    else
+    {
+        ++font->stats.run_cache_misses;
+        entry = FC_AddRun(cache, hash, FC_CreateTextLayout(font, box, effect, text, len));
+        if(entry == nullptr)
+            return 0;
     }
 
-    if(result != nullptr && e != nullptr)
-        *result = *e;
+    // The layout rebuilds itself if the font's glyphs moved since it was kept
+    layout = entry->layout;
+    FC_UpdateTextLayout(layout);
+    cache->bytes -= entry->bytes;
+    entry->bytes = FC_GetRunBytes(layout);
+    cache->bytes += entry->bytes;
+
+    FC_TouchBatchLevels(font, &layout->batch);
+    FC_SubmitBatch(font, dest, &layout->batch);
+    *result = layout->bounds;
 
+    // A run bigger than the whole limit goes right after it is drawn
+    FC_TrimRunCache(cache);
     return 1;
 }
 
+void FC_SetRunCacheLimit(FC_Font* font, Uint32 max_bytes)
+{
+    if(font == nullptr)
+        return;
 
-FC_GlyphData* FC_SetGlyphData(FC_Font* font, Uint32 codepoint, FC_GlyphData glyph_data)
+    font->run_cache.max_bytes = max_bytes;
+    if(max_bytes == 0)
+        FC_FreeRunCache(&font->run_cache);
+    else
+        FC_TrimRunCache(&font->run_cache);
+}
+
+Uint32 FC_GetRunCacheLimit(FC_Font* font)
 {
-    return FC_MapInsert(font->glyphs, codepoint, glyph_data);
+    if(font == nullptr)
+        return 0;
+
+    return font->run_cache.max_bytes;
 }
 
 
 
-// Drawing
-static SDL_Rect FC_RenderLeft(FC_Font* font, SDL_Renderer* dest, int x, int y, FC_Scale scale, const char* text)
+// Editable layouts
+
+// One wrapped line of an edit layout.  The newline that ends a paragraph comes after the characters of its last line.
+typedef struct FC_EditLine
 {
-    const char* c = text;
-    SDL_Rect srcRect;
-    SDL_Rect dstRect;
-    SDL_Rect dirtyRect = {x, y, 0, 0};
+    int start;  // Byte offset into the text
+    int len;  // In bytes, not counting the newline
+    int first_char;  // Position of the line's first character
+    int num_chars;  // Not counting the newline
+    Uint8 ends_paragraph;  // A newline follows the line
+    int* prefix;  // Pen x in front of each character and after the last one, num_chars + 1 of them
+} FC_EditLine;
+
+typedef struct FC_EditLines
+{
+    int num_lines;
+    int lines_size;
+    FC_EditLine* lines;
+} FC_EditLines;
 
-    FC_GlyphData glyph;
-    Uint32 codepoint;
+struct FC_EditLayout
+{
+    FC_Font* font;
+    Uint32 font_generation;  // FC_GetFontGeneration() when the lines were measured
+    Uint8 dirty;  // The lines couldn't be kept up to date and have been dropped
+    int column_width;
 
-    float destX = x;
-    float destY = y;
-    float destH;
-    float destLineSpacing;
-    float destLetterSpacing;
+    char* text;
+    int len;
+    int size;  // Bytes allocated for 'text'
+    int num_chars;
 
-    if(font == nullptr)
-        return dirtyRect;
+    FC_EditLines lines;  // Sorted by position, covering the whole text
+};
 
-    destH = font->height * scale.y;
-    destLineSpacing = font->lineSpacing*scale.y;
-    destLetterSpacing = font->letterSpacing*scale.x;
+static void FC_ClearEditLines(FC_EditLines* lines)
+{
+    int i;
+    for(i = 0; i < lines->num_lines; ++i)
+        free(lines->lines[i].prefix);
+    lines->num_lines = 0;
+}
 
-    if(c == nullptr || font->glyph_cache_count == 0 || dest == nullptr)
-        return dirtyRect;
+static Uint8 FC_ReserveEditLines(FC_EditLines* lines, int num_lines)
+{
+    int new_size;
+    FC_EditLine* new_lines;
 
-    int newlineX = x;
+    if(num_lines <= lines->lines_size)
+        return 1;
 
-    for(; *c != '\0'; c++)
-    {
-        if(*c == '\n')
-        {
-            destX = newlineX;
-            destY += destH + destLineSpacing;
-            continue;
-        }
+    new_size = (lines->lines_size > 0? lines->lines_size : 16);
+    while(new_size < num_lines)
+        new_size *= 2;
 
-        codepoint = FC_GetCodepointFromUTF8(&c, 1);  // Increments 'c' to skip the extra UTF-8 bytes
-        if(!FC_GetGlyphData(font, &glyph, codepoint))
-        {
-            codepoint = ' ';
-            if(!FC_GetGlyphData(font, &glyph, codepoint))
-                continue;  // Skip bad characters
-        }
+    new_lines = (FC_EditLine*)realloc(lines->lines, new_size * sizeof(FC_EditLine));
+    if(new_lines == nullptr)
+        return 0;
 
-        if (codepoint == ' ')
-        {
-            destX += glyph.rect.w*scale.x + destLetterSpacing;
-            continue;
-        }
-        /*if(destX >= dest->w)
-            continue;
-        if(destY >= dest->h)
-            continue;*/
+    lines->lines = new_lines;
+    lines->lines_size = new_size;
+    return 1;
+}
 
-        srcRect = glyph.rect;
-    
-        dstRect = fc_render_callback(FC_GetGlyphCacheLevel(font, glyph.cache_level), &srcRect, dest, destX, destY, scale.x, scale.y);
-        if(dirtyRect.w == 0 || dirtyRect.h == 0)
-            dirtyRect = dstRect;
-        else
-            dirtyRect = SDL_RectUnion(dirtyRect, dstRect);
+// Fills in the line's character count and pen positions.  These step the same way FC_RenderLeft() moves the pen.
+static Uint8 FC_MeasureEditLine(FC_Font* font, const char* text, FC_EditLine* line)
+{
+    const char* c = text + line->start;
+    const char* end = c + line->len;
+    Uint32 prev = 0;
+    int x = 0;
+    int i;
 
-        destX += glyph.rect.w*scale.x + destLetterSpacing;
+    line->num_chars = FC_CountCharacters(c, line->len);
+    line->prefix = (int*)malloc((line->num_chars + 1) * sizeof(int));
+    if(line->prefix == nullptr)
+        return 0;
+
+    line->prefix[0] = 0;
+    for(i = 0; i < line->num_chars; ++i)
+    {
+        const char* next = FC_MIN(U8_next(c), end);
+        x += FC_GetLineWidth(font, c, next, &prev) + font->letterSpacing;
+        line->prefix[i + 1] = x;
+        c = next;
     }
 
-    return dirtyRect;
+    return 1;
 }
 
-static void set_color_for_all_caches(FC_Font* font, SDL_Color color)
+// Wraps the text from 'start' to 'end' into lines appended to 'result', numbering its characters from 'first_char'.
+// 'ends_paragraph' says whether a newline follows 'end'.
+static Uint8 FC_WrapEditText(FC_EditLayout* layout, int start, int end, int first_char, Uint8 ends_paragraph, FC_EditLines* result)
 {
-    // TODO: How can I predict which glyph caches are to be used?
-    SDL_Texture* img;
-    int i;
-    int num_levels = FC_GetNumCacheLevels(font);
-    for(i = 0; i < num_levels; ++i)
+    FC_LineWrap wrap;
+    const char* line;
+    int line_len;
+
+    FC_BeginLineWrap(&wrap, layout->font, layout->column_width, 0, layout->text + start, end - start);
+    while(FC_NextWrappedLine(&wrap, &line, &line_len))
     {
-        img = FC_GetGlyphCacheLevel(font, i);
-        set_color(img, color.r, color.g, color.b, FC_GET_ALPHA(color));
+        FC_EditLine* edit_line;
+
+        if(!FC_ReserveEditLines(result, result->num_lines + 1))
+            return 0;
+
+        edit_line = &result->lines[result->num_lines];
+        edit_line->start = line - layout->text;
+        edit_line->len = line_len;
+        edit_line->first_char = first_char;
+        // Lines that break softly pick up right where they end, even at a newline (trailing spaces that don't fit get an empty line before it)
+        edit_line->ends_paragraph = (wrap.pos == nullptr? ends_paragraph : wrap.pos != line + line_len);
+        if(!FC_MeasureEditLine(layout->font, layout->text, edit_line))
+            return 0;
+
+        ++result->num_lines;
+        first_char += edit_line->num_chars + edit_line->ends_paragraph;
     }
+
+    return 1;
 }
 
-SDL_Rect FC_Draw(FC_Font* font, SDL_Renderer* dest, int x, int y, const char* formatted_text, ...)
+static void FC_RebuildEditLayout(FC_EditLayout* layout)
 {
-    if(formatted_text == nullptr || font == nullptr)
-        return {x, y, 0, 0};
+    Uint64 start = SDL_GetPerformanceCounter();
+    Uint32 elapsed;
 
-    FC_EXTRACT_VARARGS(fc_buffer, formatted_text);
+    FC_ClearEditLines(&layout->lines);
+    layout->dirty = !FC_WrapEditText(layout, 0, layout->len, 0, 0, &layout->lines);
+    if(layout->dirty)
+    {
+        FC_ClearEditLines(&layout->lines);
+        SDL_Log("SDL_FontCache error: Could not allocate memory for the lines of an edit layout.\n");
+    }
+    layout->font_generation = FC_GetFontGeneration(layout->font);
 
-    set_color_for_all_caches(font, font->default_color);
+    elapsed = FC_GetMicroseconds(start);
+    if(FC_IsFontThread(layout->font))
+        layout->font->stats.layout_us += elapsed;
+    FC_NotifyStats(layout->font, FC_STATS_LAYOUT_BUILT, elapsed);
+}
 
-    return FC_RenderLeft(font, dest, x, y, {1,1}, fc_buffer);
+static void FC_UpdateEditLayout(FC_EditLayout* layout)
+{
+    if(layout->dirty || layout->font_generation != FC_GetFontGeneration(layout->font))
+        FC_RebuildEditLayout(layout);
 }
 
+// Returns the index of the line that the caret in front of 'position' is on
+static int FC_FindEditLine(FC_EditLayout* layout, int position)
+{
+    const FC_EditLine* lines = layout->lines.lines;
+    int low = 0;
+    int high = layout->lines.num_lines - 1;
+
+    while(low < high)
+    {
+        int mid = (low + high + 1)/2;
+        if(lines[mid].first_char <= position)
+            low = mid;
+        else
+            high = mid - 1;
+    }
 
+    return low;
+}
 
-typedef struct FC_StringList
+// Returns the byte offset of the character at 'position' and stores the index of its line in 'line_index'
+static int FC_GetEditLayoutByte(FC_EditLayout* layout, int position, int* line_index)
 {
-    char* value;
-    struct FC_StringList* next;
-} FC_StringList;
+    const char* c = layout->text;
+    const char* end = layout->text + layout->len;
+    int i = 0;
 
-void FC_StringListFree(FC_StringList* node)
-{
-    // Delete the nodes in order
-    while(node != nullptr)
+    *line_index = 0;
+    if(layout->lines.num_lines > 0)
     {
-        FC_StringList* last = node;
-        node = node->next;
+        const FC_EditLine* line;
 
-        free(last->value);
-        free(last);
+        *line_index = FC_FindEditLine(layout, position);
+        line = &layout->lines.lines[*line_index];
+        c += line->start;
+        end = c + line->len;
+        i = line->first_char;
     }
+
+    for(; i < position && c < end; ++i)
+        c = FC_MIN(U8_next(c), end);
+
+    return c - layout->text;
 }
 
-FC_StringList** FC_StringListPushBack(FC_StringList** node, char* value, Uint8 copy)
+// Re-wraps the paragraphs of lines first..last after an edit changed their text by 'byte_delta' bytes and 'char_delta'
+// characters, then moves the lines after them by as much.  The rest of the text keeps its lines.
+static void FC_RewrapEditLines(FC_EditLayout* layout, int first, int last, int byte_delta, int char_delta)
 {
-    if(node == nullptr)
+    Uint64 start_time = SDL_GetPerformanceCounter();
+    Uint32 elapsed;
+    FC_EditLines* lines = &layout->lines;
+    FC_EditLines wrapped = {0, 0, nullptr};
+    int start, end, num_lines, i;
+
+    if(lines->num_lines == 0 || layout->font_generation != FC_GetFontGeneration(layout->font))
     {
-        return nullptr;
+        FC_RebuildEditLayout(layout);
+        return;
     }
 
-    // Get to the last node
-    while(*node != nullptr)
+    while(first > 0 && !lines->lines[first - 1].ends_paragraph)
+        --first;
+    while(last < lines->num_lines - 1 && !lines->lines[last].ends_paragraph)
+        ++last;
+
+    start = lines->lines[first].start;
+    end = lines->lines[last].start + lines->lines[last].len + byte_delta;
+    num_lines = lines->num_lines - (last - first + 1);
+
+    if(!FC_WrapEditText(layout, start, end, lines->lines[first].first_char, lines->lines[last].ends_paragraph, &wrapped)
+       || !FC_ReserveEditLines(lines, num_lines + wrapped.num_lines))
     {
-        node = &(*node)->next;
+        FC_ClearEditLines(&wrapped);
+        free(wrapped.lines);
+        FC_RebuildEditLayout(layout);
+        return;
     }
 
-    *node = (FC_StringList*)malloc(sizeof(FC_StringList));
+    for(i = first; i <= last; ++i)
+        free(lines->lines[i].prefix);
+
+    memmove(lines->lines + first + wrapped.num_lines, lines->lines + last + 1, (lines->num_lines - last - 1) * sizeof(FC_EditLine));
+    memcpy(lines->lines + first, wrapped.lines, wrapped.num_lines * sizeof(FC_EditLine));
+    lines->num_lines = num_lines + wrapped.num_lines;
+    free(wrapped.lines);
+
+    for(i = first + wrapped.num_lines; i < lines->num_lines; ++i)
+    {
+        lines->lines[i].start += byte_delta;
+        lines->lines[i].first_char += char_delta;
+    }
 
-    (*node)->value = (copy? U8_strdup(value) : value);
-    (*node)->next = nullptr;
+    // Measuring new glyphs can add a cache level, which doesn't move anything that was measured
+    layout->font_generation = FC_GetFontGeneration(layout->font);
 
-    return node;
+    elapsed = FC_GetMicroseconds(start_time);
+    if(FC_IsFontThread(layout->font))
+        layout->font->stats.layout_us += elapsed;
+    FC_NotifyStats(layout->font, FC_STATS_LAYOUT_BUILT, elapsed);
 }
 
-FC_StringList** FC_StringListPushBackBytes(FC_StringList** node, const char* data, int num_bytes)
+FC_EditLayout* FC_CreateEditLayout(FC_Font* font, int column_width, const char* text, int len)
 {
-    if(node == nullptr)
+    FC_EditLayout* layout;
+
+    if(font == nullptr)
+        return nullptr;
+
+    if(text == nullptr)
+        len = 0;
+    else if(len < 0)
+        len = strlen(text);
+
+    layout = (FC_EditLayout*)calloc(1, sizeof(FC_EditLayout));
+    if(layout == nullptr)
+        return nullptr;
+
+    layout->size = len + 1;
+    layout->text = (char*)malloc(layout->size);
+    if(layout->text == nullptr)
     {
-        return node;
+        free(layout);
+        return nullptr;
     }
 
-    // Get to the last node
-    while(*node != nullptr)
+    if(len > 0)
+        memcpy(layout->text, text, len);
+    layout->text[len] = '\0';
+    layout->len = len;
+    layout->num_chars = FC_CountCharacters(layout->text, len);
+
+    layout->font = font;
+    layout->column_width = FC_MAX(column_width, 0);
+    FC_RebuildEditLayout(layout);
+
+    return layout;
+}
+
+void FC_FreeEditLayout(FC_EditLayout* layout)
+{
+    if(layout == nullptr)
+        return;
+
+    FC_ClearEditLines(&layout->lines);
+    free(layout->lines.lines);
+    free(layout->text);
+    free(layout);
+}
+
+Uint8 FC_EditLayoutInsert(FC_EditLayout* layout, int position, const char* text, int len)
+{
+    int byte, line, num_chars;
+
+    if(layout == nullptr || text == nullptr)
+        return 0;
+
+    if(len < 0)
+        len = strlen(text);
+    if(position == -1)
+        position = layout->num_chars;
+
+    if(position < 0 || position > layout->num_chars)
+        return 0;
+    if(len == 0)
+        return 1;
+
+    if(layout->len + len + 1 > layout->size)
     {
-        node = &(*node)->next;
+        int new_size = FC_MAX(layout->size * 2, layout->len + len + 1);
+        char* new_text = (char*)realloc(layout->text, new_size);
+        if(new_text == nullptr)
+            return 0;
+
+        layout->text = new_text;
+        layout->size = new_size;
     }
 
-    *node = (FC_StringList*)malloc(sizeof(FC_StringList));
+    byte = FC_GetEditLayoutByte(layout, position, &line);
+    num_chars = FC_CountCharacters(text, len);
 
-    (*node)->value = (char*)malloc(num_bytes + 1);
-    memcpy((*node)->value, data, num_bytes);
-    (*node)->value[num_bytes] = '\0';
-    (*node)->next = nullptr;
+    memmove(layout->text + byte + len, layout->text + byte, layout->len - byte + 1);
+    memcpy(layout->text + byte, text, len);
+    layout->len += len;
+    layout->num_chars += num_chars;
 
-    return node;
+    FC_RewrapEditLines(layout, line, line, len, num_chars);
+    return 1;
 }
 
-static FC_StringList* FC_Explode(const char* text, char delimiter)
+void FC_EditLayoutDelete(FC_EditLayout* layout, int position, int count)
 {
-    FC_StringList* head;
-    FC_StringList* new_node;
-    FC_StringList** node;
-    const char* start;
-    const char* end;
-    unsigned int size;
-    if(text == nullptr)
-        return nullptr;
+    int byte, end_byte, first, last;
 
-    head = nullptr;
-    node = &head;
+    if(layout == nullptr || position < 0 || position >= layout->num_chars || count <= 0)
+        return;
 
-    // Doesn't technically support UTF-8, but it's probably fine, right?
-    size = 0;
-    start = end = text;
-    while(1)
-    {
-        if(*end == delimiter || *end == '\0')
-        {
-            *node = (FC_StringList*)malloc(sizeof(FC_StringList));
-            new_node = *node;
+    count = FC_MIN(count, layout->num_chars - position);
+    byte = FC_GetEditLayoutByte(layout, position, &first);
+    end_byte = FC_GetEditLayoutByte(layout, position + count, &last);
 
-            new_node->value = (char*)malloc(size + 1);
-            memcpy(new_node->value, start, size);
-            new_node->value[size] = '\0';
+    memmove(layout->text + byte, layout->text + end_byte, layout->len - end_byte + 1);
+    layout->len -= end_byte - byte;
+    layout->num_chars -= count;
 
-            new_node->next = nullptr;
+    FC_RewrapEditLines(layout, first, last, byte - end_byte, -count);
+}
 
-            if(*end == '\0')
-                break;
+void FC_SetEditLayoutWidth(FC_EditLayout* layout, int column_width)
+{
+    if(layout == nullptr)
+        return;
 
-            node = &((*node)->next);
-            start = end+1;
-            size = 0;
-        }
-        else
-            ++size;
+    layout->column_width = FC_MAX(column_width, 0);
+    FC_RebuildEditLayout(layout);
+}
 
-        ++end;
-    }
+const char* FC_GetEditLayoutText(FC_EditLayout* layout)
+{
+    return (layout != nullptr? layout->text : nullptr);
+}
 
-    return head;
+int FC_GetEditLayoutLength(FC_EditLayout* layout)
+{
+    return (layout != nullptr? layout->num_chars : 0);
 }
 
-static FC_StringList* FC_ExplodeBreakingSpace(const char* text, FC_StringList** spaces)
+int FC_GetEditLayoutNumLines(FC_EditLayout* layout)
 {
-    FC_StringList* head;
-    FC_StringList** node;
-    const char* start;
-    const char* end;
-    unsigned int size;
-    if(text == nullptr)
-        return nullptr;
+    if(layout == nullptr)
+        return 0;
 
-    head = nullptr;
-    node = &head;
+    FC_UpdateEditLayout(layout);
+    return layout->lines.num_lines;
+}
 
-    // Warning: spaces must not be initialized before this function
-    *spaces = nullptr;
+// Distance from one line's top to the next, the same as FC_GetHeight() puts between lines
+static int FC_GetEditLinePitch(FC_EditLayout* layout)
+{
+    return layout->font->height + layout->font->lineSpacing;
+}
 
-    // Doesn't technically support UTF-8, but it's probably fine, right?
-    size = 0;
-    start = end = text;
-    while(1)
-    {
-        // Add any characters here that should make separate words (except for \n?)
-        if(*end == ' ' || *end == '\t' || *end == '\0')
-        {
-            FC_StringListPushBackBytes(node, start, size);
-            FC_StringListPushBackBytes(spaces, end, 1);
+SDL_Rect FC_GetEditLayoutCharacterOffset(FC_EditLayout* layout, int position)
+{
+    SDL_Rect result = {0, 0, 1, 0};
+    const FC_EditLine* line;
+    int line_index;
 
-            if(*end == '\0')
-                break;
+    if(layout == nullptr)
+        return result;
 
-            node = &((*node)->next);
-            start = end+1;
-            size = 0;
-        }
-        else
-            ++size;
+    result.h = FC_GetLineHeight(layout->font);
+    FC_UpdateEditLayout(layout);
+    if(layout->lines.num_lines == 0)
+        return result;
 
-        ++end;
-    }
+    position = FC_MAX(0, FC_MIN(position, layout->num_chars));
+    line_index = FC_FindEditLine(layout, position);
+    line = &layout->lines.lines[line_index];
 
-    return head;
+    result.x = line->prefix[FC_MIN(position - line->first_char, line->num_chars)];
+    result.y = line_index * FC_GetEditLinePitch(layout);
+    return result;
 }
 
-static FC_StringList* FC_ExplodeAndKeep(const char* text, char delimiter)
+int FC_GetEditLayoutPositionFromOffset(FC_EditLayout* layout, int x, int y)
 {
-    FC_StringList* head;
-    FC_StringList** node;
-    const char* start;
-    const char* end;
-    unsigned int size;
-    if(text == nullptr)
-        return nullptr;
+    const FC_EditLine* line;
+    int line_pitch, line_index;
+    int low, high, last;
 
-    head = nullptr;
-    node = &head;
+    if(layout == nullptr)
+        return 0;
 
-    // Doesn't technically support UTF-8, but it's probably fine, right?
-    size = 0;
-    start = end = text;
-    while(1)
-    {
-        if(*end == delimiter || *end == '\0')
-        {
-            FC_StringListPushBackBytes(node, start, size);
+    FC_UpdateEditLayout(layout);
+    if(layout->lines.num_lines == 0)
+        return 0;
 
-            if(*end == '\0')
-                break;
+    line_pitch = FC_GetEditLinePitch(layout);
+    line_index = (y > 0 && line_pitch > 0? y / line_pitch : 0);
+    line_index = FC_MIN(line_index, layout->lines.num_lines - 1);
+    line = &layout->lines.lines[line_index];
 
-            node = &((*node)->next);
-            start = end;
-            size = 1;
-        }
-        else
-            ++size;
+    // A caret after the last character of a wrapped line would show up at the start of the next one
+    last = line->num_chars;
+    if(!line->ends_paragraph && line_index < layout->lines.num_lines - 1 && last > 0)
+        --last;
 
-        ++end;
+    // Find the last character edge at or left of x, then take whichever edge of that character is closer
+    low = 0;
+    high = last;
+    while(low < high)
+    {
+        int mid = (low + high + 1)/2;
+        if(line->prefix[mid] <= x)
+            low = mid;
+        else
+            high = mid - 1;
     }
+    if(low < last && line->prefix[low + 1] - x < x - line->prefix[low])
+        ++low;
 
-    return head;
+    return line->first_char + low;
 }
 
-static void FC_RenderAlign(FC_Font* font, SDL_Renderer* dest, int x, int y, int width, FC_Scale scale, FC_AlignEnum align, const char* text)
+SDL_Rect FC_DrawEditLayout(FC_EditLayout* layout, SDL_Renderer* dest, int x, int y, SDL_Color color)
 {
-    switch(align)
-    {
-        case FC_ALIGN_LEFT:
-            FC_RenderLeft(font, dest, x, y, scale, text);
-            break;
-        case FC_ALIGN_CENTER:
-            FC_RenderCenter(font, dest, x + width/2, y, scale, text);
-            break;
-        case FC_ALIGN_RIGHT:
-            FC_RenderRight(font, dest, x + width, y, scale, text);
-            break;
-    }
-}
+    SDL_Rect result = {x, y, 0, 0};
+    SDL_Rect visible;
+    FC_GlyphBatch* batch;
+    FC_Font* font;
+    int line_pitch, i;
 
-static FC_StringList* FC_GetBufferFitToColumn(FC_Font* font, int width, FC_Scale scale, Uint8 keep_newlines)
-{
-    FC_StringList* result = nullptr;
-    FC_StringList** current = &result;
+    if(layout == nullptr)
+        return result;
 
-    FC_StringList *ls, *iter;
+    FC_UpdateEditLayout(layout);
+    font = layout->font;
+    line_pitch = FC_GetEditLinePitch(layout);
+    visible = get_visible_rect(dest);
 
-    ls = (keep_newlines? FC_ExplodeAndKeep(fc_buffer, '\n') : FC_Explode(fc_buffer, '\n'));
-    for(iter = ls; iter != nullptr; iter = iter->next)
+    // Lines are evenly spaced, so the first visible one is found without going through the ones above it
+    i = (line_pitch > 0 && visible.y > y + font->height? (visible.y - y - font->height) / line_pitch + 1 : 0);
+    batch = FC_BeginBatch(font, color);
+    for(; i < layout->lines.num_lines; ++i)
     {
-        char* line = iter->value;
-
-        // If line is too long, then add words one at a time until we go over.
-        if(width > 0 && FC_GetWidth(font, "%s", line) > width)
-        {
-            FC_StringList *words, *word_iter, *spaces, *spaces_iter;
+        const FC_EditLine* line = &layout->lines.lines[i];
+        int line_y = y + i * line_pitch;
+        if(line_y >= visible.y + visible.h)
+            break;
 
-            words = FC_ExplodeBreakingSpace(line, &spaces);
-            // Skip the first word for the iterator, so there will always be at least one word per line
-            line = new_concat(words->value, spaces->value);
-            for(word_iter = words->next, spaces_iter = spaces->next; word_iter != nullptr && spaces_iter != nullptr; word_iter = word_iter->next, spaces_iter = spaces_iter->next)
-            {
-                char* line_plus_word = new_concat(line, word_iter->value);
-                char* word_plus_space = new_concat(word_iter->value, spaces_iter->value);
-                if(FC_GetWidth(font, "%s", line_plus_word) > width)
-                {
-                    current = FC_StringListPushBack(current, line, 0);
+        FC_RenderLeft(font, dest, batch, &visible, x, line_y, {1,1}, layout->text + line->start, line->len);
+    }
+    FC_SubmitBatch(font, dest, batch);
 
-                    line = word_plus_space;
-                }
-                else
-                {
-                    replace_concat(&line, word_plus_space);
-                    free(word_plus_space);
-                }
-                free(line_plus_word);
-            }
-            current = FC_StringListPushBack(current, line, 0);
-            FC_StringListFree(words);
-            FC_StringListFree(spaces);
-        }
-        else
-        {
-            current = FC_StringListPushBack(current, line, 0);
-            iter->value = nullptr;
-        }
+    for(i = 0; i < layout->lines.num_lines; ++i)
+    {
+        const FC_EditLine* line = &layout->lines.lines[i];
+        result.w = FC_MAX(result.w, line->prefix[line->num_chars]);
     }
-    FC_StringListFree(ls);
+    if(layout->lines.num_lines > 0)
+        result.h = layout->lines.num_lines * line_pitch - font->lineSpacing;
 
     return result;
 }
 
-static void FC_DrawColumnFromBuffer(FC_Font* font, SDL_Renderer* dest, SDL_Rect box, int* total_height, FC_Scale scale, FC_AlignEnum align)
-{
-    int y = box.y;
-    FC_StringList *ls, *iter;
 
-    ls = FC_GetBufferFitToColumn(font, box.w, scale, 0);
-    for(iter = ls; iter != nullptr; iter = iter->next)
-    {
-        FC_RenderAlign(font, dest, box.x, y, box.w, scale, align, iter->value);
-        y += FC_GetLineHeight(font);
-    }
-    FC_StringListFree(ls);
 
-    if(total_height != nullptr)
-        *total_height = y - box.y;
-}
+// Draw lists
 
-SDL_Rect FC_DrawBox(FC_Font* font, SDL_Renderer* dest, SDL_Rect box, const char* formatted_text, ...)
+typedef struct FC_DrawOp
 {
-    Uint8 useClip;
-    if(formatted_text == nullptr || font == nullptr)
-        return {box.x, box.y, 0, 0};
+    FC_Font* font;
+    Uint8 boxed;  // Drawn like FC_DrawTextBox(), otherwise like FC_DrawTextEffect() at box.x, box.y
+    SDL_Rect box;
+    FC_Effect effect;
+    int text_offset;  // Into the list's text, which moves when it grows
+    int len;
+} FC_DrawOp;
+
+struct FC_DrawList
+{
+    int num_ops;
+    int ops_size;
+    FC_DrawOp* ops;
+
+    int text_len;
+    int text_size;
+    char* text;
+
+    // Reused by every replay
+    FC_GlyphBatch batch;
+    int marks_size;
+    int* marks;
+};
 
-    FC_EXTRACT_VARARGS(fc_buffer, formatted_text);
+FC_DrawList* FC_CreateDrawList(void)
+{
+    return (FC_DrawList*)calloc(1, sizeof(FC_DrawList));
+}
 
-    useClip = has_clip(dest);
-    SDL_Rect oldclip, newclip;
-    if(useClip)
-    {
-        oldclip = get_clip(dest);
-        newclip = SDL_RectIntersect(oldclip, box);
-    }
-    else
-        newclip = box;
+void FC_FreeDrawList(FC_DrawList* list)
+{
+    if(list == nullptr)
+        return;
 
-    set_clip(dest, &newclip);
+    free(list->ops);
+    free(list->text);
+    FC_FreeBatch(&list->batch);
+    free(list->marks);
+    free(list);
+}
 
-    set_color_for_all_caches(font, font->default_color);
+void FC_ClearDrawList(FC_DrawList* list)
+{
+    if(list == nullptr)
+        return;
 
-    FC_DrawColumnFromBuffer(font, dest, box, nullptr, {1,1}, FC_ALIGN_LEFT);
+    list->num_ops = 0;
+    list->text_len = 0;
+}
 
-    if(useClip)
-        set_clip(dest, &oldclip);
-    else
-        set_clip(dest, nullptr);
+int FC_GetDrawListCount(FC_DrawList* list)
+{
+    if(list == nullptr)
+        return 0;
 
-    return box;
+    return list->num_ops;
 }
 
-SDL_Rect FC_DrawBoxAlign(FC_Font* font, SDL_Renderer* dest, SDL_Rect box, FC_AlignEnum align, const char* formatted_text, ...)
+// Copies the text into the list.  Nothing here reads the font, so lists can be recorded on any thread.
+static Uint8 FC_AddDrawOp(FC_DrawList* list, FC_Font* font, Uint8 boxed, SDL_Rect box, FC_Effect effect, const char* text, int len)
 {
-    Uint8 useClip;
-    if(formatted_text == nullptr || font == nullptr)
-        return {box.x, box.y, 0, 0};
+    FC_DrawOp* op;
 
-    FC_EXTRACT_VARARGS(fc_buffer, formatted_text);
+    if(list == nullptr || font == nullptr || text == nullptr)
+        return 0;
 
-    useClip = has_clip(dest);
-    SDL_Rect oldclip, newclip;
-    if(useClip)
+    if(len < 0)
+        len = strlen(text);
+
+    if(list->num_ops == list->ops_size)
     {
-        oldclip = get_clip(dest);
-        newclip = SDL_RectIntersect(oldclip, box);
+        int new_size = (list->ops_size > 0? list->ops_size*2 : 16);
+        FC_DrawOp* new_ops = (FC_DrawOp*)realloc(list->ops, new_size * sizeof(FC_DrawOp));
+        if(new_ops == nullptr)
+            return 0;
+        list->ops = new_ops;
+        list->ops_size = new_size;
     }
-    else
-        newclip = box;
-    set_clip(dest, &newclip);
 
-    set_color_for_all_caches(font, font->default_color);
+    if(list->text_len + len > list->text_size)
+    {
+        int new_size = (list->text_size > 0? list->text_size*2 : 256);
+        char* new_text;
+        while(new_size < list->text_len + len)
+            new_size *= 2;
+        new_text = (char*)realloc(list->text, new_size);
+        if(new_text == nullptr)
+            return 0;
+        list->text = new_text;
+        list->text_size = new_size;
+    }
 
-    FC_DrawColumnFromBuffer(font, dest, box, nullptr, {1,1}, align);
+    op = &list->ops[list->num_ops++];
+    op->font = font;
+    op->boxed = boxed;
+    op->box = box;
+    op->effect = effect;
+    op->text_offset = list->text_len;
+    op->len = len;
 
-    if(useClip)
-        set_clip(dest, &oldclip);
-    else
-        set_clip(dest, nullptr);
+    memcpy(list->text + list->text_len, text, len);
+    list->text_len += len;
+    return 1;
+}
 
-    return box;
+Uint8 FC_DrawListAddText(FC_DrawList* list, FC_Font* font, int x, int y, FC_Effect effect, const char* text, int len)
+{
+    return FC_AddDrawOp(list, font, 0, {x, y, 0, 0}, effect, text, len);
 }
 
-SDL_Rect FC_DrawBoxScale(FC_Font* font, SDL_Renderer* dest, SDL_Rect box, FC_Scale scale, const char* formatted_text, ...)
+Uint8 FC_DrawListAddTextBox(FC_DrawList* list, FC_Font* font, SDL_Rect box, FC_Effect effect, const char* text, int len)
 {
-    Uint8 useClip;
-    if(formatted_text == nullptr || font == nullptr)
-        return {box.x, box.y, 0, 0};
+    return FC_AddDrawOp(list, font, 1, box, effect, text, len);
+}
 
-    FC_EXTRACT_VARARGS(fc_buffer, formatted_text);
+// Cuts the quads added to each batch level since its mark down to 'clip', and drops the ones outside of it.
+// This stands in for the clip rect FC_DrawTextBox() sets, so boxes can share a submission.  Batched glyphs
+// are axis-aligned quads with x0 <= x1 and y0 <= y1, so their texture coordinates are cut in proportion.
+static void FC_ClipBatchQuads(FC_GlyphBatch* batch, const int* marks, int num_marks, SDL_Rect clip)
+{
+    float left = clip.x;
+    float top = clip.y;
+    float right = clip.x + clip.w;
+    float bottom = clip.y + clip.h;
+    int i, j;
 
-    useClip = has_clip(dest);
-    SDL_Rect oldclip, newclip;
-    if(useClip)
+    for(i = 0; i < batch->num_levels; ++i)
     {
-        oldclip = get_clip(dest);
-        newclip = SDL_RectIntersect(oldclip, box);
-    }
-    else
-        newclip = box;
-    set_clip(dest, &newclip);
+        FC_GlyphBatchLevel* level = &batch->levels[i];
+        int kept = (i < num_marks? marks[i] : 0);
 
-    set_color_for_all_caches(font, font->default_color);
+        for(j = kept; j < level->num_vertices; j += 4)
+        {
+            SDL_Vertex* v = &level->vertices[j];
+            SDL_Vertex* out = &level->vertices[kept];
+            float x0 = v[0].position.x, x1 = v[2].position.x;
+            float y0 = v[0].position.y, y1 = v[2].position.y;
+            float cx0 = FC_MAX(x0, left), cx1 = FC_MIN(x1, right);
+            float cy0 = FC_MAX(y0, top), cy1 = FC_MIN(y1, bottom);
+            float u0 = v[0].tex_coord.x, u1 = v[2].tex_coord.x;
+            float v0 = v[0].tex_coord.y, v1 = v[2].tex_coord.y;
+            int* n;
+
+            if(cx0 >= cx1 || cy0 >= cy1)
+                continue;
 
-    FC_DrawColumnFromBuffer(font, dest, box, nullptr, scale, FC_ALIGN_LEFT);
+            if(x1 > x0)
+            {
+                float du = (u1 - u0) / (x1 - x0);
+                u1 = u0 + (cx1 - x0)*du;
+                u0 = u0 + (cx0 - x0)*du;
+            }
+            if(y1 > y0)
+            {
+                float dv = (v1 - v0) / (y1 - y0);
+                v1 = v0 + (cy1 - y0)*dv;
+                v0 = v0 + (cy0 - y0)*dv;
+            }
 
-    if(useClip)
-        set_clip(dest, &oldclip);
-    else
-        set_clip(dest, nullptr);
+            if(out != v)
+                memcpy(out, v, 4 * sizeof(SDL_Vertex));
+            out[0].position.x = cx0;  out[0].position.y = cy0;  out[0].tex_coord.x = u0;  out[0].tex_coord.y = v0;
+            out[1].position.x = cx1;  out[1].position.y = cy0;  out[1].tex_coord.x = u1;  out[1].tex_coord.y = v0;
+            out[2].position.x = cx1;  out[2].position.y = cy1;  out[2].tex_coord.x = u1;  out[2].tex_coord.y = v1;
+            out[3].position.x = cx0;  out[3].position.y = cy1;  out[3].tex_coord.x = u0;  out[3].tex_coord.y = v1;
+
+            n = &level->indices[kept/4*6];
+            n[0] = kept;
+            n[1] = kept + 1;
+            n[2] = kept + 2;
+            n[3] = kept;
+            n[4] = kept + 2;
+            n[5] = kept + 3;
+            kept += 4;
+        }
 
-    return box;
+        level->num_vertices = kept;
+        level->num_indices = kept/4*6;
+    }
 }
 
-SDL_Rect FC_DrawBoxColor(FC_Font* font, SDL_Renderer* dest, SDL_Rect box, SDL_Color color, const char* formatted_text, ...)
+// Adds the op's glyphs to the list's batch
+static void FC_BatchDrawOp(FC_DrawList* list, SDL_Renderer* dest, const FC_DrawOp* op, SDL_Rect visible)
 {
-    Uint8 useClip;
-    if(formatted_text == nullptr || font == nullptr)
-        return {box.x, box.y, 0, 0};
-
-    FC_EXTRACT_VARARGS(fc_buffer, formatted_text);
+    FC_GlyphBatch* batch = &list->batch;
+    const char* text = list->text + op->text_offset;
+    int num_marks = batch->num_levels;
+    int i;
 
-    useClip = has_clip(dest);
-    SDL_Rect oldclip, newclip;
-    if(useClip)
+    batch->color = op->effect.color;
+    if(!op->boxed)
     {
-        oldclip = get_clip(dest);
-        newclip = SDL_RectIntersect(oldclip, box);
+        FC_RenderAlign(op->font, dest, batch, &visible, op->box.x, op->box.y, 0, op->effect.scale, op->effect.alignment, text, op->len);
+        return;
     }
-    else
-        newclip = box;
-    set_clip(dest, &newclip);
 
-    set_color_for_all_caches(font, color);
-
-    FC_DrawColumnFromBuffer(font, dest, box, nullptr, {1,1}, FC_ALIGN_LEFT);
+    visible = SDL_RectIntersect(visible, op->box);
+    if(visible.w <= 0 || visible.h <= 0)
+        return;
 
-    if(useClip)
-        set_clip(dest, &oldclip);
-    else
-        set_clip(dest, nullptr);
+    // Remember where the box's quads start, so only they are clipped
+    if(list->marks_size < num_marks)
+    {
+        int* new_marks = (int*)realloc(list->marks, num_marks * sizeof(int));
+        if(new_marks == nullptr)
+            return;
+        list->marks = new_marks;
+        list->marks_size = num_marks;
+    }
+    for(i = 0; i < num_marks; ++i)
+        list->marks[i] = batch->levels[i].num_vertices;
 
-    return box;
+    FC_RenderColumn(op->font, dest, batch, &visible, op->box, nullptr, op->effect.scale, op->effect.alignment, text, op->len);
+    FC_ClipBatchQuads(batch, list->marks, num_marks, visible);
 }
 
-SDL_Rect FC_DrawBoxEffect(FC_Font* font, SDL_Renderer* dest, SDL_Rect box, FC_Effect effect, const char* formatted_text, ...)
+void FC_RenderDrawList(FC_DrawList* list, SDL_Renderer* dest)
 {
-    Uint8 useClip;
-    if(formatted_text == nullptr || font == nullptr)
-        return {box.x, box.y, 0, 0};
+    SDL_Rect visible;
+    int i;
 
-    FC_EXTRACT_VARARGS(fc_buffer, formatted_text);
+    if(list == nullptr || dest == nullptr)
+        return;
 
-    useClip = has_clip(dest);
-    SDL_Rect oldclip, newclip;
-    if(useClip)
+    // The render callback has to see each op drawn the usual way
+    if(!FC_CanBatch())
     {
-        oldclip = get_clip(dest);
-        newclip = SDL_RectIntersect(oldclip, box);
+        for(i = 0; i < list->num_ops; ++i)
+        {
+            const FC_DrawOp* op = &list->ops[i];
+            if(op->boxed)
+                FC_DrawTextBox(op->font, dest, op->box, op->effect, list->text + op->text_offset, op->len);
+            else
+                FC_DrawTextEffect(op->font, dest, op->box.x, op->box.y, op->effect, list->text + op->text_offset, op->len);
+        }
+        return;
     }
-    else
-        newclip = box;
-    set_clip(dest, &newclip);
 
-    set_color_for_all_caches(font, effect.color);
+    // Consecutive ops with the same font go in one batch.  Glyph misses are rendered while it fills and
+    // uploaded together by FC_SubmitBatch(), then each cache level it used is drawn with one call.
+    visible = get_visible_rect(dest);
+    i = 0;
+    while(i < list->num_ops)
+    {
+        FC_Font* font = list->ops[i].font;
+        FC_ResetBatch(&list->batch);
+        for(; i < list->num_ops && list->ops[i].font == font; ++i)
+            FC_BatchDrawOp(list, dest, &list->ops[i], visible);
+        FC_SubmitBatch(font, dest, &list->batch);
+    }
+}
 
-    FC_DrawColumnFromBuffer(font, dest, box, nullptr, effect.scale, effect.alignment);
 
-    if(useClip)
-        set_clip(dest, &oldclip);
-    else
-        set_clip(dest, nullptr);
 
-    return box;
-}
+// Variadic drawing
 
-SDL_Rect FC_DrawColumn(FC_Font* font, SDL_Renderer* dest, int x, int y, Uint16 width, const char* formatted_text, ...)
+SDL_Rect FC_Draw(FC_Font* font, SDL_Renderer* dest, int x, int y, const char* formatted_text, ...)
 {
-    SDL_Rect box = {x, y, width, 0};
-    int total_height;
-
-    if(formatted_text == nullptr || font == nullptr)
+    char* buffer;
+    if(formatted_text == nullptr || font == nullptr || (buffer = FC_GetFormatBuffer()) == nullptr)
         return {x, y, 0, 0};
 
-    FC_EXTRACT_VARARGS(fc_buffer, formatted_text);
+    FC_EXTRACT_VARARGS(buffer, formatted_text);
 
-    set_color_for_all_caches(font, font->default_color);
-
-    FC_DrawColumnFromBuffer(font, dest, box, &total_height, {1,1}, FC_ALIGN_LEFT);
-
-    return {box.x, box.y, width, total_height};
+    return FC_DrawTextEffect(font, dest, x, y, FC_MakeEffect(FC_ALIGN_LEFT, {1,1}, font->default_color), buffer, -1);
 }
 
-SDL_Rect FC_DrawColumnAlign(FC_Font* font, SDL_Renderer* dest, int x, int y, Uint16 width, FC_AlignEnum align, const char* formatted_text, ...)
+SDL_Rect FC_DrawAlign(FC_Font* font, SDL_Renderer* dest, int x, int y, FC_AlignEnum align, const char* formatted_text, ...)
 {
-    SDL_Rect box = {x, y, width, 0};
-    int total_height;
-
-    if(formatted_text == nullptr || font == nullptr)
+    char* buffer;
+    if(formatted_text == nullptr || font == nullptr || (buffer = FC_GetFormatBuffer()) == nullptr)
         return {x, y, 0, 0};
 
-    FC_EXTRACT_VARARGS(fc_buffer, formatted_text);
-
-    set_color_for_all_caches(font, font->default_color);
-
-    switch(align)
-    {
-    case FC_ALIGN_CENTER:
-        box.x -= width/2;
-        break;
-    case FC_ALIGN_RIGHT:
-        box.x -= width;
-        break;
-    default:
-        break;
-    }
-
-    FC_DrawColumnFromBuffer(font, dest, box, &total_height, {1,1}, align);
+    FC_EXTRACT_VARARGS(buffer, formatted_text);
 
-    return {box.x, box.y, width, total_height};
+    return FC_DrawTextEffect(font, dest, x, y, FC_MakeEffect(align, {1,1}, font->default_color), buffer, -1);
 }
 
-SDL_Rect FC_DrawColumnScale(FC_Font* font, SDL_Renderer* dest, int x, int y, Uint16 width, FC_Scale scale, const char* formatted_text, ...)
+SDL_Rect FC_DrawScale(FC_Font* font, SDL_Renderer* dest, int x, int y, FC_Scale scale, const char* formatted_text, ...)
 {
-    SDL_Rect box = {x, y, width, 0};
-    int total_height;
-
-    if(formatted_text == nullptr || font == nullptr)
+    char* buffer;
+    if(formatted_text == nullptr || font == nullptr || (buffer = FC_GetFormatBuffer()) == nullptr)
         return {x, y, 0, 0};
 
-    FC_EXTRACT_VARARGS(fc_buffer, formatted_text);
+    FC_EXTRACT_VARARGS(buffer, formatted_text);
 
-    set_color_for_all_caches(font, font->default_color);
-
-    FC_DrawColumnFromBuffer(font, dest, box, &total_height, scale, FC_ALIGN_LEFT);
-
-    return {box.x, box.y, width, total_height};
+    return FC_DrawTextEffect(font, dest, x, y, FC_MakeEffect(FC_ALIGN_LEFT, scale, font->default_color), buffer, -1);
 }
 
-SDL_Rect FC_DrawColumnColor(FC_Font* font, SDL_Renderer* dest, int x, int y, Uint16 width, SDL_Color color, const char* formatted_text, ...)
+SDL_Rect FC_DrawColor(FC_Font* font, SDL_Renderer* dest, int x, int y, SDL_Color color, const char* formatted_text, ...)
 {
-    SDL_Rect box = {x, y, width, 0};
-    int total_height;
-
-    if(formatted_text == nullptr || font == nullptr)
+    char* buffer;
+    if(formatted_text == nullptr || font == nullptr || (buffer = FC_GetFormatBuffer()) == nullptr)
         return {x, y, 0, 0};
 
-    FC_EXTRACT_VARARGS(fc_buffer, formatted_text);
+    FC_EXTRACT_VARARGS(buffer, formatted_text);
 
-    set_color_for_all_caches(font, color);
-
-    FC_DrawColumnFromBuffer(font, dest, box, &total_height, {1,1}, FC_ALIGN_LEFT);
-
-    return {box.x, box.y, width, total_height};
+    return FC_DrawTextEffect(font, dest, x, y, FC_MakeEffect(FC_ALIGN_LEFT, {1,1}, color), buffer, -1);
 }
 
-SDL_Rect FC_DrawColumnEffect(FC_Font* font, SDL_Renderer* dest, int x, int y, Uint16 width, FC_Effect effect, const char* formatted_text, ...)
-{
-    SDL_Rect box = {x, y, width, 0};
-    int total_height;
-
-    if(formatted_text == nullptr || font == nullptr)
+SDL_Rect FC_DrawEffect(FC_Font* font, SDL_Renderer* dest, int x, int y, FC_Effect effect, const char* formatted_text, ...)
+{
+    char* buffer;
+    if(formatted_text == nullptr || font == nullptr || (buffer = FC_GetFormatBuffer()) == nullptr)
         return {x, y, 0, 0};
 
-    FC_EXTRACT_VARARGS(fc_buffer, formatted_text);
+    FC_EXTRACT_VARARGS(buffer, formatted_text);
 
-    set_color_for_all_caches(font, effect.color);
+    return FC_DrawTextEffect(font, dest, x, y, effect, buffer, -1);
+}
 
-    switch(effect.alignment)
-    {
-    case FC_ALIGN_CENTER:
-        box.x -= width/2;
-        break;
-    case FC_ALIGN_RIGHT:
-        box.x -= width;
-        break;
-    default:
-        break;
-    }
+SDL_Rect FC_DrawBox(FC_Font* font, SDL_Renderer* dest, SDL_Rect box, const char* formatted_text, ...)
+{
+    char* buffer;
+    if(formatted_text == nullptr || font == nullptr || (buffer = FC_GetFormatBuffer()) == nullptr)
+        return {box.x, box.y, 0, 0};
 
-    FC_DrawColumnFromBuffer(font, dest, box, &total_height, effect.scale, effect.alignment);
+    FC_EXTRACT_VARARGS(buffer, formatted_text);
 
-    return {box.x, box.y, width, total_height};
+    return FC_DrawTextBox(font, dest, box, FC_MakeEffect(FC_ALIGN_LEFT, {1,1}, font->default_color), buffer, -1);
 }
 
-static SDL_Rect FC_RenderCenter(FC_Font* font, SDL_Renderer* dest, int x, int y, FC_Scale scale, const char* text)
+SDL_Rect FC_DrawBoxAlign(FC_Font* font, SDL_Renderer* dest, SDL_Rect box, FC_AlignEnum align, const char* formatted_text, ...)
 {
-    SDL_Rect result = {x, y, 0, 0};
-    if(text == nullptr || font == nullptr)
-        return result;
-
-    char* str = U8_strdup(text);
-    char* del = str;
-    char* c;
-
-    // Go through str, when you find a \n, replace it with \0 and print it
-    // then move down, back, and continue.
-    for(c = str; *c != '\0';)
-    {
-        if(*c == '\n')
-        {
-            *c = '\0';
-            result = SDL_RectUnion(FC_RenderLeft(font, dest, x - scale.x*FC_GetWidth(font, "%s", str)/2, y, scale, str), result);
-            *c = '\n';
-            c++;
-            str = c;
-            y += scale.y*font->height;
-        }
-        else
-            c++;
-    }
+    char* buffer;
+    if(formatted_text == nullptr || font == nullptr || (buffer = FC_GetFormatBuffer()) == nullptr)
+        return {box.x, box.y, 0, 0};
 
-    result = SDL_RectUnion(FC_RenderLeft(font, dest, x - scale.x*FC_GetWidth(font, "%s", str)/2, y, scale, str), result);
+    FC_EXTRACT_VARARGS(buffer, formatted_text);
 
-    free(del);
-    return result;
+    return FC_DrawTextBox(font, dest, box, FC_MakeEffect(align, {1,1}, font->default_color), buffer, -1);
 }
 
-static SDL_Rect FC_RenderRight(FC_Font* font, SDL_Renderer* dest, int x, int y, FC_Scale scale, const char* text)
+SDL_Rect FC_DrawBoxScale(FC_Font* font, SDL_Renderer* dest, SDL_Rect box, FC_Scale scale, const char* formatted_text, ...)
 {
-    SDL_Rect result = {x, y, 0, 0};
-    if(text == nullptr || font == nullptr)
-        return result;
+    char* buffer;
+    if(formatted_text == nullptr || font == nullptr || (buffer = FC_GetFormatBuffer()) == nullptr)
+        return {box.x, box.y, 0, 0};
 
-    char* str = U8_strdup(text);
-    char* del = str;
-    char* c;
+    FC_EXTRACT_VARARGS(buffer, formatted_text);
 
-    for(c = str; *c != '\0';)
-    {
-        if(*c == '\n')
-        {
-            *c = '\0';
-            result = SDL_RectUnion(FC_RenderLeft(font, dest, x - scale.x*FC_GetWidth(font, "%s", str), y, scale, str), result);
-            *c = '\n';
-            c++;
-            str = c;
-            y += scale.y*font->height;
-        }
-        else
-            c++;
-    }
+    return FC_DrawTextBox(font, dest, box, FC_MakeEffect(FC_ALIGN_LEFT, scale, font->default_color), buffer, -1);
+}
+
+SDL_Rect FC_DrawBoxColor(FC_Font* font, SDL_Renderer* dest, SDL_Rect box, SDL_Color color, const char* formatted_text, ...)
+{
+    char* buffer;
+    if(formatted_text == nullptr || font == nullptr || (buffer = FC_GetFormatBuffer()) == nullptr)
+        return {box.x, box.y, 0, 0};
 
-    result = SDL_RectUnion(FC_RenderLeft(font, dest, x - scale.x*FC_GetWidth(font, "%s", str), y, scale, str), result);
+    FC_EXTRACT_VARARGS(buffer, formatted_text);
 
-    free(del);
-    return result;
+    return FC_DrawTextBox(font, dest, box, FC_MakeEffect(FC_ALIGN_LEFT, {1,1}, color), buffer, -1);
 }
 
+SDL_Rect FC_DrawBoxEffect(FC_Font* font, SDL_Renderer* dest, SDL_Rect box, FC_Effect effect, const char* formatted_text, ...)
+{
+    char* buffer;
+    if(formatted_text == nullptr || font == nullptr || (buffer = FC_GetFormatBuffer()) == nullptr)
+        return {box.x, box.y, 0, 0};
+
+    FC_EXTRACT_VARARGS(buffer, formatted_text);
 
+    return FC_DrawTextBox(font, dest, box, effect, buffer, -1);
+}
 
-SDL_Rect FC_DrawScale(FC_Font* font, SDL_Renderer* dest, int x, int y, FC_Scale scale, const char* formatted_text, ...)
+SDL_Rect FC_DrawColumn(FC_Font* font, SDL_Renderer* dest, int x, int y, Uint16 width, const char* formatted_text, ...)
 {
-    if(formatted_text == nullptr || font == nullptr)
+    char* buffer;
+    if(formatted_text == nullptr || font == nullptr || (buffer = FC_GetFormatBuffer()) == nullptr)
         return {x, y, 0, 0};
 
-    FC_EXTRACT_VARARGS(fc_buffer, formatted_text);
+    FC_EXTRACT_VARARGS(buffer, formatted_text);
 
-    set_color_for_all_caches(font, font->default_color);
-
-    return FC_RenderLeft(font, dest, x, y, scale, fc_buffer);
+    return FC_DrawTextColumn(font, dest, x, y, width, FC_MakeEffect(FC_ALIGN_LEFT, {1,1}, font->default_color), buffer, -1);
 }
 
-SDL_Rect FC_DrawAlign(FC_Font* font, SDL_Renderer* dest, int x, int y, FC_AlignEnum align, const char* formatted_text, ...)
+SDL_Rect FC_DrawColumnAlign(FC_Font* font, SDL_Renderer* dest, int x, int y, Uint16 width, FC_AlignEnum align, const char* formatted_text, ...)
 {
-    if(formatted_text == nullptr || font == nullptr)
+    char* buffer;
+    if(formatted_text == nullptr || font == nullptr || (buffer = FC_GetFormatBuffer()) == nullptr)
         return {x, y, 0, 0};
 
-    FC_EXTRACT_VARARGS(fc_buffer, formatted_text);
-
-    set_color_for_all_caches(font, font->default_color);
-
-    SDL_Rect result;
-    switch(align)
-    {
-        case FC_ALIGN_LEFT:
-            result = FC_RenderLeft(font, dest, x, y, {1,1}, fc_buffer);
-            break;
-        case FC_ALIGN_CENTER:
-            result = FC_RenderCenter(font, dest, x, y, {1,1}, fc_buffer);
-            break;
-        case FC_ALIGN_RIGHT:
-            result = FC_RenderRight(font, dest, x, y, {1,1}, fc_buffer);
-            break;
-        default:
-            result = {x, y, 0, 0};
-            break;
-    }
+    FC_EXTRACT_VARARGS(buffer, formatted_text);
 
-    return result;
+    return FC_DrawTextColumn(font, dest, x, y, width, FC_MakeEffect(align, {1,1}, font->default_color), buffer, -1);
 }
 
-SDL_Rect FC_DrawColor(FC_Font* font, SDL_Renderer* dest, int x, int y, SDL_Color color, const char* formatted_text, ...)
+SDL_Rect FC_DrawColumnScale(FC_Font* font, SDL_Renderer* dest, int x, int y, Uint16 width, FC_Scale scale, const char* formatted_text, ...)
 {
-    if(formatted_text == nullptr || font == nullptr)
+    char* buffer;
+    if(formatted_text == nullptr || font == nullptr || (buffer = FC_GetFormatBuffer()) == nullptr)
         return {x, y, 0, 0};
 
-    FC_EXTRACT_VARARGS(fc_buffer, formatted_text);
+    FC_EXTRACT_VARARGS(buffer, formatted_text);
 
-    set_color_for_all_caches(font, color);
-
-    return FC_RenderLeft(font, dest, x, y, {1,1}, fc_buffer);
+    return FC_DrawTextColumn(font, dest, x, y, width, FC_MakeEffect(FC_ALIGN_LEFT, scale, font->default_color), buffer, -1);
 }
 
-
-SDL_Rect FC_DrawEffect(FC_Font* font, SDL_Renderer* dest, int x, int y, FC_Effect effect, const char* formatted_text, ...)
+SDL_Rect FC_DrawColumnColor(FC_Font* font, SDL_Renderer* dest, int x, int y, Uint16 width, SDL_Color color, const char* formatted_text, ...)
 {
-    if(formatted_text == nullptr || font == nullptr)
+    char* buffer;
+    if(formatted_text == nullptr || font == nullptr || (buffer = FC_GetFormatBuffer()) == nullptr)
         return {x, y, 0, 0};
 
-    FC_EXTRACT_VARARGS(fc_buffer, formatted_text);
+    FC_EXTRACT_VARARGS(buffer, formatted_text);
 
-    set_color_for_all_caches(font, effect.color);
+    return FC_DrawTextColumn(font, dest, x, y, width, FC_MakeEffect(FC_ALIGN_LEFT, {1,1}, color), buffer, -1);
+}
 
-    SDL_Rect result;
-    switch(effect.alignment)
-    {
-        case FC_ALIGN_LEFT:
-            result = FC_RenderLeft(font, dest, x, y, effect.scale, fc_buffer);
-            break;
-        case FC_ALIGN_CENTER:
-            result = FC_RenderCenter(font, dest, x, y, effect.scale, fc_buffer);
-            break;
-        case FC_ALIGN_RIGHT:
-            result = FC_RenderRight(font, dest, x, y, effect.scale, fc_buffer);
-            break;
-        default:
-            result = {x, y, 0, 0};
-            break;
-    }
+SDL_Rect FC_DrawColumnEffect(FC_Font* font, SDL_Renderer* dest, int x, int y, Uint16 width, FC_Effect effect, const char* formatted_text, ...)
+{
+    char* buffer;
+    if(formatted_text == nullptr || font == nullptr || (buffer = FC_GetFormatBuffer()) == nullptr)
+        return {x, y, 0, 0};
 
-    return result;
+    FC_EXTRACT_VARARGS(buffer, formatted_text);
+
+    return FC_DrawTextColumn(font, dest, x, y, width, effect, buffer, -1);
 }
 
 
@@ -2230,7 +7000,7 @@ FC_FilterEnum FC_GetFilterMode(FC_Font* font)
     if(font == nullptr)
         return FC_FILTER_NEAREST;
 
-    return font->filter;
+    return FC_GetCacheOwner(font)->filter;
 }
 
 Uint16 FC_GetLineHeight(FC_Font* font)
@@ -2241,87 +7011,113 @@ Uint16 FC_GetLineHeight(FC_Font* font)
     return font->height;
 }
 
-Uint16 FC_GetHeight(FC_Font* font, const char* formatted_text, ...)
+Uint16 FC_GetTextHeight(FC_Font* font, const char* text, int len)
 {
-    if(formatted_text == nullptr || font == nullptr)
+    if(text == nullptr || font == nullptr)
         return 0;
 
-    FC_EXTRACT_VARARGS(fc_buffer, formatted_text);
+    if(len < 0)
+        len = strlen(text);
 
     Uint16 numLines = 1;
-    const char* c;
+    const char* c = text;
+    const char* end = text + len;
 
-    for (c = fc_buffer; *c != '\0'; c++)
+    while((c = (const char*)memchr(c, '\n', end - c)) != nullptr)
     {
-        if(*c == '\n')
-            numLines++;
+        numLines++;
+        c++;
     }
 
     //   Actual height of letter region + line spacing
     return font->height*numLines + font->lineSpacing*(numLines - 1);  //height*numLines;
 }
 
-Uint16 FC_GetWidth(FC_Font* font, const char* formatted_text, ...)
+Uint16 FC_GetHeight(FC_Font* font, const char* formatted_text, ...)
 {
-    if(formatted_text == nullptr || font == nullptr)
+    char* buffer;
+    if(formatted_text == nullptr || font == nullptr || (buffer = FC_GetFormatBuffer()) == nullptr)
         return 0;
 
-    FC_EXTRACT_VARARGS(fc_buffer, formatted_text);
+    FC_EXTRACT_VARARGS(buffer, formatted_text);
 
-    const char* c;
-    Uint16 width = 0;
-    Uint16 bigWidth = 0;  // Allows for multi-line strings
+    return FC_GetTextHeight(font, buffer, -1);
+}
+
+Uint16 FC_GetTextWidth(FC_Font* font, const char* text, int len)
+{
+    if(text == nullptr || font == nullptr)
+        return 0;
+
+    if(len < 0)
+        len = strlen(text);
+
+    const char* c = text;
+    const char* end = text + len;
+    int bigWidth = 0;  // Allows for multi-line strings
 
-    for (c = fc_buffer; *c != '\0'; c++)
+    while(1)
     {
-        if(*c == '\n')
-        {
-            bigWidth = bigWidth >= width? bigWidth : width;
-            width = 0;
-            continue;
-        }
+        const char* line_end = (const char*)memchr(c, '\n', end - c);
+        Uint32 prev = 0;
+        int width;
 
-        FC_GlyphData glyph;
-        Uint32 codepoint = FC_GetCodepointFromUTF8(&c, 1);
-        if(FC_GetGlyphData(font, &glyph, codepoint) || FC_GetGlyphData(font, &glyph, ' '))
-            width += glyph.rect.w;
+        if(line_end == nullptr)
+            line_end = end;
+
+        width = FC_GetLineWidth(font, c, line_end, &prev);
+        bigWidth = bigWidth >= width? bigWidth : width;
+
+        if(line_end == end)
+            break;
+        c = line_end + 1;
     }
-    bigWidth = bigWidth >= width? bigWidth : width;
 
     return bigWidth;
 }
 
+Uint16 FC_GetWidth(FC_Font* font, const char* formatted_text, ...)
+{
+    char* buffer;
+    if(formatted_text == nullptr || font == nullptr || (buffer = FC_GetFormatBuffer()) == nullptr)
+        return 0;
+
+    FC_EXTRACT_VARARGS(buffer, formatted_text);
+
+    return FC_GetTextWidth(font, buffer, -1);
+}
+
 // If width == -1, use no width limit
-SDL_Rect FC_GetCharacterOffset(FC_Font* font, Uint16 position_index, int column_width, const char* formatted_text, ...)
+SDL_Rect FC_GetTextCharacterOffset(FC_Font* font, Uint16 position_index, int column_width, const char* text, int len)
 {
     SDL_Rect result = {0, 0, 1, FC_GetLineHeight(font)};
-    FC_StringList *ls, *iter;
+    FC_LineWrap wrap;
+    const char* line;
+    int line_len;
     int num_lines = 0;
     Uint8 done = 0;
 
-    if(formatted_text == nullptr || column_width == 0 || position_index == 0 || font == nullptr)
+    if(text == nullptr || column_width == 0 || position_index == 0 || font == nullptr)
         return result;
 
-    FC_EXTRACT_VARARGS(fc_buffer, formatted_text);
+    if(len < 0)
+        len = strlen(text);
 
-    ls = FC_GetBufferFitToColumn(font, column_width, {1,1}, 1);
-    for(iter = ls; iter != nullptr;)
+    FC_BeginLineWrap(&wrap, font, column_width, 1, text, len);
+    while(FC_NextWrappedLine(&wrap, &line, &line_len))
     {
-        char* line;
-        int i = 0;
-        FC_StringList* next_iter = iter->next;
+        const char* c;
+        const char* line_end = line + line_len;
 
         ++num_lines;
-        for(line = iter->value; line != nullptr && *line != '\0'; line = (char*)U8_next(line))
+        for(c = line; c < line_end; c = U8_next(c))
         {
-            ++i;
             --position_index;
             if(position_index == 0)
             {
                 // FIXME: Doesn't handle box-wrapped newlines correctly
-                line = (char*)U8_next(line);
-                line[0] = '\0';
-                result.x = FC_GetWidth(font, "%s", iter->value);
+                c = U8_next(c);
+                result.x = FC_GetTextWidth(font, line, FC_MIN(c, line_end) - line);
                 done = 1;
                 break;
             }
@@ -2330,11 +7126,9 @@ SDL_Rect FC_GetCharacterOffset(FC_Font* font, Uint16 position_index, int column_
             break;
 
         // Prevent line wrapping if there are no more lines
-        if(next_iter == nullptr && !done)
-            result.x = FC_GetWidth(font, "%s", iter->value);
-        iter = next_iter;
+        if(wrap.pos == nullptr)
+            result.x = FC_GetTextWidth(font, line, line_len);
     }
-    FC_StringListFree(ls);
 
     if(num_lines > 1)
     {
@@ -2344,117 +7138,171 @@ SDL_Rect FC_GetCharacterOffset(FC_Font* font, Uint16 position_index, int column_
     return result;
 }
 
+SDL_Rect FC_GetCharacterOffset(FC_Font* font, Uint16 position_index, int column_width, const char* formatted_text, ...)
+{
+    char* buffer;
+    if(formatted_text == nullptr || column_width == 0 || position_index == 0 || font == nullptr || (buffer = FC_GetFormatBuffer()) == nullptr)
+    {
+        SDL_Rect result = {0, 0, 1, FC_GetLineHeight(font)};
+        return result;
+    }
+
+    FC_EXTRACT_VARARGS(buffer, formatted_text);
 
-Uint16 FC_GetColumnHeight(FC_Font* font, Uint16 width, const char* formatted_text, ...)
+    return FC_GetTextCharacterOffset(font, position_index, column_width, buffer, -1);
+}
+
+
+Uint16 FC_GetTextColumnHeight(FC_Font* font, Uint16 width, const char* text, int len)
 {
     int y = 0;
-
-    FC_StringList *ls, *iter;
+    FC_LineWrap wrap;
+    const char* line;
+    int line_len;
 
     if(font == nullptr)
         return 0;
 
-    if(formatted_text == nullptr || width == 0)
+    if(text == nullptr || width == 0)
         return font->height;
 
-    FC_EXTRACT_VARARGS(fc_buffer, formatted_text);
+    if(len < 0)
+        len = strlen(text);
 
-    ls = FC_GetBufferFitToColumn(font, width, {1,1}, 0);
-    for(iter = ls; iter != nullptr; iter = iter->next)
+    Uint64 start = SDL_GetPerformanceCounter();
+    FC_BeginLineWrap(&wrap, font, width, 0, text, len);
+    while(FC_NextWrappedLine(&wrap, &line, &line_len))
     {
         y += FC_GetLineHeight(font);
     }
-    FC_StringListFree(ls);
+    if(FC_IsFontThread(font))
+        font->stats.layout_us += FC_GetMicroseconds(start);
 
     return y;
 }
 
+Uint16 FC_GetColumnHeight(FC_Font* font, Uint16 width, const char* formatted_text, ...)
+{
+    char* buffer;
+    if(font == nullptr)
+        return 0;
+
+    if(formatted_text == nullptr || width == 0 || (buffer = FC_GetFormatBuffer()) == nullptr)
+        return font->height;
+
+    FC_EXTRACT_VARARGS(buffer, formatted_text);
+
+    return FC_GetTextColumnHeight(font, width, buffer, -1);
+}
+
 static int FC_GetAscentFromCodepoint(FC_Font* font, Uint32 codepoint)
 {
     FC_GlyphData glyph;
 
-    if(font == nullptr)
+    if(font == nullptr || !FC_GetGlyphData(font, &glyph, codepoint))
         return 0;
 
-    // FIXME: Store ascent so we can return it here
-    FC_GetGlyphData(font, &glyph, codepoint);
-    return glyph.rect.h;
+    return glyph.metrics.maxy;
 }
 
 static int FC_GetDescentFromCodepoint(FC_Font* font, Uint32 codepoint)
 {
     FC_GlyphData glyph;
 
-    if(font == nullptr)
+    if(font == nullptr || !FC_GetGlyphData(font, &glyph, codepoint))
         return 0;
 
-    // FIXME: Store descent so we can return it here
-    FC_GetGlyphData(font, &glyph, codepoint);
-    return glyph.rect.h;
+    return -glyph.metrics.miny;
 }
 
-int FC_GetAscent(FC_Font* font, const char* formatted_text, ...)
+int FC_GetTextAscent(FC_Font* font, const char* text, int len)
 {
     Uint32 codepoint;
     int max, ascent;
-    const char* c;
+    FC_TextScan scan;
 
     if(font == nullptr)
         return 0;
 
-    if(formatted_text == nullptr)
+    if(text == nullptr)
         return font->ascent;
 
-    FC_EXTRACT_VARARGS(fc_buffer, formatted_text);
+    if(len < 0)
+        len = strlen(text);
 
     max = 0;
-    c = fc_buffer;
-
-    while(*c != '\0')
+    FC_BeginTextScan(&scan, text, text + len);
+    while(scan.c < scan.end)
     {
-        codepoint = FC_GetCodepointFromUTF8(&c, 1);
+        codepoint = FC_NextCodepoint(&scan);
         if(codepoint != 0)
         {
             ascent = FC_GetAscentFromCodepoint(font, codepoint);
             if(ascent > max)
                 max = ascent;
         }
-        ++c;
     }
     return max;
 }
 
-int FC_GetDescent(FC_Font* font, const char* formatted_text, ...)
+int FC_GetAscent(FC_Font* font, const char* formatted_text, ...)
+{
+    char* buffer;
+    if(font == nullptr)
+        return 0;
+
+    if(formatted_text == nullptr || (buffer = FC_GetFormatBuffer()) == nullptr)
+        return font->ascent;
+
+    FC_EXTRACT_VARARGS(buffer, formatted_text);
+
+    return FC_GetTextAscent(font, buffer, -1);
+}
+
+int FC_GetTextDescent(FC_Font* font, const char* text, int len)
 {
     Uint32 codepoint;
     int max, descent;
-    const char* c;
+    FC_TextScan scan;
 
     if(font == nullptr)
         return 0;
 
-    if(formatted_text == nullptr)
+    if(text == nullptr)
         return font->descent;
 
-    FC_EXTRACT_VARARGS(fc_buffer, formatted_text);
+    if(len < 0)
+        len = strlen(text);
 
     max = 0;
-    c = fc_buffer;
-
-    while(*c != '\0')
+    FC_BeginTextScan(&scan, text, text + len);
+    while(scan.c < scan.end)
     {
-        codepoint = FC_GetCodepointFromUTF8(&c, 1);
+        codepoint = FC_NextCodepoint(&scan);
         if(codepoint != 0)
         {
             descent = FC_GetDescentFromCodepoint(font, codepoint);
             if(descent > max)
                 max = descent;
         }
-        ++c;
     }
     return max;
 }
 
+int FC_GetDescent(FC_Font* font, const char* formatted_text, ...)
+{
+    char* buffer;
+    if(font == nullptr)
+        return 0;
+
+    if(formatted_text == nullptr || (buffer = FC_GetFormatBuffer()) == nullptr)
+        return font->descent;
+
+    FC_EXTRACT_VARARGS(buffer, formatted_text);
+
+    return FC_GetTextDescent(font, buffer, -1);
+}
+
 int FC_GetBaseline(FC_Font* font)
 {
     if(font == nullptr)
@@ -2498,48 +7346,155 @@ SDL_Color FC_GetDefaultColor(FC_Font* font)
     return font->default_color;
 }
 
-SDL_Rect FC_GetBounds(FC_Font* font, int x, int y, FC_AlignEnum align, FC_Scale scale, const char* formatted_text, ...)
+// FC_GetTextWidth() and FC_GetTextHeight() of the text, found in one pass over it.  With 'cached_only' the font is only
+// read: glyphs and kerning pairs that aren't cached are measured as a space and no kerning, and make this return 0.
+static Uint8 FC_MeasureText(FC_Font* font, const char* text, int len, Uint8 cached_only, Uint16* width, Uint16* height)
 {
-    SDL_Rect result = {x, y, 0, 0};
+    FC_TextScan scan;
+    Uint32 prev = 0;
+    int line_width = 0;
+    int max_width = 0;
+    int num_lines = 1;
+    Uint8 complete = 1;
+
+    FC_BeginTextScan(&scan, text, text + len);
+    while(scan.c < scan.end)
+    {
+        const FC_GlyphData* glyph;
+        Uint32 codepoint = FC_NextCodepoint(&scan);
+        int kerning;
 
-    if(formatted_text == nullptr)
-        return result;
+        if(codepoint == '\n')
+        {
+            max_width = FC_MAX(max_width, line_width);
+            line_width = 0;
+            ++num_lines;
+            prev = 0;
+            continue;
+        }
+
+        if(!cached_only)
+        {
+            glyph = FC_LookupGlyphOrSpace(font, &codepoint);
+            if(glyph == nullptr)
+                continue;
+            kerning = FC_GetKerning(font, prev, codepoint);
+        }
+        else
+        {
+            glyph = FC_MapFind(font->glyphs, codepoint);
+            if(glyph == nullptr)
+            {
+                complete = 0;
+                codepoint = ' ';
+                glyph = FC_MapFind(font->glyphs, ' ');
+                if(glyph == nullptr)
+                    continue;
+            }
+            if(!FC_PeekKerning(font, prev, codepoint, &kerning))
+                complete = 0;
+        }
+
+        line_width += kerning + glyph->rect.w;
+        prev = codepoint;
+    }
+
+    *width = FC_MAX(max_width, line_width);
+    *height = font->height*num_lines + font->lineSpacing*(num_lines - 1);
+    return complete;
+}
+
+static Uint8 FC_MeasureTextBounds(FC_Font* font, int x, int y, FC_AlignEnum align, FC_Scale scale, const char* text, int len, Uint8 cached_only, SDL_Rect* result)
+{
+    Uint16 width = 0;
+    Uint16 height = 0;
+    Uint8 complete;
+
+    *result = {x, y, 0, 0};
+    if(text == nullptr || font == nullptr)
+        return 1;
 
-    // Create a temp buffer while GetWidth and GetHeight use fc_buffer.
-    char* temp = (char*)malloc(fc_buffer_size);
-    FC_EXTRACT_VARARGS(temp, formatted_text);
+    if(len < 0)
+        len = strlen(text);
 
-    result.w = FC_GetWidth(font, "%s", temp) * scale.x;
-    result.h = FC_GetHeight(font, "%s", temp) * scale.y;
+    complete = FC_MeasureText(font, text, len, cached_only, &width, &height);
+    result->w = width * scale.x;
+    result->h = height * scale.y;
 
     switch(align)
     {
         case FC_ALIGN_LEFT:
             break;
         case FC_ALIGN_CENTER:
-            result.x -= result.w/2;
+            result->x -= result->w/2;
             break;
         case FC_ALIGN_RIGHT:
-            result.x -= result.w;
+            result->x -= result->w;
             break;
         default:
             break;
     }
 
-    free(temp);
+    return complete;
+}
+
+void FC_GetTextBoundsBatch(FC_Font* font, int x, int y, FC_AlignEnum align, FC_Scale scale, const FC_TextSpan* spans, int count, SDL_Rect* results)
+{
+    int i;
+    if(spans == nullptr || results == nullptr)
+        return;
+
+    for(i = 0; i < count; ++i)
+        FC_MeasureTextBounds(font, x, y, align, scale, spans[i].text, spans[i].len, 0, &results[i]);
+}
+
+Uint8 FC_GetCachedTextBoundsBatch(FC_Font* font, int x, int y, FC_AlignEnum align, FC_Scale scale, const FC_TextSpan* spans, int count, SDL_Rect* results)
+{
+    Uint8 complete = 1;
+    int i;
+    if(spans == nullptr || results == nullptr)
+        return 0;
+
+    for(i = 0; i < count; ++i)
+    {
+        if(!FC_MeasureTextBounds(font, x, y, align, scale, spans[i].text, spans[i].len, 1, &results[i]))
+            complete = 0;
+    }
+    return complete;
+}
 
+SDL_Rect FC_GetTextBounds(FC_Font* font, int x, int y, FC_AlignEnum align, FC_Scale scale, const char* text, int len)
+{
+    SDL_Rect result;
+    FC_MeasureTextBounds(font, x, y, align, scale, text, len, 0, &result);
     return result;
 }
 
+SDL_Rect FC_GetBounds(FC_Font* font, int x, int y, FC_AlignEnum align, FC_Scale scale, const char* formatted_text, ...)
+{
+    char* buffer;
+    if(formatted_text == nullptr || (buffer = FC_GetFormatBuffer()) == nullptr)
+    {
+        SDL_Rect result = {x, y, 0, 0};
+        return result;
+    }
+
+    FC_EXTRACT_VARARGS(buffer, formatted_text);
+
+    return FC_GetTextBounds(font, x, y, align, scale, buffer, -1);
+}
+
 Uint8 FC_InRect(int x, int y, SDL_Rect input_rect)
 {
     return (input_rect.x <= x && x <= input_rect.x + input_rect.w && input_rect.y <= y && y <= input_rect.y + input_rect.h);
 }
 
 // TODO: Make it work with alignment
-Uint16 FC_GetPositionFromOffset(FC_Font* font, int x, int y, int column_width, FC_AlignEnum align, const char* formatted_text, ...)
+Uint16 FC_GetTextPositionFromOffset(FC_Font* font, int x, int y, int column_width, FC_AlignEnum align, const char* text, int len)
 {
-    FC_StringList *ls, *iter;
+    FC_LineWrap wrap;
+    const char* line;
+    int line_len;
     Uint8 done = 0;
     int height = FC_GetLineHeight(font);
     Uint16 position = 0;
@@ -2547,20 +7502,26 @@ Uint16 FC_GetPositionFromOffset(FC_Font* font, int x, int y, int column_width, F
     int current_y = 0;
     FC_GlyphData glyph_data;
 
-    if(formatted_text == nullptr || column_width == 0 || font == nullptr)
+    if(text == nullptr || column_width == 0 || font == nullptr)
         return 0;
 
-    FC_EXTRACT_VARARGS(fc_buffer, formatted_text);
+    if(len < 0)
+        len = strlen(text);
 
-    ls = FC_GetBufferFitToColumn(font, column_width, {1,1}, 1);
-    for(iter = ls; iter != nullptr; iter = iter->next)
+    FC_BeginLineWrap(&wrap, font, column_width, 1, text, len);
+    while(FC_NextWrappedLine(&wrap, &line, &line_len))
     {
-        char* line;
+        const char* c;
+        const char* line_end = line + line_len;
+        Uint32 prev = 0;
 
-        for(line = iter->value; line != nullptr && *line != '\0'; line = (char*)U8_next(line))
+        for(c = line; c < line_end; c = U8_next(c))
         {
-            if(FC_GetGlyphData(font, &glyph_data, FC_GetCodepointFromUTF8((const char**)&line, 0)))
+            Uint32 codepoint = FC_GetCodepointFromUTF8(&c, 0);
+            if(FC_GetGlyphData(font, &glyph_data, codepoint))
             {
+                current_x += FC_GetKerning(font, prev, codepoint);
+                prev = codepoint;
                 if(FC_InRect(x, y, {current_x, current_y, glyph_data.rect.w, glyph_data.rect.h}))
                 {
                     done = 1;
@@ -2579,49 +7540,78 @@ Uint16 FC_GetPositionFromOffset(FC_Font* font, int x, int y, int column_width, F
         if(y < current_y)
             break;
     }
-    FC_StringListFree(ls);
 
     return position;
 }
 
-int FC_GetWrappedText(FC_Font* font, char* result, int max_result_size, Uint16 width, const char* formatted_text, ...)
+Uint16 FC_GetPositionFromOffset(FC_Font* font, int x, int y, int column_width, FC_AlignEnum align, const char* formatted_text, ...)
+{
+    char* buffer;
+    if(formatted_text == nullptr || column_width == 0 || font == nullptr || (buffer = FC_GetFormatBuffer()) == nullptr)
+        return 0;
+
+    FC_EXTRACT_VARARGS(buffer, formatted_text);
+
+    return FC_GetTextPositionFromOffset(font, x, y, column_width, align, buffer, -1);
+}
+
+int FC_GetTextWrapped(FC_Font* font, char* result, int max_result_size, Uint16 width, const char* text, int len)
 {
-    FC_StringList *ls, *iter;
+    FC_LineWrap wrap;
+    const char* line;
+    int line_len;
 
     if(font == nullptr)
         return 0;
 
-    if(formatted_text == nullptr || width == 0)
+    if(text == nullptr || width == 0)
         return 0;
 
-    FC_EXTRACT_VARARGS(fc_buffer, formatted_text);
+    if(len < 0)
+        len = strlen(text);
 
-    ls = FC_GetBufferFitToColumn(font, width, {1,1}, 0);
+    Uint64 start = SDL_GetPerformanceCounter();
+    FC_BeginLineWrap(&wrap, font, width, 0, text, len);
     int size_so_far = 0;
     int size_remaining = max_result_size-1; // reserve for \0
-    for(iter = ls; iter != nullptr && size_remaining > 0; iter = iter->next)
+    while(size_remaining > 0 && FC_NextWrappedLine(&wrap, &line, &line_len))
     {
         // Copy as much of this line as we can
-        int len = strlen(iter->value);
-        int num_bytes = FC_MIN(len, size_remaining);
-        memcpy(&result[size_so_far], iter->value, num_bytes);
+        int num_bytes = FC_MIN(line_len, size_remaining);
+        memcpy(&result[size_so_far], line, num_bytes);
         size_so_far += num_bytes;
+        size_remaining -= num_bytes;
 
         // If there's another line, add newline character
-        if(size_remaining > 0 && iter->next != nullptr)
+        if(size_remaining > 0 && wrap.pos != nullptr)
         {
             --size_remaining;
             result[size_so_far] = '\n';
             ++size_so_far;
         }
     }
-    FC_StringListFree(ls);
 
     result[size_so_far] = '\0';
+    if(FC_IsFontThread(font))
+        font->stats.layout_us += FC_GetMicroseconds(start);
 
     return size_so_far;
 }
 
+int FC_GetWrappedText(FC_Font* font, char* result, int max_result_size, Uint16 width, const char* formatted_text, ...)
+{
+    char* buffer;
+    if(font == nullptr)
+        return 0;
+
+    if(formatted_text == nullptr || width == 0 || (buffer = FC_GetFormatBuffer()) == nullptr)
+        return 0;
+
+    FC_EXTRACT_VARARGS(buffer, formatted_text);
+
+    return FC_GetTextWrapped(font, result, max_result_size, width, buffer, -1);
+}
+
 
 
 // Setters
@@ -2629,13 +7619,16 @@ int FC_GetWrappedText(FC_Font* font, char* result, int max_result_size, Uint16 w
 
 void FC_SetFilterMode(FC_Font* font, FC_FilterEnum filter)
 {
+    FC_Font* owner;
+    int i;
     if(font == nullptr)
         return;
 
-    if(font->filter != filter)
-    {
-        font->filter = filter;
-    }
+    // The levels are only refiltered, so glyphs already packed keep the padding they were packed with
+    owner = FC_GetCacheOwner(font);
+    font->filter = owner->filter = filter;
+    for(i = 0; i < owner->glyph_cache_count; ++i)
+        FC_SetLevelFilter(owner, owner->glyph_cache[i]);
 }
 
 
@@ -2645,6 +7638,7 @@ void FC_SetSpacing(FC_Font* font, int LetterSpacing)
         return;
 
     font->letterSpacing = LetterSpacing;
+    ++font->generation;
 }
 
 void FC_SetLineSpacing(FC_Font* font, int LineSpacing)
@@ -2653,6 +7647,7 @@ void FC_SetLineSpacing(FC_Font* font, int LineSpacing)
         return;
 
     font->lineSpacing = LineSpacing;
+    ++font->generation;
 }
 
 void FC_SetDefaultColor(FC_Font* font, SDL_Color color)
@@ -56,6 +56,22 @@ typedef enum
     FC_FILTER_LINEAR
 } FC_FilterEnum;
 
+typedef enum
+{
+    FC_CACHE_FORMAT_RGBA8888,
+    FC_CACHE_FORMAT_ALPHA
+} FC_CacheFormatEnum;
+
+// What a stats callback is told about.  The value passed along with each is noted here.
+typedef enum
+{
+    FC_STATS_GLYPH_RENDERED,  // A glyph missing from the cache was rendered; microseconds it took, including packing
+    FC_STATS_CACHE_LEVEL_ADDED,  // A cache level was added; its index
+    FC_STATS_CACHE_LEVEL_EVICTED,  // A cache level was emptied to make room; its index
+    FC_STATS_UPLOADS_FLUSHED,  // Staged glyphs were copied onto the cache textures; how many
+    FC_STATS_LAYOUT_BUILT  // An FC_TextLayout was laid out; microseconds it took
+} FC_StatsEventEnum;
+
 typedef struct FC_Scale
 {
     float x;
@@ -71,16 +87,80 @@ typedef struct FC_Effect
 
 } FC_Effect;
 
+typedef struct FC_ColorRun
+{
+    int offset;  // Byte offset into the text where this color starts
+    SDL_Color color;
+
+} FC_ColorRun;
+
+// A string to measure, for the batch measuring functions
+typedef struct FC_TextSpan
+{
+    const char* text;
+    int len;  // In bytes, or -1 if 'text' is NUL-terminated
+
+} FC_TextSpan;
+
 // Opaque type
 typedef struct FC_Font FC_Font;
 
+// Opaque type for glyph cache levels that several fonts pack into
+typedef struct FC_Atlas FC_Atlas;
+
+// Opaque handle for a font that is loading in the background
+typedef struct FC_FontLoad FC_FontLoad;
+
+// Opaque type for a font file in memory that several fonts load from
+typedef struct FC_FontSource FC_FontSource;
+
+// Opaque type for a string laid out once and drawn many times
+typedef struct FC_TextLayout FC_TextLayout;
+
+// Opaque type for text that is edited in place and queried for caret positions
+typedef struct FC_EditLayout FC_EditLayout;
+
+// Opaque type for text draws recorded now and drawn later
+typedef struct FC_DrawList FC_DrawList;
+
+// Glyph box and advance from SDL_ttf, relative to the pen position on the baseline
+typedef struct FC_GlyphMetrics
+{
+    Sint16 minx, maxx;
+    Sint16 miny, maxy;
+    Sint16 advance;
+
+} FC_GlyphMetrics;
+
 typedef struct FC_GlyphData
 {
     SDL_Rect rect;
     int cache_level;
+    FC_GlyphMetrics metrics;
 
 } FC_GlyphData;
 
+// Counters since the font was created or FC_ResetStats() was last called, and the current state of its cache
+typedef struct FC_Stats
+{
+    Uint32 glyph_hits;  // FC_GetGlyphData() lookups that found the glyph cached
+    Uint32 glyph_misses;  // Lookups that had to render the glyph
+    Uint32 glyphs_rendered;  // Glyphs rendered by SDL_ttf, including the loading string
+    Uint32 glyph_uploads;  // Glyphs staged by FC_AddGlyphToCache()
+    Uint32 target_switches;  // SDL_SetRenderTarget() calls made to update the cache textures
+    Uint32 render_calls;  // Glyphs drawn through the render callback plus SDL_RenderGeometry() calls
+    Uint32 levels_evicted;
+    Uint32 run_cache_hits;  // Draws that took their quads from the run cache
+    Uint32 run_cache_misses;  // Draws that had to lay out a run to keep in the run cache
+    Uint64 layout_us;  // Microseconds spent laying out FC_TextLayouts and wrapping text in FC_GetTextWrapped() and FC_GetTextColumnHeight()
+
+    int num_cache_levels;
+    float cache_occupancy;  // Fraction (0 to 1) of the packed cache levels' area taken by glyphs and their padding
+    Uint64 cache_bytes;  // Texture memory of the cache levels
+    Uint64 run_cache_bytes;  // Memory of the runs in the run cache
+
+} FC_Stats;
+
 
 
 // Object creation
@@ -94,12 +174,59 @@ FC_GlyphData FC_MakeGlyphData(int cache_level, Sint16 x, Sint16 y, Uint16 w, Uin
 
 FC_Font* FC_CreateFont(void);
 
+/*! Loads the font and caches the glyphs of its loading string on the renderer.
+ *  With a nullptr renderer the font is headless: it keeps only glyph metrics and never creates textures, so all of the measuring functions (FC_GetWidth(), FC_GetColumnHeight(), FC_GetWrappedText(), FC_GetBounds(), ...) work but drawing does nothing.
+ *  Separate headless fonts can be loaded, used and freed on separate threads.  SDL_FontCache takes turns opening and closing its TTF_Fonts, since SDL_ttf does that with one FreeType library, so the program must not open or close TTF_Fonts of its own on another thread at the same time. */
 Uint8 FC_LoadFont(FC_Font* font, SDL_Renderer* renderer, const char* filename_ttf, Uint32 pointSize, SDL_Color color, int style);
 
 Uint8 FC_LoadFontFromTTF(FC_Font* font, SDL_Renderer* renderer, TTF_Font* ttf, SDL_Color color);
 
+/*! Loads the font from the RWops.  New glyphs can only be loaded later if own_rwops is set, since the font keeps reading from the RWops.  Use a font source to load from memory the caller manages. */
 Uint8 FC_LoadFont_RW(FC_Font* font, SDL_Renderer* renderer, SDL_RWops* file_rwops_ttf, Uint8 own_rwops, Uint32 pointSize, SDL_Color color, int style);
 
+/*! Opens a font file once for any number of fonts to load from, so each size or style of a family doesn't read and keep its own copy.  The file is memory-mapped where mmap() is available and read into memory otherwise.
+ *  Fonts loaded from a source share its memory and can always load new glyphs.  Returns nullptr on failure. */
+FC_FontSource* FC_CreateFontSource(const char* filename_ttf);
+
+/*! Reads the whole RWops into a new font source.  Closes it if own_rwops is set. */
+FC_FontSource* FC_CreateFontSource_RW(SDL_RWops* file_rwops_ttf, Uint8 own_rwops);
+
+/*! Makes a font source that reads from the caller's buffer without copying it.  The buffer must stay valid until every font loaded from the source is cleared or freed. */
+FC_FontSource* FC_CreateFontSourceFromMemory(const void* data, size_t size);
+
+/*! Drops the caller's reference to the source.  Fonts loaded from it keep their own, so this can be called as soon as they are loaded, and the memory goes when the last of them is cleared or freed. */
+void FC_FreeFontSource(FC_FontSource* source);
+
+/*! Loads the font at the given size and style from the source, keeping a reference to it.  Otherwise the same as FC_LoadFont(). */
+Uint8 FC_LoadFontFromSource(FC_Font* font, SDL_Renderer* renderer, FC_FontSource* source, Uint32 pointSize, SDL_Color color, int style);
+
+/*! Writes the font's glyph cache to 'dst', so a later run can load it with FC_LoadFontCache() instead of rendering the loading string again.
+ *  The file holds each cache level's coverage (one byte per pixel), the glyph table and packing state, and the metrics of the TTF_Font it was made with.
+ *  Reading the cache levels back needs render target support.  Closes 'dst' if own_rwops is set.  Returns 0 on failure. */
+Uint8 FC_SaveFontCache(FC_Font* font, SDL_RWops* dst, Uint8 own_rwops);
+
+/*! Loads the font like FC_LoadFontFromTTF(), but takes its glyph cache from a file written by FC_SaveFontCache(), so startup is one texture upload per cache level.  Glyphs missing from the file are still rendered from 'ttf' as needed.
+ *  Returns 0 without changing the font if the file is damaged or was saved with a different face, size, style or distance field spread, so the caller can fall back to FC_LoadFontFromTTF().  Closes 'src' if own_rwops is set. */
+Uint8 FC_LoadFontCache(FC_Font* font, SDL_Renderer* renderer, TTF_Font* ttf, SDL_Color color, SDL_RWops* src, Uint8 own_rwops);
+
+/*! Starts loading a font in the background.  The glyphs of the loading string are rasterized by 'num_threads' worker threads (0 uses one per CPU), each with its own TTF_Font, and packed off the main thread.
+ *  The font file is read into memory up front, so the RWops is done with when this returns.  The font must not be used or freed until FC_FinishFontLoad() is called.  Returns nullptr on failure. */
+FC_FontLoad* FC_LoadFontAsync(FC_Font* font, SDL_Renderer* renderer, const char* filename_ttf, Uint32 pointSize, SDL_Color color, int style, int num_threads);
+
+FC_FontLoad* FC_LoadFontAsync_RW(FC_Font* font, SDL_Renderer* renderer, SDL_RWops* file_rwops_ttf, Uint8 own_rwops, Uint32 pointSize, SDL_Color color, int style, int num_threads);
+
+/*! Starts loading the font in the background from a font source, which the workers read from without copying it. */
+FC_FontLoad* FC_LoadFontAsyncFromSource(FC_Font* font, SDL_Renderer* renderer, FC_FontSource* source, Uint32 pointSize, SDL_Color color, int style, int num_threads);
+
+/*! Returns 1 once the background work is done and FC_FinishFontLoad() will not block. */
+Uint8 FC_PollFontLoad(FC_FontLoad* load);
+
+/*! Waits for the background work, uploads the packed glyph caches to the renderer, and frees the handle.  Must be called on the thread that owns the renderer.  Returns 1 on success. */
+Uint8 FC_FinishFontLoad(FC_FontLoad* load);
+
+/*! Restores the font's cache levels after an SDL_RENDER_TARGETS_RESET or SDL_RENDER_DEVICE_RESET event ('evType'), onto 'renderer', which may be a new one.
+ *  Levels with a shadow (see FC_SetCacheShadowing()) are made again from it with one upload each, and the font keeps all of its glyphs.  Other levels the font packed start over empty, and their glyphs
+ *  are rendered again the next time they're drawn.  After a device reset the old textures are left alone, since they went with the old device.  Fonts that share an atlas are all restored by calling this for any one of them. */
 void FC_ResetFontFromRendererReset(FC_Font* font, SDL_Renderer* renderer, Uint32 evType);
 
 void FC_ClearFont(FC_Font* font);
@@ -168,10 +295,86 @@ void U8_strdel(char* string, int position);
 /*! Sets the string from which to load the initial glyphs.  Use this if you need upfront loading for any reason (such as lack of render-target support). */
 void FC_SetLoadingString(FC_Font* font, const char* string);
 
-/*! Returns the size of the internal buffer which is used for unpacking variadic text data.  This buffer is shared by all FC_Fonts. */
+/*! Adds an inclusive range of Unicode values (such as 0x400 to 0x4FF for Cyrillic) to load up front along with the loading string.  Only characters the font provides are loaded, so a wide range costs no texture space for the ones it lacks.
+ *  Control characters and values past U+10FFFF are left out.  Ranges are kept when the font is reloaded.  Returns 0 if nothing is left of the range or memory runs out. */
+Uint8 FC_AddLoadingRange(FC_Font* font, Uint32 first, Uint32 last);
+
+/*! Removes the ranges added with FC_AddLoadingRange().  Glyphs already loaded stay cached. */
+void FC_ClearLoadingRanges(FC_Font* font);
+
+/*! Sets the width and height, in pixels, of the font's glyph cache levels.  0 (the default) uses 12 times the line height.  The size is clamped to the renderer's maximum texture size and takes effect the next time the font is loaded. */
+void FC_SetCacheLevelSize(FC_Font* font, int size);
+
+/*! Returns the size of the font's glyph cache levels, or the requested size if the font hasn't been loaded yet. */
+int FC_GetCacheLevelSize(FC_Font* font);
+
+/*! Limits how many glyph cache levels the font keeps, which bounds its texture memory to about max_levels * size * size * 4 bytes (2 bytes with a packed FC_CACHE_FORMAT_ALPHA format).  0 (the default) means no limit.
+ *  When a glyph doesn't fit and the limit is reached, the least recently used level is emptied and reused instead, and its glyphs are rendered again the next time they are drawn.
+ *  Levels used since the last draw are never emptied, so a single draw that needs glyphs from more levels than the limit still adds levels.
+ *  Only levels the font packed itself are evicted, and only when it has a TTF_Font to render from. */
+void FC_SetCacheLevelLimit(FC_Font* font, int max_levels);
+
+/*! Returns the glyph cache level limit, or 0 if there is none. */
+int FC_GetCacheLevelLimit(FC_Font* font);
+
+/*! Sets how the font's glyph cache levels are stored.  FC_CACHE_FORMAT_RGBA8888 (the default) uses 4 bytes per pixel.
+ *  Glyphs are rendered white and colored when drawn, so FC_CACHE_FORMAT_ALPHA only keeps their coverage, in the smallest format with an alpha channel that the renderer lists (one of the 16-bit 4444 formats).
+ *  The coverage is then quantized to 16 levels, which is usually invisible at text sizes.  Renderers that don't list such a format keep using RGBA8888.  Takes effect the next time the font is loaded. */
+void FC_SetCacheFormat(FC_Font* font, FC_CacheFormatEnum format);
+
+/*! Returns the requested glyph cache format. */
+FC_CacheFormatEnum FC_GetCacheFormat(FC_Font* font);
+
+/*! Keeps a copy of each glyph cache level in system memory, updated as glyphs are added, so FC_ResetFontFromRendererReset() can put the levels back without rendering any glyphs again.
+ *  The copies take 4 bytes per pixel of every level.  Levels the font already has are read back from their textures, which needs render target support.  For fonts that share an atlas, this applies to the atlas. */
+void FC_SetCacheShadowing(FC_Font* font, Uint8 enable);
+
+/*! Returns 1 if the font's cache levels are shadowed in system memory. */
+Uint8 FC_GetCacheShadowing(FC_Font* font);
+
+/*! Stores the font's glyphs as signed distance fields instead of coverage, so a font loaded once at a large reference size can be drawn at any FC_Scale with sharp edges by a shader that thresholds the field (see FC_GetDistanceFieldShader()).
+ *  The field is 128 on a glyph's outline and reaches 255 and 0 'spread' pixels inside and outside of it.  Each glyph is cached with 'spread' pixels of room on every side for the falloff, which is drawn around the glyph without moving it.  0 (the default) stores coverage.  Also switches the font to FC_FILTER_LINEAR, which distance fields need.
+ *  Drawn without a shader, glyphs come out with edges about 2*spread pixels soft at the reference size, so a spread of 2 to 4 stays readable either way.  Takes effect the next time the font is loaded. */
+void FC_SetDistanceField(FC_Font* font, int spread);
+
+/*! Returns the distance field spread, or 0 if the font stores coverage. */
+int FC_GetDistanceField(FC_Font* font);
+
+/*! Makes the font keep the glyph quads of the text it draws, up to about max_bytes of memory, so drawing the same text with the same box size, alignment and scale again skips decoding, glyph lookups and wrapping.
+ *  Runs that only moved or changed color are reused too.  The least recently drawn runs are dropped to stay under the limit.  0 (the default) turns the cache off and frees it.
+ *  Only used while drawing in batches to the font's renderer, and not for color runs.  Hits and misses are counted in FC_GetStats(). */
+void FC_SetRunCacheLimit(FC_Font* font, Uint32 max_bytes);
+
+/*! Returns the run cache limit in bytes, or 0 if the cache is off. */
+Uint32 FC_GetRunCacheLimit(FC_Font* font);
+
+/*! Creates glyph cache levels that fonts attached with FC_SetFontAtlas() share, so text mixing several fonts draws from the same textures.
+ *  level_size is the width and height of each level (0 for 1024), clamped to the renderer's maximum texture size.  max_levels works like FC_SetCacheLevelLimit() for all of the fonts together.
+ *  Requires render target support, since glyphs are only added as they are needed.  Returns nullptr on failure. */
+FC_Atlas* FC_CreateAtlas(SDL_Renderer* renderer, int level_size, int max_levels);
+
+/*! Frees the atlas and its textures.  Fonts still attached to it lose their glyphs and go back to caching them on their own. */
+void FC_FreeAtlas(FC_Atlas* atlas);
+
+/*! Makes the font pack its glyphs into the atlas instead of its own cache levels.  Must be called before the font is loaded, and the font must then be loaded with the atlas's renderer.
+ *  The font's cache level size, limit and format are ignored in favor of the atlas's.  Atlas fonts can't be loaded asynchronously or from a saved cache.  Pass nullptr to detach an unloaded font. */
+Uint8 FC_SetFontAtlas(FC_Font* font, FC_Atlas* atlas);
+
+/*! Returns the atlas that the font packs into, or nullptr. */
+FC_Atlas* FC_GetFontAtlas(FC_Font* font);
+
+/*! Sets the font that glyphs missing from this font's TTF_Font are taken from.  The fallback can have fallbacks of its own, up to 8 fonts deep.
+ *  Borrowed glyphs are moved onto this font's baseline and packed into this font's cache levels (or atlas), so they draw in the same batch.  Fonts without an atlas don't use the chain for their loading string.
+ *  The fallback must stay loaded for as long as this font uses it. */
+void FC_SetFallbackFont(FC_Font* font, FC_Font* fallback);
+
+/*! Returns the font's fallback, or nullptr. */
+FC_Font* FC_GetFallbackFont(FC_Font* font);
+
+/*! Returns the size of the internal buffer which is used for unpacking variadic text data.  Each thread gets its own buffer of this size, shared by all FC_Fonts, so formatting never clobbers another thread's text.  Only measuring can happen on other threads, though; drawing still belongs on the renderer's thread. */
 unsigned int FC_GetBufferSize(void);
 
-/*! Changes the size of the internal buffer which is used for unpacking variadic text data.  This buffer is shared by all FC_Fonts. */
+/*! Changes the size of the internal buffer which is used for unpacking variadic text data.  Formatted text longer than this is truncated; the FC_*Text*() functions take their text as-is and have no such limit. */
 void FC_SetBufferSize(unsigned int size);
 
 /*! Returns the width of a single horizontal tab in multiples of the width of a space (default: 4) */
@@ -184,6 +387,19 @@ void FC_SetRenderCallback(SDL_Rect (*callback)(SDL_Texture* src, SDL_Rect* srcre
 
 SDL_Rect FC_DefaultRenderCallback(SDL_Texture* src, SDL_Rect* srcrect, SDL_Renderer* dest, int x, int y, float xscale, float yscale);
 
+/*! Sets a function that is called with begin set to 1 right before the font's glyphs are sent to 'dest', and with begin set to 0 right after, so a shader can be bound around them.
+ *  Batched drawing calls it once per draw call (once per FC_DrawTextLayout() for layouts); drawing glyph by glyph may call it once per line.  Pass nullptr to remove it. */
+void FC_SetDistanceFieldCallback(FC_Font* font, void (*callback)(FC_Font* font, SDL_Renderer* dest, Uint8 begin, void* userdata), void* userdata);
+
+/*! Returns the source of a GLSL fragment shader that draws distance field glyphs, antialiased over one screen pixel at any scale.  It uses the names of SDL's OpenGL renderer (tex0, v_color and v_texCoord), so other renderers need them changed. */
+const char* FC_GetDistanceFieldShader(void);
+
+/*! Enables or disables batched drawing, which submits each string with one SDL_RenderGeometry call per cache level (default: enabled when built against SDL 2.0.18 or later).  While a custom render callback is set, glyphs are always drawn one at a time through it. */
+void FC_SetBatchRendering(Uint8 enable);
+
+/*! Returns 1 if batched drawing is enabled. */
+Uint8 FC_GetBatchRendering(void);
+
 
 // Custom caching
 
@@ -200,6 +416,9 @@ Uint8 FC_SetGlyphCacheLevel(FC_Font* font, int cache_level, SDL_Texture* cache_t
 /*! Copies the given surface to the given cache level as a texture.  New cache levels must be sequential. */
 Uint8 FC_UploadGlyphCache(FC_Font* font, int cache_level, SDL_Surface* data_surface);
 
+/*! Returns the fraction (0 to 1) of the given cache level that is covered by packed glyphs and their padding.  Levels that no glyphs were packed into report 0. */
+float FC_GetCacheLevelOccupancy(FC_Font* font, int cache_level);
+
 
 /*! Returns the number of codepoints that are stored in the font's glyph data map. */
 unsigned int FC_GetNumCodepoints(FC_Font* font);
@@ -210,12 +429,60 @@ void FC_GetCodepoints(FC_Font* font, Uint32* result);
 /*! Stores the glyph data for the given codepoint in 'result'.  Returns 0 if the codepoint was not found in the cache. */
 Uint8 FC_GetGlyphData(FC_Font* font, FC_GlyphData* result, Uint32 codepoint);
 
-/*! Sets the glyph data for the given codepoint.  Duplicates are not checked.  Returns a pointer to the stored data. */
+/*! Sets the glyph data for the given codepoint, replacing any existing entry.  Returns a pointer to the stored data, which stays valid until the next glyph is added. */
 FC_GlyphData* FC_SetGlyphData(FC_Font* font, Uint32 codepoint, FC_GlyphData glyph_data);
 
+/*! Copies glyphs that were loaded on demand onto their cache textures.  New glyphs are staged on the CPU and uploaded together, one render target switch per cache level.
+ *  The draw functions call this before drawing, so it is only needed when using the cache textures directly or to move the upload to a convenient point in the frame. */
+void FC_FlushGlyphUploads(FC_Font* font);
+
+/*! Queues an inclusive range of Unicode values for FC_WarmGlyphs() to render ahead of time, such as the script of a language about to be shown.  Control characters and values past U+10FFFF are left out.
+ *  The queue is kept when the font is reloaded, so it can be filled before an asynchronous load finishes.  Returns 0 if nothing is left of the range or memory runs out. */
+Uint8 FC_QueueGlyphRange(FC_Font* font, Uint32 first, Uint32 last);
+
+/*! Queues the characters of the given text that aren't cached yet, such as the strings of the next screen.  'len' is in bytes, or -1 for a null-terminated string.  Returns 0 if memory runs out. */
+Uint8 FC_QueueGlyphsFromText(FC_Font* font, const char* text, int len);
+
+/*! Renders queued glyphs until about budget_us microseconds have passed, then uploads them.  Call it once a frame to spread the cost of new glyphs out instead of paying it in the frame that first draws them.
+ *  At least one codepoint is handled per call.  Ones that are already cached or that neither the font nor its fallbacks provide are dropped without rendering.
+ *  Nothing happens while the font has no TTF_Font to render from.  Returns the number of codepoints still queued. */
+int FC_WarmGlyphs(FC_Font* font, Uint32 budget_us);
+
+/*! Returns the number of codepoints waiting for FC_WarmGlyphs(), counting ones it will drop without rendering. */
+int FC_GetNumQueuedGlyphs(FC_Font* font);
+
+
+// Statistics
+
+/*! Returns the font's counters and the state of its cache.  Fonts that share an atlas count their own lookups and draws, but report the atlas's target switches, evictions and cache levels.
+ *  Only the thread that created or last loaded the font counts lookups and layout time; measuring on other threads leaves the counters alone. */
+FC_Stats FC_GetStats(FC_Font* font);
+
+/*! Zeroes the font's counters, and the atlas's if it uses one. */
+void FC_ResetStats(FC_Font* font);
+
+/*! Sets a function that is called as the events in FC_StatsEventEnum happen to the font, for feeding them to telemetry.  Pass nullptr to remove it.
+ *  Events caused by a font that uses an atlas are reported to that font.  The callback must not draw with or change the font. */
+void FC_SetStatsCallback(FC_Font* font, void (*callback)(FC_Font* font, FC_StatsEventEnum event, Uint32 value, void* userdata), void* userdata);
+
 
 // Rendering
 
+/*! Glyphs that fall outside the renderer's viewport and clip rect are skipped rather than submitted, though they still count toward the returned rect.
+ *  Centered and right-aligned lines that are entirely hidden aren't measured, so they don't count toward it.  Boxes and columns stop laying out lines once they pass the bottom of the visible area. */
+
+/*! Non-variadic drawing: 'text' is used as-is (no format specifiers).  If 'len' is negative, 'text' must be NUL-terminated; otherwise only the first 'len' bytes are drawn.
+ *  Like all drawing, these must be called on the thread that owns the renderer: they fill the font's shared glyph batch, mark its cache levels as used, and change the cache textures' color mods when not batching. */
+SDL_Rect FC_DrawText(FC_Font* font, SDL_Renderer* dest, int x, int y, const char* text, int len);
+SDL_Rect FC_DrawTextEffect(FC_Font* font, SDL_Renderer* dest, int x, int y, FC_Effect effect, const char* text, int len);
+SDL_Rect FC_DrawTextBox(FC_Font* font, SDL_Renderer* dest, SDL_Rect box, FC_Effect effect, const char* text, int len);
+SDL_Rect FC_DrawTextColumn(FC_Font* font, SDL_Renderer* dest, int x, int y, Uint16 width, FC_Effect effect, const char* text, int len);
+
+/*! Like FC_DrawTextEffect() and FC_DrawTextBox(), but each of the 'num_runs' runs, sorted by offset, colors the text from its offset up to the next run.  Text before the first run uses effect.color.
+ *  With batch rendering the colors go into the glyph vertices, so the whole string is still one submission per cache level.  Otherwise the cache textures are recolored where the runs change. */
+SDL_Rect FC_DrawTextRuns(FC_Font* font, SDL_Renderer* dest, int x, int y, FC_Effect effect, const char* text, int len, const FC_ColorRun* runs, int num_runs);
+SDL_Rect FC_DrawTextBoxRuns(FC_Font* font, SDL_Renderer* dest, SDL_Rect box, FC_Effect effect, const char* text, int len, const FC_ColorRun* runs, int num_runs);
+
 SDL_Rect FC_Draw(FC_Font* font, SDL_Renderer* dest, int x, int y, const char* formatted_text, ...);
 SDL_Rect FC_DrawAlign(FC_Font* font, SDL_Renderer* dest, int x, int y, FC_AlignEnum align, const char* formatted_text, ...);
 SDL_Rect FC_DrawScale(FC_Font* font, SDL_Renderer* dest, int x, int y, FC_Scale scale, const char* formatted_text, ...);
@@ -235,6 +502,87 @@ SDL_Rect FC_DrawColumnColor(FC_Font* font, SDL_Renderer* dest, int x, int y, Uin
 SDL_Rect FC_DrawColumnEffect(FC_Font* font, SDL_Renderer* dest, int x, int y, Uint16 width, FC_Effect effect, const char* formatted_text, ...);
 
 
+// Text layouts
+
+/*! Creates a layout for text that is drawn repeatedly.  The text is wrapped, aligned and turned into glyph quads once, and each FC_DrawTextLayout() only submits them.
+ *  If box.w is 0, the text is drawn like FC_DrawTextEffect() at (box.x, box.y).  Otherwise it is wrapped to the box like FC_DrawTextBox(), clipped to the box if box.h is not 0.
+ *  The layout is rebuilt when its text, box or effect change, or when the font's glyphs are changed or reloaded.  Free layouts before their font. */
+FC_TextLayout* FC_CreateTextLayout(FC_Font* font, SDL_Rect box, FC_Effect effect, const char* text, int len);
+void FC_FreeTextLayout(FC_TextLayout* layout);
+
+/*! Changes the layout's text.  Setting the same text again does nothing. */
+void FC_SetTextLayoutText(FC_TextLayout* layout, const char* text, int len);
+
+/*! Changes the layout's box.  Moving a box without resizing it does not rebuild the layout. */
+void FC_SetTextLayoutBox(FC_TextLayout* layout, SDL_Rect box);
+void FC_SetTextLayoutEffect(FC_TextLayout* layout, FC_Effect effect);
+
+/*! Returns the area the layout covers, as the equivalent FC_Draw*() call would. */
+SDL_Rect FC_GetTextLayoutBounds(FC_TextLayout* layout);
+
+/*! Draws the layout.  With batched rendering off or a custom render callback set, the text is laid out again on every draw. */
+SDL_Rect FC_DrawTextLayout(FC_TextLayout* layout, SDL_Renderer* dest);
+
+
+// Editable layouts
+
+/*! Creates a layout for text being edited, wrapped to column_width (0 for no wrapping).  It keeps where each line breaks and where each character on a line starts,
+ *  so an edit only re-wraps the newline-separated paragraphs it touches and caret queries are binary searches instead of walks over the whole text.
+ *  Positions are UTF-8 character indexes into the layout's own copy of the text, with each newline counting as a character.
+ *  The layout is re-wrapped when the font's glyphs or spacing change, or when the font is reloaded.  Free layouts before their font. */
+FC_EditLayout* FC_CreateEditLayout(FC_Font* font, int column_width, const char* text, int len);
+void FC_FreeEditLayout(FC_EditLayout* layout);
+
+/*! Inserts UTF-8 text in front of the character at 'position', like U8_strinsert().  Use a position of -1 to append.  Returns 0 when unable to insert the text. */
+Uint8 FC_EditLayoutInsert(FC_EditLayout* layout, int position, const char* text, int len);
+
+/*! Erases 'count' characters starting at 'position', like calling U8_strdel() that many times. */
+void FC_EditLayoutDelete(FC_EditLayout* layout, int position, int count);
+
+/*! Changes the width the text is wrapped to, which re-wraps all of it. */
+void FC_SetEditLayoutWidth(FC_EditLayout* layout, int column_width);
+
+/*! Returns the layout's text, which stays valid until the next edit. */
+const char* FC_GetEditLayoutText(FC_EditLayout* layout);
+int FC_GetEditLayoutLength(FC_EditLayout* layout);
+int FC_GetEditLayoutNumLines(FC_EditLayout* layout);
+
+/*! Returns a 1-pixel wide caret box in front of the character at 'position', relative to the top-left corner of the text.  The length of the text is the position after its last character. */
+SDL_Rect FC_GetEditLayoutCharacterOffset(FC_EditLayout* layout, int position);
+
+/*! Given an offset (x,y) from the top-left corner of the text, returns the caret position closest to it. */
+int FC_GetEditLayoutPositionFromOffset(FC_EditLayout* layout, int x, int y);
+
+/*! Draws the text left-aligned with its top-left corner at (x, y).  Only the lines inside the renderer's viewport and clip rect are drawn.
+ *  Lines are spaced like FC_GetHeight(), so the font's line spacing goes between them, and the same goes for the caret offsets. */
+SDL_Rect FC_DrawEditLayout(FC_EditLayout* layout, SDL_Renderer* dest, int x, int y, SDL_Color color);
+
+
+// Draw lists
+
+/*! Creates a list that text draws are recorded into and replayed from with FC_RenderDrawList().  Recording only copies the text and parameters and never reads the fonts,
+ *  so each thread that builds part of a frame can record into its own list while the render thread is drawing.  A list must only be used by one thread at a time. */
+FC_DrawList* FC_CreateDrawList(void);
+void FC_FreeDrawList(FC_DrawList* list);
+
+/*! Empties the list, keeping its memory for the next frame.  Lists aren't emptied by drawing them, so static text can be recorded once and drawn every frame. */
+void FC_ClearDrawList(FC_DrawList* list);
+
+/*! Returns the number of recorded draws. */
+int FC_GetDrawListCount(FC_DrawList* list);
+
+/*! Records a draw like FC_DrawTextEffect().  'len' is in bytes, or -1 for a null-terminated string.  The font must stay loaded until the list is drawn.  Returns 0 if memory runs out. */
+Uint8 FC_DrawListAddText(FC_DrawList* list, FC_Font* font, int x, int y, FC_Effect effect, const char* text, int len);
+
+/*! Records a draw like FC_DrawTextBox(), wrapped to the box and cut off at its edges. */
+Uint8 FC_DrawListAddTextBox(FC_DrawList* list, FC_Font* font, SDL_Rect box, FC_Effect effect, const char* text, int len);
+
+/*! Draws the recorded text in order, on the thread that owns the renderer.  Layout and glyph lookups happen here, since fonts can't be read while another thread adds glyphs to them.
+ *  Runs of draws that use the same font are batched together: their missing glyphs are rendered, uploaded once, and each cache level is drawn with one call.
+ *  Boxes are cut by trimming their glyph quads instead of setting a clip rect.  With batching off or a render callback set, each draw is made the usual way. */
+void FC_RenderDrawList(FC_DrawList* list, SDL_Renderer* dest);
+
+
 // Getters
 
 FC_FilterEnum FC_GetFilterMode(FC_Font* font);
@@ -263,8 +611,30 @@ Uint16 FC_GetPositionFromOffset(FC_Font* font, int x, int y, int column_width, F
 // Returns the number of characters in the new wrapped text written into `result`.
 int FC_GetWrappedText(FC_Font* font, char* result, int max_result_size, Uint16 width, const char* formatted_text, ...);
 
+/*! Non-variadic getters: same as above, but 'text' is used as-is.  If 'len' is negative, 'text' must be NUL-terminated.
+ *  These and the variadic getters may be called on other threads as long as every glyph they need is already cached and no thread is drawing with or changing the font at the same time. */
+Uint16 FC_GetTextHeight(FC_Font* font, const char* text, int len);
+Uint16 FC_GetTextWidth(FC_Font* font, const char* text, int len);
+SDL_Rect FC_GetTextCharacterOffset(FC_Font* font, Uint16 position_index, int column_width, const char* text, int len);
+Uint16 FC_GetTextColumnHeight(FC_Font* font, Uint16 width, const char* text, int len);
+int FC_GetTextAscent(FC_Font* font, const char* text, int len);
+int FC_GetTextDescent(FC_Font* font, const char* text, int len);
+SDL_Rect FC_GetTextBounds(FC_Font* font, int x, int y, FC_AlignEnum align, FC_Scale scale, const char* text, int len);
+
+/*! Fills results[i] with FC_GetTextBounds() of spans[i], for 'count' spans.  Each is measured in one pass over its text, with no allocation.  Missing glyphs are loaded, so call it on the thread that owns the font. */
+void FC_GetTextBoundsBatch(FC_Font* font, int x, int y, FC_AlignEnum align, FC_Scale scale, const FC_TextSpan* spans, int count, SDL_Rect* results);
+
+/*! Like FC_GetTextBoundsBatch(), but never loads glyphs or changes the font, so several threads can measure parts of a batch at the same time while nothing else uses the font.
+ *  Returns 0 if a span needed a glyph or kerning pair that isn't cached yet (such as characters the font can't draw), in which case its bounds may be off; measuring those spans once with FC_GetTextBoundsBatch() caches what they need. */
+Uint8 FC_GetCachedTextBoundsBatch(FC_Font* font, int x, int y, FC_AlignEnum align, FC_Scale scale, const FC_TextSpan* spans, int count, SDL_Rect* results);
+Uint16 FC_GetTextPositionFromOffset(FC_Font* font, int x, int y, int column_width, FC_AlignEnum align, const char* text, int len);
+int FC_GetTextWrapped(FC_Font* font, char* result, int max_result_size, Uint16 width, const char* text, int len);
+
 // Setters
 
+/*! Sets how the font's cache levels are filtered when glyphs are drawn scaled or at fractional positions.  Existing levels are switched in place, so the font doesn't need to be reloaded (with SDL 2.0.12 or later; older versions only apply it to new levels).
+ *  Glyphs are packed with more padding under FC_FILTER_LINEAR so they don't bleed into each other.  Ones packed before switching to it keep their smaller padding, so set it before loading to avoid that.
+ *  The mode is kept when the font is reloaded.  Fonts on an atlas share its mode. */
 void FC_SetFilterMode(FC_Font* font, FC_FilterEnum filter);
 void FC_SetSpacing(FC_Font* font, int LetterSpacing);
 void FC_SetLineSpacing(FC_Font* font, int LineSpacing);
@@ -0,0 +1,323 @@
+/*
+Benchmarks for SDL_FontCache's loading, drawing, measuring and wrapping paths.
+
+Everything is drawn with a software renderer onto an offscreen surface, so no window or GPU is needed.
+Results go to stdout as tab-separated lines, one per benchmark, after a header line:
+
+    name  iterations  seconds  us_per_iteration  rate  rate_unit
+
+Build from this directory with the Makefile, which finds SDL2 and SDL2_ttf through pkg-config:
+
+    make benchmark
+
+and run it from here, or pass the font and sample text:
+
+    ./benchmark [fonts/FreeSans.ttf] [utf8_sample.txt] [point size]
+*/
+
+#include "SDL_FontCache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+// Each benchmark repeats until it has run for this long
+#define BENCH_MIN_SECONDS 0.5
+#define BENCH_MAX_ITERATIONS 1000000
+
+// Copies of the sample text joined into the paragraph that is wrapped
+#define BENCH_SAMPLE_REPEATS 40
+
+typedef struct BenchContext
+{
+    SDL_Renderer* renderer;
+    const char* font_file;
+    int point_size;
+    FC_Font* font;  // Loaded with the default loading string
+    FC_DrawList* list;
+
+    std::string loading_string;  // For the load benchmarks
+    std::string line;  // One line of ASCII text
+    std::string paragraph;  // The sample text repeated
+    std::string missing;  // Characters outside of the default loading string, for lazy loading
+
+} BenchContext;
+
+static const SDL_Color black = {0, 0, 0, 255};
+
+static double get_seconds(Uint64 start)
+{
+    return (SDL_GetPerformanceCounter() - start) / (double)SDL_GetPerformanceFrequency();
+}
+
+// Runs 'fn' once to warm up, then until BENCH_MIN_SECONDS have passed, and prints a result line.
+// 'fn' returns the seconds taken by the part of it being measured.  'units' is how many of
+// 'rate_unit' one iteration does, for the rate column.
+static void run(const char* name, BenchContext* ctx, double (*fn)(BenchContext* ctx), double units, const char* rate_unit)
+{
+    double seconds = 0.0;
+    long iterations = 0;
+
+    fn(ctx);
+
+    while(seconds < BENCH_MIN_SECONDS && iterations < BENCH_MAX_ITERATIONS)
+    {
+        seconds += fn(ctx);
+        ++iterations;
+    }
+
+    printf("%s\t%ld\t%.6f\t%.3f\t%.1f\t%s\n", name, iterations, seconds, seconds * 1000000.0 / iterations,
+           (seconds > 0.0? units * iterations / seconds : 0.0), rate_unit);
+    fflush(stdout);
+}
+
+static void append_utf8(std::string& result, Uint32 unicode)
+{
+    if(unicode < 0x80)
+        result += (char)unicode;
+    else if(unicode < 0x800)
+    {
+        result += (char)(0xC0 | (unicode >> 6));
+        result += (char)(0x80 | (unicode & 0x3F));
+    }
+    else
+    {
+        result += (char)(0xE0 | (unicode >> 12));
+        result += (char)(0x80 | ((unicode >> 6) & 0x3F));
+        result += (char)(0x80 | (unicode & 0x3F));
+    }
+}
+
+// The FC_GetString*() functions return a copy for the caller to free
+static std::string take_string(char* string)
+{
+    std::string result = (string != nullptr? string : "");
+    free(string);
+    return result;
+}
+
+static std::string read_file(const char* filename)
+{
+    std::string result;
+    size_t size = 0;
+    char* data = (char*)SDL_LoadFile(filename, &size);
+    if(data != nullptr)
+    {
+        result.assign(data, size);
+        SDL_free(data);
+    }
+
+    // Skip a byte order mark and trailing newlines
+    if(result.compare(0, 3, "\xEF\xBB\xBF") == 0)
+        result.erase(0, 3);
+    while(!result.empty() && (result.back() == '\n' || result.back() == '\r'))
+        result.pop_back();
+    return result;
+}
+
+
+// Loading
+
+static double bench_load(BenchContext* ctx)
+{
+    Uint64 start = SDL_GetPerformanceCounter();
+    FC_Font* font = FC_CreateFont();
+    FC_SetLoadingString(font, ctx->loading_string.c_str());
+    FC_LoadFont(font, ctx->renderer, ctx->font_file, ctx->point_size, black, TTF_STYLE_NORMAL);
+    FC_FreeFont(font);
+    return get_seconds(start);
+}
+
+static void run_load(const char* name, BenchContext* ctx, const std::string& loading_string)
+{
+    ctx->loading_string = loading_string;
+    run(name, ctx, bench_load, U8_strlen(loading_string.c_str()), "glyphs/s");
+}
+
+
+// Drawing
+
+static double bench_draw(BenchContext* ctx)
+{
+    Uint64 start = SDL_GetPerformanceCounter();
+    FC_DrawText(ctx->font, ctx->renderer, 0, 0, ctx->line.c_str(), (int)ctx->line.size());
+    return get_seconds(start);
+}
+
+static double bench_draw_box(BenchContext* ctx)
+{
+    Uint64 start = SDL_GetPerformanceCounter();
+    FC_DrawTextBox(ctx->font, ctx->renderer, SDL_Rect{0, 0, 600, 4000}, FC_MakeEffect(FC_ALIGN_LEFT, FC_Scale{1, 1}, black),
+                   ctx->paragraph.c_str(), (int)ctx->paragraph.size());
+    return get_seconds(start);
+}
+
+// Lines of the line benchmark that go into one draw list
+#define BENCH_LIST_LINES 20
+
+// Recording and drawing a list of lines, against drawing them one call at a time
+static double bench_draw_list(BenchContext* ctx)
+{
+    Uint64 start = SDL_GetPerformanceCounter();
+    int i;
+    FC_ClearDrawList(ctx->list);
+    for(i = 0; i < BENCH_LIST_LINES; ++i)
+        FC_DrawListAddText(ctx->list, ctx->font, 0, i*20, FC_MakeEffect(FC_ALIGN_LEFT, FC_Scale{1, 1}, black), ctx->line.c_str(), (int)ctx->line.size());
+    FC_RenderDrawList(ctx->list, ctx->renderer);
+    return get_seconds(start);
+}
+
+static double bench_draw_lines(BenchContext* ctx)
+{
+    Uint64 start = SDL_GetPerformanceCounter();
+    int i;
+    for(i = 0; i < BENCH_LIST_LINES; ++i)
+        FC_DrawText(ctx->font, ctx->renderer, 0, i*20, ctx->line.c_str(), (int)ctx->line.size());
+    return get_seconds(start);
+}
+
+
+// Measuring
+
+static double bench_get_width(BenchContext* ctx)
+{
+    Uint64 start = SDL_GetPerformanceCounter();
+    FC_GetTextWidth(ctx->font, ctx->line.c_str(), (int)ctx->line.size());
+    return get_seconds(start);
+}
+
+static double bench_column_height(BenchContext* ctx)
+{
+    Uint64 start = SDL_GetPerformanceCounter();
+    FC_GetTextColumnHeight(ctx->font, 600, ctx->paragraph.c_str(), (int)ctx->paragraph.size());
+    return get_seconds(start);
+}
+
+
+// Glyph lookups
+
+static void get_glyphs(FC_Font* font, const std::string& text)
+{
+    FC_GlyphData glyph;
+    const char* c = text.c_str();
+    while(*c != '\0')
+        FC_GetGlyphData(font, &glyph, FC_GetCodepointFromUTF8(&c, 1));
+}
+
+// Every lookup misses, so each glyph is rendered, packed and staged, then uploaded.  Loading the font isn't timed.
+static double bench_glyph_miss(BenchContext* ctx)
+{
+    Uint64 start;
+    double seconds;
+    FC_Font* font = FC_CreateFont();
+    FC_SetLoadingString(font, " ");
+    FC_LoadFont(font, ctx->renderer, ctx->font_file, ctx->point_size, black, TTF_STYLE_NORMAL);
+
+    start = SDL_GetPerformanceCounter();
+    get_glyphs(font, ctx->missing);
+    FC_FlushGlyphUploads(font);
+    seconds = get_seconds(start);
+
+    FC_FreeFont(font);
+    return seconds;
+}
+
+// The warm up run caches the glyphs, so every lookup hits
+static double bench_glyph_hit(BenchContext* ctx)
+{
+    Uint64 start = SDL_GetPerformanceCounter();
+    get_glyphs(ctx->font, ctx->missing);
+    return get_seconds(start);
+}
+
+
+int main(int argc, char* argv[])
+{
+    BenchContext ctx;
+    SDL_Surface* target;
+    std::string sample;
+    std::string ascii;
+    std::string latin1;
+    std::string large;
+    Uint32 i;
+
+    ctx.font_file = (argc > 1? argv[1] : "fonts/FreeSans.ttf");
+    sample = read_file(argc > 2? argv[2] : "utf8_sample.txt");
+    ctx.point_size = (argc > 3? atoi(argv[3]) : 20);
+
+    if(SDL_Init(0) < 0 || TTF_Init() < 0)
+    {
+        fprintf(stderr, "Could not initialize SDL: %s\n", SDL_GetError());
+        return 1;
+    }
+
+    target = SDL_CreateRGBSurfaceWithFormat(0, 1024, 768, 32, SDL_PIXELFORMAT_RGBA8888);
+    ctx.renderer = (target != nullptr? SDL_CreateSoftwareRenderer(target) : nullptr);
+    if(ctx.renderer == nullptr)
+    {
+        fprintf(stderr, "Could not create a software renderer: %s\n", SDL_GetError());
+        return 1;
+    }
+
+    ctx.font = FC_CreateFont();
+    if(!FC_LoadFont(ctx.font, ctx.renderer, ctx.font_file, ctx.point_size, black, TTF_STYLE_NORMAL))
+    {
+        fprintf(stderr, "Could not load %s\n", ctx.font_file);
+        return 1;
+    }
+
+    ctx.line = "The quick brown fox jumps over the lazy dog. 0123456789 (ASCII)";
+    for(i = 0; i < BENCH_SAMPLE_REPEATS; ++i)
+    {
+        ctx.paragraph += sample;
+        ctx.paragraph += (i % 8 == 7? "\n" : " ");
+    }
+
+    // Latin Extended, Greek and Cyrillic aren't in the default loading string
+    for(i = 0x100; i < 0x180; ++i)
+        append_utf8(ctx.missing, i);
+    for(i = 0x391; i < 0x3CA; ++i)
+        append_utf8(ctx.missing, i);
+    for(i = 0x410; i < 0x450; ++i)
+        append_utf8(ctx.missing, i);
+    ascii = take_string(FC_GetStringASCII());
+    latin1 = take_string(FC_GetStringASCII_Latin1());
+    large = latin1 + ctx.missing;
+
+    printf("name\titerations\tseconds\tus_per_iteration\trate\trate_unit\n");
+
+    run_load("load_ascii", &ctx, ascii);
+    run_load("load_latin1", &ctx, latin1);
+    run_load("load_large", &ctx, large);
+
+    FC_SetBatchRendering(1);
+    run("draw_batched", &ctx, bench_draw, U8_strlen(ctx.line.c_str()), "glyphs/s");
+    FC_SetBatchRendering(0);
+    run("draw_unbatched", &ctx, bench_draw, U8_strlen(ctx.line.c_str()), "glyphs/s");
+    FC_SetBatchRendering(1);
+    run("draw_box_wrap", &ctx, bench_draw_box, U8_strlen(ctx.paragraph.c_str()), "glyphs/s");
+
+    // The same text again, from the run cache
+    FC_SetRunCacheLimit(ctx.font, 1 << 20);
+    run("draw_run_cache", &ctx, bench_draw, U8_strlen(ctx.line.c_str()), "glyphs/s");
+    run("draw_box_run_cache", &ctx, bench_draw_box, U8_strlen(ctx.paragraph.c_str()), "glyphs/s");
+    FC_SetRunCacheLimit(ctx.font, 0);
+
+    ctx.list = FC_CreateDrawList();
+    run("draw_lines", &ctx, bench_draw_lines, BENCH_LIST_LINES * U8_strlen(ctx.line.c_str()), "glyphs/s");
+    run("draw_list", &ctx, bench_draw_list, BENCH_LIST_LINES * U8_strlen(ctx.line.c_str()), "glyphs/s");
+    FC_FreeDrawList(ctx.list);
+
+    run("get_width", &ctx, bench_get_width, U8_strlen(ctx.line.c_str()), "glyphs/s");
+    run("get_column_height", &ctx, bench_column_height, U8_strlen(ctx.paragraph.c_str()), "glyphs/s");
+
+    run("glyph_miss", &ctx, bench_glyph_miss, U8_strlen(ctx.missing.c_str()), "glyphs/s");
+    run("glyph_hit", &ctx, bench_glyph_hit, U8_strlen(ctx.missing.c_str()), "glyphs/s");
+
+    FC_FreeFont(ctx.font);
+    SDL_DestroyRenderer(ctx.renderer);
+    SDL_FreeSurface(target);
+    TTF_Quit();
+    SDL_Quit();
+    return 0;
+}